@@ -0,0 +1,446 @@
+// json_object.h --- Flat JSON object parser for job files by katahiromz
+// License: Apache 2.0
+#pragma once
+
+#include <cstdint>          // C Standard Integers
+#include <cstdlib>          // For std::strtod
+#include <cstring>          // C String Library
+#include <cassert>          // For assert macro
+#include <cmath>            // For std::isfinite
+#include <string>           // For std::string
+#include <vector>           // For std::vector
+
+// JSONの値の型。
+enum JSON_TYPE
+{
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+};
+
+// JSONのメンバー。値はスカラーのみ（入れ子のオブジェクトや配列は受け付けない）。
+struct JSON_MEMBER
+{
+    std::string m_key;      // キー（UTF-8）。
+    JSON_TYPE m_type;       // 値の型。
+    std::string m_str;      // 文字列の値（UTF-8、エスケープは解除済み）。
+    double m_num;           // 数値の値。
+    bool m_bool;            // 真偽値の値。
+};
+
+typedef std::vector<JSON_MEMBER> JSON_OBJECT;
+
+// 空白を読み飛ばす。
+inline void json_skip_space(const char *& pch)
+{
+    while (*pch == ' ' || *pch == '\t' || *pch == '\r' || *pch == '\n')
+        ++pch;
+}
+
+// 数値の文法 -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)? に合う終わりを返す。合わなければnullptr。
+// std::strtodは0x10、01、1.、infなども受け付けるので、先に確かめる。
+inline const char *json_scan_number(const char *pch)
+{
+    if (*pch == '-')
+        ++pch;
+    if (*pch == '0')
+        ++pch;
+    else if ('1' <= *pch && *pch <= '9')
+        while ('0' <= *pch && *pch <= '9')
+            ++pch;
+    else
+        return nullptr;
+
+    if (*pch == '.')
+    {
+        ++pch;
+        if (!('0' <= *pch && *pch <= '9'))
+            return nullptr;
+        while ('0' <= *pch && *pch <= '9')
+            ++pch;
+    }
+
+    if (*pch == 'e' || *pch == 'E')
+    {
+        ++pch;
+        if (*pch == '+' || *pch == '-')
+            ++pch;
+        if (!('0' <= *pch && *pch <= '9'))
+            return nullptr;
+        while ('0' <= *pch && *pch <= '9')
+            ++pch;
+    }
+    return pch;
+}
+
+// 4桁の16進数を読む。
+inline bool json_parse_hex4(const char *& pch, uint32_t& value)
+{
+    value = 0;
+    for (int i = 0; i < 4; ++i, ++pch)
+    {
+        char ch = *pch;
+        value <<= 4;
+        if ('0' <= ch && ch <= '9')
+            value |= ch - '0';
+        else if ('A' <= ch && ch <= 'F')
+            value |= ch - 'A' + 10;
+        else if ('a' <= ch && ch <= 'f')
+            value |= ch - 'a' + 10;
+        else
+            return false;
+    }
+    return true;
+}
+
+// コードポイントをUTF-8で追加する。
+inline void json_append_utf8(std::string& str, uint32_t u32)
+{
+    if (u32 < 0x80)
+    {
+        str += char(u32);
+    }
+    else if (u32 < 0x800)
+    {
+        str += char(0xC0 | (u32 >> 6));
+        str += char(0x80 | (u32 & 0x3F));
+    }
+    else if (u32 < 0x10000)
+    {
+        str += char(0xE0 | (u32 >> 12));
+        str += char(0x80 | ((u32 >> 6) & 0x3F));
+        str += char(0x80 | (u32 & 0x3F));
+    }
+    else
+    {
+        str += char(0xF0 | (u32 >> 18));
+        str += char(0x80 | ((u32 >> 12) & 0x3F));
+        str += char(0x80 | ((u32 >> 6) & 0x3F));
+        str += char(0x80 | (u32 & 0x3F));
+    }
+}
+
+// UTF-8の1文字を読んで追加する。pchは先頭バイト（0x80以上）を指すこと。
+// 不正なバイト列（冗長な表現、サロゲート、U+10FFFFを超える値を含む）ならfalseを返す。
+inline bool json_parse_utf8_char(const char *& pch, std::string& str)
+{
+    const unsigned char *pb = reinterpret_cast<const unsigned char *>(pch);
+    int len;
+    uint32_t u32, min_value;
+    if ((pb[0] & 0xE0) == 0xC0)
+    {
+        len = 2;
+        u32 = pb[0] & 0x1F;
+        min_value = 0x80;
+    }
+    else if ((pb[0] & 0xF0) == 0xE0)
+    {
+        len = 3;
+        u32 = pb[0] & 0x0F;
+        min_value = 0x800;
+    }
+    else if ((pb[0] & 0xF8) == 0xF0)
+    {
+        len = 4;
+        u32 = pb[0] & 0x07;
+        min_value = 0x10000;
+    }
+    else
+    {
+        return false;
+    }
+
+    for (int i = 1; i < len; ++i)
+    {
+        if ((pb[i] & 0xC0) != 0x80) // 途中で終わっていても、ここでNUL文字に当たる。
+            return false;
+        u32 = (u32 << 6) | (pb[i] & 0x3F);
+    }
+    if (u32 < min_value || u32 > 0x10FFFF || (0xD800 <= u32 && u32 <= 0xDFFF))
+        return false;
+
+    str.append(pch, len);
+    pch += len;
+    return true;
+}
+
+// 文字列を読む。pchは開き引用符を指すこと。
+// 不正なUTF-8とU+0000は受け付けない。失敗したとき、errorがあれば理由を返す（構文の誤りなら空のまま）。
+inline bool json_parse_string(const char *& pch, std::string& str, std::string *error = nullptr)
+{
+    str.clear();
+    if (*pch != '"')
+        return false;
+    ++pch;
+
+    for (;;)
+    {
+        char ch = *pch;
+        if (ch == '"')
+        {
+            ++pch;
+            return true;
+        }
+        if ((unsigned char)ch >= 0x80)
+        {
+            if (!json_parse_utf8_char(pch, str))
+            {
+                if (error)
+                    *error = "Invalid UTF-8 in string";
+                return false;
+            }
+            continue;
+        }
+        ++pch;
+        if ((unsigned char)ch < 0x20)
+            return false;
+        if (ch != '\\')
+        {
+            str += ch;
+            continue;
+        }
+
+        switch (*pch++)
+        {
+        case '"': str += '"'; break;
+        case '\\': str += '\\'; break;
+        case '/': str += '/'; break;
+        case 'b': str += '\b'; break;
+        case 'f': str += '\f'; break;
+        case 'n': str += '\n'; break;
+        case 'r': str += '\r'; break;
+        case 't': str += '\t'; break;
+        case 'u':
+            {
+                uint32_t u32;
+                if (!json_parse_hex4(pch, u32))
+                    return false;
+                if (u32 == 0) // 文字列がC文字列として途中で切れてしまう。
+                {
+                    if (error)
+                        *error = "U+0000 in string";
+                    return false;
+                }
+                if (0xD800 <= u32 && u32 <= 0xDBFF) // 上位サロゲート？
+                {
+                    uint32_t low;
+                    if (pch[0] != '\\' || pch[1] != 'u')
+                        return false;
+                    pch += 2;
+                    if (!json_parse_hex4(pch, low) || !(0xDC00 <= low && low <= 0xDFFF))
+                        return false;
+                    u32 = 0x10000 + ((u32 - 0xD800) << 10) + (low - 0xDC00);
+                }
+                else if (0xDC00 <= u32 && u32 <= 0xDFFF) // 対になっていない下位サロゲート？
+                {
+                    return false;
+                }
+                json_append_utf8(str, u32);
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+}
+
+// 1行のJSONオブジェクトを読む。スカラーの値だけを持つ平たいオブジェクトのみ受け付ける。
+// 失敗したとき、errorがあれば文字列の誤りの理由を返す（それ以外の誤りなら空のまま）。
+inline bool json_parse_object(const char *text, JSON_OBJECT& object, std::string *error = nullptr)
+{
+    object.clear();
+
+    const char *pch = text;
+    json_skip_space(pch);
+    if (*pch++ != '{')
+        return false;
+
+    json_skip_space(pch);
+    if (*pch == '}')
+    {
+        ++pch;
+        json_skip_space(pch);
+        return *pch == 0;
+    }
+
+    for (;;)
+    {
+        JSON_MEMBER member;
+        json_skip_space(pch);
+        if (!json_parse_string(pch, member.m_key, error))
+            return false;
+        json_skip_space(pch);
+        if (*pch++ != ':')
+            return false;
+        json_skip_space(pch);
+
+        member.m_num = 0;
+        member.m_bool = false;
+        if (*pch == '"')
+        {
+            member.m_type = JSON_STRING;
+            if (!json_parse_string(pch, member.m_str, error))
+                return false;
+        }
+        else if (std::strncmp(pch, "true", 4) == 0)
+        {
+            member.m_type = JSON_BOOL;
+            member.m_bool = true;
+            pch += 4;
+        }
+        else if (std::strncmp(pch, "false", 5) == 0)
+        {
+            member.m_type = JSON_BOOL;
+            pch += 5;
+        }
+        else if (std::strncmp(pch, "null", 4) == 0)
+        {
+            member.m_type = JSON_NULL;
+            pch += 4;
+        }
+        else if (*pch == '-' || ('0' <= *pch && *pch <= '9'))
+        {
+            const char *end = json_scan_number(pch);
+            if (!end)
+                return false;
+            char *endptr;
+            member.m_type = JSON_NUMBER;
+            member.m_num = std::strtod(pch, &endptr);
+            if (endptr != end || !std::isfinite(member.m_num))
+                return false;
+            pch = end;
+        }
+        else
+        {
+            return false; // 入れ子のオブジェクト、配列、または不正な値。
+        }
+        object.push_back(std::move(member));
+
+        json_skip_space(pch);
+        if (*pch == ',')
+        {
+            ++pch;
+            continue;
+        }
+        if (*pch++ != '}')
+            return false;
+        json_skip_space(pch);
+        return *pch == 0;
+    }
+}
+
+// キーのメンバーを探す。なければnullptrを返す。
+inline const JSON_MEMBER *json_find_member(const JSON_OBJECT& object, const char *key)
+{
+    for (auto& member : object)
+    {
+        if (member.m_key == key)
+            return &member;
+    }
+    return nullptr;
+}
+
+// 文字列をJSONの文字列にする（引用符付き）。
+inline std::string json_quote(const std::string& str)
+{
+    std::string ret = "\"";
+    for (char ch : str)
+    {
+        switch (ch)
+        {
+        case '"': ret += "\\\""; break;
+        case '\\': ret += "\\\\"; break;
+        case '\b': ret += "\\b"; break;
+        case '\f': ret += "\\f"; break;
+        case '\n': ret += "\\n"; break;
+        case '\r': ret += "\\r"; break;
+        case '\t': ret += "\\t"; break;
+        default:
+            if ((unsigned char)ch < 0x20)
+            {
+                static const char s_hex[] = "0123456789ABCDEF";
+                ret += "\\u00";
+                ret += s_hex[(unsigned char)ch >> 4];
+                ret += s_hex[ch & 0xF];
+            }
+            else
+            {
+                ret += ch;
+            }
+            break;
+        }
+    }
+    ret += '"';
+    return ret;
+}
+
+inline void json_object_unittest(void)
+{
+#ifndef NDEBUG
+    JSON_OBJECT object;
+
+    assert(json_parse_object("{}", object) && object.empty());
+    assert(json_parse_object(" { } \r\n", object) && object.empty());
+    assert(json_parse_object("{\"a\": 1, \"b\": -2.5e1, \"c\": true, \"d\": false, \"e\": null}", object));
+    assert(object.size() == 5);
+    assert(object[0].m_key == "a" && object[0].m_type == JSON_NUMBER && object[0].m_num == 1);
+    assert(object[1].m_type == JSON_NUMBER && object[1].m_num == -25);
+    assert(object[2].m_type == JSON_BOOL && object[2].m_bool);
+    assert(object[3].m_type == JSON_BOOL && !object[3].m_bool);
+    assert(object[4].m_type == JSON_NULL);
+    assert(json_find_member(object, "c") == &object[2]);
+    assert(json_find_member(object, "z") == nullptr);
+
+    assert(json_parse_object("{\"text\": \"A\\nB\\\"\\\\\\u3042\\ud83d\\ude00\"}", object));
+    assert(object[0].m_type == JSON_STRING);
+    assert(object[0].m_str == u8"A\nB\"\\あ😀");
+    assert(json_parse_object(u8"{\"text\":\"山田 太郎\"}", object) && object[0].m_str == u8"山田 太郎");
+
+    assert(!json_parse_object("", object));
+    assert(!json_parse_object("[1]", object));
+    assert(!json_parse_object("{\"a\": [1]}", object));
+    assert(!json_parse_object("{\"a\": {}}", object));
+    assert(!json_parse_object("{\"a\": 1,}", object));
+    assert(!json_parse_object("{\"a\": 1} x", object));
+    assert(!json_parse_object("{\"a\": \"x}", object));
+    assert(!json_parse_object("{\"a\": \"\\ud83d\"}", object));
+    assert(!json_parse_object("{\"a\": \"\\q\"}", object));
+    assert(!json_parse_object("{a: 1}", object));
+
+    // 数値はJSONの文法に合うものだけを受け付ける。
+    static const char *const s_good_numbers[] = { "0", "-0", "10", "0.5", "-1.25", "1e3", "1E+3", "2e-2", "0e0" };
+    for (auto good : s_good_numbers)
+        assert(json_parse_object((std::string("{\"a\": ") + good + "}").c_str(), object) && object[0].m_num == std::strtod(good, nullptr));
+    static const char *const s_bad_numbers[] =
+    {
+        "0x10", "01", "-01", "1.", ".5", "-", "+1", "1e", "1e+", "1.e3", "-.5", "1.5.2", "inf", "-inf", "nan", "1e999",
+    };
+    for (auto bad : s_bad_numbers)
+        assert(!json_parse_object((std::string("{\"a\": ") + bad + "}").c_str(), object));
+
+    // U+0000と不正なUTF-8は理由とともに拒む。
+    std::string error;
+    assert(!json_parse_object("{\"a\": \"x\\u0000y\"}", object, &error) && error == "U+0000 in string");
+    error.clear();
+    assert(!json_parse_object("{\"\\u0000\": 1}", object, &error) && error == "U+0000 in string");
+    static const char *const s_bad_utf8[] =
+    {
+        "\x80", "\xC3", "\xC3" "A", "\xC0\xAF", "\xE0\x80\xAF", "\xED\xA0\x80",
+        "\xF4\x90\x80\x80", "\xF8\x88\x80\x80\x80", "\xFF", "\xE3\x81",
+    };
+    for (auto bad : s_bad_utf8)
+    {
+        error.clear();
+        std::string line = std::string("{\"a\": \"") + bad + "\"}";
+        assert(!json_parse_object(line.c_str(), object, &error) && error == "Invalid UTF-8 in string");
+    }
+    error.clear();
+    assert(!json_parse_object("{\"a\": 1,}", object, &error) && error.empty());
+    assert(json_parse_object("{\"a\": \"\xC2\x80\xEF\xBF\xBF\xF4\x8F\xBF\xBF\"}", object, &error));
+
+    std::string quoted = json_quote(u8"A\n\"\\\x01あ");
+    assert(quoted == u8"\"A\\n\\\"\\\\\\u0001あ\"");
+    assert(json_parse_object(("{\"t\": " + quoted + "}").c_str(), object) && object[0].m_str == u8"A\n\"\\\x01あ");
+#endif
+}
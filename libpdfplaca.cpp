@@ -0,0 +1,5920 @@
+// libpdfplaca.cpp --- The core of pdfplaca (layout and drawing) by katahiromz
+// License: Apache 2.0
+
+#define _CRT_SECURE_NO_DEPRECATE    // We use deprecate functions for compatibility
+#define _USE_MATH_DEFINES           // We use <cmath> M_PI constant
+
+#include <cstdlib>          // C Standard Library
+#include <cstdio>           // C Standard Input/Output Library
+#include <cstdint>          // C Standard Integers
+#include <climits>          // For INT_MAX
+#include <cmath>            // C Math Library
+#include <cassert>          // For assert macro
+#include <cstring>          // C String Library
+#include <vector>           // For std::vector
+#include <string>           // For std::string and std::wstring
+#include <string_view>      // For std::string_view
+#include <unordered_map>    // For std::unordered_map
+#include <list>             // For std::list
+#include <deque>            // For std::deque
+#include <array>            // For std::array
+#include <complex>          // For std::complex
+#include <algorithm>        // For standard algorithm
+#include <chrono>           // For std::chrono
+#include <thread>           // For std::thread
+#include <memory>           // For std::shared_ptr
+#include <mutex>            // For std::mutex
+#include <condition_variable> // For std::condition_variable
+
+// For SIMD intrinsics (x86/x64 only)
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #define U8_HAVE_X86_SIMD
+    #include <immintrin.h>  // SSE2 and AVX2 intrinsics
+    #ifdef _MSC_VER
+        #include <intrin.h> // For __cpuid and _BitScanForward
+        #define U8_TARGET_AVX2
+    #else
+        #include <cpuid.h>  // For __get_cpuid
+        #define U8_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#endif
+
+// For detecting memory leak (for MSVC only)
+#if defined(_MSC_VER) && !defined(NDEBUG) && !defined(_CRTDBG_MAP_ALLOC)
+    #define _CRTDBG_MAP_ALLOC
+    #include <crtdbg.h>     // For C run-time debugging
+#endif
+
+#include <cairo.h>          // Cairo Graphic Library
+#include <cairo-pdf.h>      // Cairo PDF
+#ifdef CAIRO_HAS_WIN32_FONT
+    #include <cairo-win32.h>    // Cairo Win32 fonts
+#endif
+#ifdef CAIRO_HAS_FT_FONT
+    #include <cairo-ft.h>       // Cairo FreeType fonts
+#endif
+
+#include <windows.h>        // Windows standard header
+#include <windowsx.h>       // Windows helper macros
+#include <shlwapi.h>        // Shell Light-weight API
+#include <tchar.h>          // Generic text mapping
+#include <strsafe.h>        // Safe string manipulation
+#include <psapi.h>          // For GetProcessMemoryInfo
+#ifdef _WIN32
+    #include <io.h>         // For _setmode
+    #include <fcntl.h>      // For _O_BINARY
+#else
+    #include <sys/mman.h>   // For mmap
+    #include <sys/stat.h>   // For fstat
+    #include <fcntl.h>      // For open
+    #include <unistd.h>     // For close
+#endif
+#ifdef PDFPLACA_USE_HARFBUZZ
+    #include <hb.h>             // HarfBuzz text shaping
+    #include <hb-ot.h>          // HarfBuzz OpenType font functions
+    #ifdef CAIRO_HAS_WIN32_FONT
+        #include <hb-gdi.h>     // HarfBuzz faces from GDI fonts
+    #endif
+    #ifdef CAIRO_HAS_FT_FONT
+        #include <hb-ft.h>      // HarfBuzz faces from FreeType
+    #endif
+#endif
+
+#include "libpdfplaca.h"    // The core of pdfplaca
+#include "grapheme_break.h" // Grapheme cluster break properties
+#include "work_stealing.h"  // Work-stealing parallel loop
+
+// Get the default font
+const _TCHAR *pdfplaca_get_default_font(void)
+{
+    if (PRIMARYLANGID(GetUserDefaultLangID()) == LANG_JAPANESE) // Is the user Japanese?
+        return _T("MS Gothic");
+    return _T("Tahoma");
+}
+
+// 単位をmmからptへ変換する。
+constexpr double pt_from_mm(double mm)
+{
+    return mm * (72.0 / 25.4);
+}
+
+// RGBから赤の値を取得する。
+constexpr uint8_t get_r_value(uint32_t color)
+{
+    return (color >> 16) & 0xFF;
+}
+// RGBから緑の値を取得する。
+constexpr uint8_t get_g_value(uint32_t color)
+{
+    return (color >> 8) & 0xFF;
+}
+// RGBから青の値を取得する。
+constexpr uint8_t get_b_value(uint32_t color)
+{
+    return (color >> 0) & 0xFF;
+}
+
+// UTF-8シーケンスの最初のバイトかどうか判定する。
+constexpr bool u8_is_lead(unsigned char ch)
+{
+    return (ch & 0xC0) != 0x80;
+}
+
+// UTF-8文字列の実際の文字数を取得する。
+constexpr size_t u8_len(const char *str)
+{
+    size_t len = 0;
+    while (*str)
+    {
+        if (u8_is_lead(*str))
+            ++len;
+        ++str;
+    }
+    return len;
+}
+static_assert(u8_len(u8"abあいう漢字") == 7, "");
+static_assert(u8_len(u8"𠮷") == 1, "");
+static_assert(u8_len(u8"😃😃") == 2, "");
+
+// 文字列を置き換える。
+template <typename T_STR>
+constexpr bool
+mstr_replace_all(T_STR& str, const T_STR& from, const T_STR& to)
+{
+    bool ret = false;
+    size_t i = 0;
+    for (;;) {
+        i = str.find(from, i);
+        if (i == T_STR::npos)
+            break;
+        ret = true;
+        str.replace(i, from.size(), to);
+        i += to.size();
+    }
+    return ret;
+}
+template <typename T_STR>
+constexpr bool
+mstr_replace_all(T_STR& str,
+                 const typename T_STR::value_type *from,
+                 const typename T_STR::value_type *to)
+{
+    return mstr_replace_all(str, T_STR(from), T_STR(to));
+}
+
+// 文字列を分割する。charsは区切りの文字集合。
+template <typename T_STR_CONTAINER>
+constexpr void
+mstr_split(T_STR_CONTAINER& container,
+           const typename T_STR_CONTAINER::value_type& str,
+           const typename T_STR_CONTAINER::value_type& chars)
+{
+    container.clear();
+    size_t i = 0, k = str.find_first_of(chars);
+    while (k != T_STR_CONTAINER::value_type::npos)
+    {
+        container.push_back(str.substr(i, k - i));
+        i = k + 1;
+        k = str.find_first_of(chars, i);
+    }
+    container.push_back(str.substr(i));
+}
+
+// 文字列を結合する。sepは区切り。
+template <typename T_STR_CONTAINER>
+constexpr typename T_STR_CONTAINER::value_type
+mstr_join(const T_STR_CONTAINER& container,
+          const typename T_STR_CONTAINER::value_type& sep)
+{
+    typename T_STR_CONTAINER::value_type result;
+    typename T_STR_CONTAINER::const_iterator it, end;
+    it = container.begin();
+    end = container.end();
+    if (it != end)
+    {
+        result = *it;
+        for (++it; it != end; ++it)
+        {
+            result += sep;
+            result += *it;
+        }
+    }
+    return result;
+}
+
+// 文字列をエスケープする。
+std::string mstr_escape(const std::string& text)
+{
+    std::string ret;
+    for (size_t ich = 0; ich < text.size(); ++ich)
+    {
+        auto ch = text[ich];
+        switch (ch)
+        {
+        case '\t': ret += '\\'; ret += 't'; break;
+        case '\n': ret += '\\'; ret += 'n'; break;
+        case '\r': ret += '\\'; ret += 'r'; break;
+        case '\f': ret += '\\'; ret += 'f'; break;
+        case '\\': ret += '\\'; ret += '\\'; break;
+        default: ret += ch; break;
+        }
+    }
+    return ret;
+}
+
+// 文字列のエスケープを解除する。
+std::string mstr_unescape(const std::string& text)
+{
+    std::string ret;
+    bool escaping = false;
+    for (size_t ich = 0; ich < text.size(); ++ich)
+    {
+        auto ch = text[ich];
+        if (escaping)
+        {
+            switch (ch)
+            {
+            case 't': ret += '\t'; break;
+            case 'n': ret += '\n'; break;
+            case 'r': ret += '\r'; break;
+            case 'f': ret += '\f'; break;
+            case '\\': ret += '\\'; break;
+            default: ret += ch; break;
+            }
+            escaping = false;
+        }
+        else
+        {
+            if (ch == '\\')
+            {
+                escaping = true;
+                if (ich + 1 == text.size())
+                {
+                    ret += ch;
+                    break;
+                }
+            }
+            else
+            {
+                ret += ch;
+            }
+        }
+    }
+    return ret;
+}
+
+// UTF-8文字列を改行で分割する。
+void u8_split_by_newlines(std::vector<std::string>& rows, const char *str)
+{
+    std::string s = str;
+    mstr_replace_all(s, "\r\n", "\n");
+    mstr_replace_all(s, "\r", "\n");
+    mstr_split(rows, s, "\n");
+}
+
+// テキストを一度の走査で正規化する。エスケープの解除、改行の統一（CRLF/CR→LF）、
+// タブの展開（3スペース）、必要ならば空白の削除、行の分割をまとめて行う。
+// 入力は分割して与えてもよい（feedを繰り返し、最後にfinishを呼ぶ）。
+struct U8_TEXT_NORMALIZER
+{
+    bool m_strip_spaces = false;    // 空白と改行を削除するか？
+    bool m_unescape = true;         // エスケープを解除するか？
+    std::string m_text;             // 正規化されたテキスト（行は'\n'で区切る）
+    std::vector<size_t> m_row_ends; // 各行の終わりの位置（最後の行を除く）
+    bool m_escaping = false;        // '\\'の直後か？
+    bool m_pending_cr = false;      // '\r'の直後か？
+
+    U8_TEXT_NORMALIZER(bool strip_spaces = false, bool unescape = true)
+        : m_strip_spaces(strip_spaces)
+        , m_unescape(unescape)
+    {
+    }
+
+    // 出力の大きさの見込みで、あらかじめ確保する。
+    void reserve(size_t size)
+    {
+        m_text.reserve(size);
+    }
+
+    void feed(std::string_view chunk)
+    {
+        size_t ich = 0;
+        while (ich < chunk.size())
+        {
+            if (!m_escaping && !m_pending_cr)
+            {
+                // 特別な処理が要らないバイトの並びはまとめて追加する。
+                size_t end = ich;
+                while (end < chunk.size() && !is_special(uint8_t(chunk[end])))
+                    ++end;
+                m_text.append(chunk.data() + ich, end - ich);
+                ich = end;
+                if (ich >= chunk.size())
+                    break;
+            }
+
+            char ch = chunk[ich++];
+            if (m_escaping)
+            {
+                m_escaping = false;
+                switch (ch)
+                {
+                case 't': put('\t'); break;
+                case 'n': put('\n'); break;
+                case 'r': put('\r'); break;
+                case 'f': put('\f'); break;
+                default: put(ch); break;
+                }
+            }
+            else if (ch == '\\' && m_unescape)
+            {
+                m_escaping = true;
+            }
+            else
+            {
+                put(ch);
+            }
+        }
+    }
+
+    void finish()
+    {
+        if (m_escaping) // 末尾の'\\'はそのまま残す。
+        {
+            m_escaping = false;
+            put('\\');
+        }
+        if (m_pending_cr)
+        {
+            m_pending_cr = false;
+            newline();
+        }
+    }
+
+    // 処理済みのテキストの先頭lenバイトを捨てる。
+    void discard(size_t len)
+    {
+        m_text.erase(0, len);
+        auto it = std::lower_bound(m_row_ends.begin(), m_row_ends.end(), len);
+        m_row_ends.erase(m_row_ends.begin(), it);
+        for (auto& end : m_row_ends)
+            end -= len;
+    }
+
+    // 行を取得する。finishの後で呼ぶこと。
+    void get_rows(std::vector<std::string_view>& rows) const
+    {
+        rows.clear();
+        rows.reserve(m_row_ends.size() + 1);
+        std::string_view text = m_text;
+        size_t start = 0;
+        for (size_t end : m_row_ends)
+        {
+            rows.push_back(text.substr(start, end - start));
+            start = end + 1;
+        }
+        rows.push_back(text.substr(start));
+    }
+
+protected:
+    bool is_special(uint8_t ch) const
+    {
+        switch (ch)
+        {
+        case '\\':
+            return m_unescape;
+        case '\r': case '\n': case '\t':
+            return true;
+        case ' ': case 0x80: // 0x80: 全角スペース（E3 80 80）の末尾バイト
+            return m_strip_spaces;
+        }
+        return false;
+    }
+
+    void newline()
+    {
+        if (m_strip_spaces)
+            return;
+        m_row_ends.push_back(m_text.size());
+        m_text += '\n';
+    }
+
+    // エスケープを解除した後の1バイトを処理する。
+    void put(char ch)
+    {
+        if (m_pending_cr)
+        {
+            m_pending_cr = false;
+            newline();
+            if (ch == '\n') // CRLF
+                return;
+        }
+
+        switch (ch)
+        {
+        case '\r':
+            m_pending_cr = true;
+            break;
+        case '\n':
+            newline();
+            break;
+        case '\t':
+            if (!m_strip_spaces)
+                m_text += "   ";
+            break;
+        case ' ':
+            if (!m_strip_spaces)
+                m_text += ' ';
+            break;
+        default:
+            m_text += ch;
+            // 全角スペースを削除する。入力は正しいUTF-8なので、E3 80 80は必ず1文字。
+            if (m_strip_spaces && uint8_t(ch) == 0x80 && m_text.size() >= 3 &&
+                m_text.compare(m_text.size() - 3, 3, u8"　") == 0)
+            {
+                m_text.resize(m_text.size() - 3);
+            }
+            break;
+        }
+    }
+};
+
+void u8_text_normalizer_unittest(void)
+{
+#ifndef NDEBUG
+    static const char *s_texts[] =
+    {
+        "", "a", "a\n", "\n\n", "a\r\nb\rc\n\rd", "a\\nb\\r\\nc", "x\\", "\\\\t\\q",
+        "\t1\\t2", u8"あ　い う\tえ\r", "\r", "\\r\n", u8"\\　",
+    };
+    for (auto text : s_texts)
+    {
+        for (int strip = 0; strip <= 1; ++strip)
+        {
+            // 従来の処理
+            std::string expected = mstr_unescape(text);
+            mstr_replace_all(expected, u8"\t", u8"   ");
+            std::vector<std::string> expected_rows;
+            if (strip)
+            {
+                mstr_replace_all(expected, " ", "");
+                mstr_replace_all(expected, "\r", "");
+                mstr_replace_all(expected, "\n", "");
+                mstr_replace_all(expected, u8"　", "");
+                expected_rows.push_back(expected);
+            }
+            else
+            {
+                u8_split_by_newlines(expected_rows, expected.c_str());
+            }
+
+            // 一度にまとめて処理する。1バイトずつに分けて与えても結果は同じ。
+            for (size_t step : { size_t(1), std::strlen(text) + 1 })
+            {
+                U8_TEXT_NORMALIZER normalizer(strip != 0);
+                std::string_view str = text;
+                for (size_t ich = 0; ich < str.size(); ich += step)
+                    normalizer.feed(str.substr(ich, step));
+                normalizer.finish();
+                std::vector<std::string_view> rows;
+                normalizer.get_rows(rows);
+
+                assert(rows.size() == expected_rows.size());
+                for (size_t i = 0; i < rows.size(); ++i)
+                    assert(rows[i] == expected_rows[i]);
+            }
+        }
+    }
+#endif
+}
+
+// 文字の分類（ビットの組み合わせ）。
+enum U8_CHAR_CLASS : uint8_t
+{
+    U8CC_NONE = 0,
+    U8CC_SPACE = (1 << 0),          // スペース
+    U8CC_PAREN_TYPE_1 = (1 << 1),   // カッコ（タイプ1）
+    U8CC_PAREN_TYPE_2 = (1 << 2),   // カッコ（タイプ2）
+    U8CC_PAREN_TYPE_3 = (1 << 3),   // カッコ（タイプ3）
+    U8CC_COMMA_PERIOD = (1 << 4),   // 句読点
+    U8CC_HYPHEN_DASH = (1 << 5),    // 横棒
+    U8CC_SMALL_KANA = (1 << 6),     // 小さいカナ
+    U8CC_OPENING = (1 << 7),        // 開きカッコ（カッコのうち）
+    U8CC_PAREN = U8CC_PAREN_TYPE_1 | U8CC_PAREN_TYPE_2 | U8CC_PAREN_TYPE_3, // カッコ
+};
+
+// 文字の分類表のページ数の上限。
+#define U8_CHAR_CLASS_MAX_PAGES 8
+
+// 文字の分類表。基本多言語面のコードポイントの上位8ビットでページを引き、下位8ビットで分類を引く。
+// ページ0は空のページ。
+struct U8_CHAR_CLASS_TABLE
+{
+    uint8_t m_page_index[256];
+    uint8_t m_pages[U8_CHAR_CLASS_MAX_PAGES][256];
+    int m_num_pages;
+
+    // 文字集合のすべての文字に分類を追加する。
+    constexpr void add(const char *char_set, uint8_t char_class)
+    {
+        for (size_t ich = 0; char_set[ich]; )
+        {
+            uint32_t ch0 = uint8_t(char_set[ich]), u32 = 0;
+            if (ch0 < 0x80)
+            {
+                u32 = ch0;
+                ich += 1;
+            }
+            else if ((ch0 & 0xE0) == 0xC0)
+            {
+                u32 = ((ch0 & 0x1F) << 6) | (uint8_t(char_set[ich + 1]) & 0x3F);
+                ich += 2;
+            }
+            else
+            {
+                u32 = ((ch0 & 0x0F) << 12) | ((uint8_t(char_set[ich + 1]) & 0x3F) << 6) | (uint8_t(char_set[ich + 2]) & 0x3F);
+                ich += 3;
+            }
+
+            uint8_t& index = m_page_index[u32 >> 8];
+            if (!index)
+                index = uint8_t(m_num_pages++);
+            m_pages[index][u32 & 0xFF] |= char_class;
+        }
+    }
+};
+
+// 文字の分類表をコンパイル時に作成する。
+constexpr U8_CHAR_CLASS_TABLE u8_make_char_class_table(void)
+{
+    U8_CHAR_CLASS_TABLE table = { {}, {}, 1 };
+    table.add(u8" 　", U8CC_SPACE);
+    table.add(u8"(（[［〔【｛〈《≪｟⁅〖〘«»〙〗⁆｠≫》〉｝】〕］]）)", U8CC_PAREN_TYPE_1);
+    table.add(u8"「『", U8CC_PAREN_TYPE_2);
+    table.add(u8"』」", U8CC_PAREN_TYPE_3);
+    table.add(u8"(（[［〔【｛〈《≪｟⁅〖〘«「『", U8CC_OPENING);
+    table.add(u8"、。，．", U8CC_COMMA_PERIOD);
+    table.add(u8"-－―ー=＝≡～", U8CC_HYPHEN_DASH);
+    table.add(u8"ぁぃぅぇぉっゃゅょゎゕゖァィゥェォヵㇰヶㇱㇲッㇳㇴㇵㇶㇷㇸㇹㇺャュョㇻㇼㇽㇾㇿヮ", U8CC_SMALL_KANA);
+    return table;
+}
+
+constexpr U8_CHAR_CLASS_TABLE g_u8_char_class_table = u8_make_char_class_table();
+static_assert(g_u8_char_class_table.m_num_pages <= U8_CHAR_CLASS_MAX_PAGES, "");
+
+// コードポイントの分類を取得する。
+constexpr uint8_t u8_char_class(uint32_t u32)
+{
+    return (u32 < 0x10000) ? g_u8_char_class_table.m_pages[g_u8_char_class_table.m_page_index[u32 >> 8]][u32 & 0xFF] : uint8_t(U8CC_NONE);
+}
+static_assert(u8_char_class(0x3000) == U8CC_SPACE, "");
+static_assert(u8_char_class(0x300C) == (U8CC_PAREN_TYPE_2 | U8CC_OPENING), "");
+static_assert(u8_char_class(0x300D) == U8CC_PAREN_TYPE_3, "");
+static_assert(u8_char_class(0xFF09) == U8CC_PAREN_TYPE_1, "");
+static_assert(u8_char_class(0x30C3) == U8CC_SMALL_KANA, "");
+static_assert(u8_char_class(0x30C4) == U8CC_NONE, "");
+static_assert(u8_char_class(0x1F600) == U8CC_NONE, "");
+
+// UTF-8シーケンスの最初のバイトでシーケンスの長さを判定する。不正なバイトなら-1を返す。
+int u8_get_skip_chars(uint8_t ch)
+{
+    if (!(ch & 0x80))
+        return 1;
+    if ((ch & 0xE0) == 0xC0)
+        return 2;
+    if ((ch & 0xF0) == 0xE0)
+        return 3;
+    if ((ch & 0xF8) == 0xF0)
+        return 4;
+    return -1;
+}
+
+// 既定で無視できる文字（Default_Ignorable_Code_Point）か？
+// 異体字セレクタ、ZWJ/ZWNJ、モンゴル文字の自由字形選択子、タグ文字など。
+bool u8_is_default_ignorable(uint32_t u32)
+{
+    if (u32 < 0x00AD)
+        return false;
+    return u32 == 0x00AD || u32 == 0x034F || u32 == 0x061C ||
+           (0x115F <= u32 && u32 <= 0x1160) || (0x17B4 <= u32 && u32 <= 0x17B5) ||
+           (0x180B <= u32 && u32 <= 0x180F) || (0x200B <= u32 && u32 <= 0x200F) ||
+           (0x202A <= u32 && u32 <= 0x202E) || (0x2060 <= u32 && u32 <= 0x206F) ||
+           u32 == 0x3164 || (0xFE00 <= u32 && u32 <= 0xFE0F) || u32 == 0xFEFF || u32 == 0xFFA0 ||
+           (0xFFF0 <= u32 && u32 <= 0xFFF8) || (0x1BCA0 <= u32 && u32 <= 0x1BCA3) ||
+           (0x1D173 <= u32 && u32 <= 0x1D17A) || (0xE0000 <= u32 && u32 <= 0xE0FFF);
+}
+
+// UTF-8シーケンスを1文字だけ検証してデコードする。シーケンス長を返す。不正なら0を返す。
+// 冗長な表現、サロゲート、U+10FFFFを超える値、途中で切れたシーケンスは不正とする。
+int u8_decode_one(const char *ptr, size_t len, uint32_t *u32)
+{
+    const uint8_t *pch = reinterpret_cast<const uint8_t *>(ptr);
+    uint32_t ch0 = pch[0];
+    if (ch0 < 0x80)
+    {
+        *u32 = ch0;
+        return 1;
+    }
+    if (ch0 < 0xC2) // 継続バイトか冗長な2バイト表現
+        return 0;
+    if (ch0 < 0xE0)
+    {
+        if (len < 2 || (pch[1] & 0xC0) != 0x80)
+            return 0;
+        *u32 = ((ch0 & 0x1F) << 6) | (pch[1] & 0x3F);
+        return 2;
+    }
+    if (ch0 < 0xF0)
+    {
+        if (len < 3 || (pch[1] & 0xC0) != 0x80 || (pch[2] & 0xC0) != 0x80)
+            return 0;
+        uint32_t value = ((ch0 & 0x0F) << 12) | ((pch[1] & 0x3F) << 6) | (pch[2] & 0x3F);
+        if (value < 0x800 || (0xD800 <= value && value <= 0xDFFF))
+            return 0;
+        *u32 = value;
+        return 3;
+    }
+    if (ch0 < 0xF5)
+    {
+        if (len < 4 || (pch[1] & 0xC0) != 0x80 || (pch[2] & 0xC0) != 0x80 || (pch[3] & 0xC0) != 0x80)
+            return 0;
+        uint32_t value = ((ch0 & 0x07) << 18) | ((pch[1] & 0x3F) << 12) | ((pch[2] & 0x3F) << 6) | (pch[3] & 0x3F);
+        if (value < 0x10000 || value > 0x10FFFF)
+            return 0;
+        *u32 = value;
+        return 4;
+    }
+    return 0;
+}
+
+// UTF-8からUTF-32に変換する。*skipはシーケンス長。不正なシーケンスなら*skipは-1になる。
+uint32_t u32_from_u8(const char *ptr, int *skip)
+{
+    // NUL終端の文字列なので、継続バイトの検査はNULで止まる。
+    uint32_t u32;
+    int len = u8_decode_one(ptr, 4, &u32);
+    if (!len)
+    {
+        *skip = -1;
+        return 0;
+    }
+    *skip = len;
+    return u32;
+}
+
+// 先頭から続くASCII文字のバイト数を返す（ポータブル版）。
+size_t u8_ascii_prefix_scalar(const char *ptr, size_t len)
+{
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t block;
+        std::memcpy(&block, ptr + i, 8);
+        if (block & 0x8080808080808080ULL)
+            break;
+    }
+    while (i < len && !(uint8_t(ptr[i]) & 0x80))
+        ++i;
+    return i;
+}
+
+#ifdef U8_HAVE_X86_SIMD
+// 最下位の1のビットの位置。valueは0でないこと。
+inline int u8_count_trailing_zeros(uint32_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, value);
+    return int(index);
+#else
+    return __builtin_ctz(value);
+#endif
+}
+
+// 先頭から続くASCII文字のバイト数を返す（SSE2版）。16バイトずつ判定する。
+size_t u8_ascii_prefix_sse2(const char *ptr, size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + i));
+        uint32_t mask = uint32_t(_mm_movemask_epi8(block));
+        if (mask)
+            return i + u8_count_trailing_zeros(mask);
+    }
+    return i + u8_ascii_prefix_scalar(ptr + i, len - i);
+}
+
+// 先頭から続くASCII文字のバイト数を返す（AVX2版）。32バイトずつ判定する。
+U8_TARGET_AVX2
+size_t u8_ascii_prefix_avx2(const char *ptr, size_t len)
+{
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr + i));
+        uint32_t mask = uint32_t(_mm256_movemask_epi8(block));
+        if (mask)
+            return i + u8_count_trailing_zeros(mask);
+    }
+    return i + u8_ascii_prefix_sse2(ptr + i, len - i);
+}
+
+// CPUがSSE2に対応しているか？
+bool u8_cpu_has_sse2(void)
+{
+#if defined(_M_X64) || defined(__x86_64__)
+    return true; // x64では必ず使える。
+#elif defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 1);
+    return (regs[3] & (1 << 26)) != 0;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+// CPUとOSがAVX2に対応しているか？
+bool u8_cpu_has_avx2(void)
+{
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7)
+        return false;
+    __cpuid(regs, 1);
+    if (!(regs[2] & (1 << 27))) // OSXSAVE
+        return false;
+    if ((_xgetbv(0) & 6) != 6) // OSがYMMレジスタを保存するか？
+        return false;
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif // def U8_HAVE_X86_SIMD
+
+typedef size_t (*U8_ASCII_PREFIX_FN)(const char *ptr, size_t len);
+
+// 実行時にCPUに合った実装を選ぶ。
+U8_ASCII_PREFIX_FN u8_select_ascii_prefix(void)
+{
+#ifdef U8_HAVE_X86_SIMD
+    if (u8_cpu_has_avx2())
+        return u8_ascii_prefix_avx2;
+    if (u8_cpu_has_sse2())
+        return u8_ascii_prefix_sse2;
+#endif
+    return u8_ascii_prefix_scalar;
+}
+
+// 先頭から続くASCII文字のバイト数を返す。
+inline size_t u8_ascii_prefix(const char *ptr, size_t len)
+{
+    static const U8_ASCII_PREFIX_FN s_fn = u8_select_ascii_prefix();
+    return s_fn(ptr, len);
+}
+
+// 一度にデコードするコードポイントの最大数。
+#define U8_DECODE_BLOCK 64
+
+// UTF-8文字列を検証しながら、コードポイントと文字の境界をまとめて取り出す。
+// 最大max_count個のコードポイントをu32sに、それぞれの開始位置をoffsetsに書き込んで、個数を返す。
+// offsets[個数]は取り出した部分の終わり。不正なシーケンスに達したら、その手前で止まる。
+// max_countは16以上。u32sとoffsetsにはmax_count + 1個の要素が必要。
+typedef size_t (*U8_DECODE_FN)(const char *ptr, size_t len, uint32_t *u32s, uint32_t *offsets, size_t max_count);
+
+// コードポイントと境界をまとめて取り出す（ポータブル版）。
+size_t u8_decode_scalar(const char *ptr, size_t len, uint32_t *u32s, uint32_t *offsets, size_t max_count)
+{
+    size_t count = 0, pos = 0;
+    while (count < max_count && pos < len)
+    {
+        int skip = u8_decode_one(ptr + pos, len - pos, &u32s[count]);
+        if (!skip)
+            break;
+        offsets[count++] = uint32_t(pos);
+        pos += skip;
+    }
+    offsets[count] = uint32_t(pos);
+    return count;
+}
+
+#ifdef U8_HAVE_X86_SIMD
+// 16バイトのASCII文字を32ビットに広げて、開始位置とともに書き込む。
+inline void u8_widen_ascii_sse2(__m128i block, size_t pos, uint32_t *u32s, uint32_t *offsets)
+{
+    const __m128i zero = _mm_setzero_si128(), four = _mm_set1_epi32(4);
+    __m128i lo = _mm_unpacklo_epi8(block, zero), hi = _mm_unpackhi_epi8(block, zero);
+    auto out = reinterpret_cast<__m128i *>(u32s);
+    _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(lo, zero));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(lo, zero));
+    _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(hi, zero));
+    _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(hi, zero));
+    auto offs = reinterpret_cast<__m128i *>(offsets);
+    __m128i offset = _mm_add_epi32(_mm_set1_epi32(int(pos)), _mm_setr_epi32(0, 1, 2, 3));
+    for (int i = 0; i < 4; ++i, offset = _mm_add_epi32(offset, four))
+        _mm_storeu_si128(offs + i, offset);
+}
+
+// 16バイトの先頭から続く非ASCII文字を、先頭バイトと継続バイトの並びをビットマスクで
+// まとめて検証してからデコードする。デコードしたバイト数を返す。0なら1文字ずつ調べること。
+inline uint32_t u8_decode_non_ascii_sse2(__m128i block, uint32_t ascii, size_t pos, uint32_t *u32s, uint32_t *offsets, size_t& count)
+{
+    // 先頭バイトの上位4ビットから、文字のバイト数を求める表。
+    static const uint8_t s_lengths[16] = { 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 2, 2, 3, 4 };
+    static const uint8_t s_lead_masks[5] = { 0, 0x7F, 0x1F, 0x0F, 0x07 };
+    static const uint32_t s_min_values[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+    auto mask_of = [block](int mask, int value) {
+        return uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(block, _mm_set1_epi8(char(mask))),
+                                                         _mm_set1_epi8(char(value)))));
+    };
+
+    // 先頭バイトから継続バイトがあるべき位置を求めて、実際の継続バイトと比べる。
+    uint32_t lead2 = mask_of(0xE0, 0xC0), lead3 = mask_of(0xF0, 0xE0), lead4 = mask_of(0xF8, 0xF0);
+    uint32_t conts = mask_of(0xC0, 0x80);
+    uint32_t leads = lead2 | lead3 | lead4;
+    uint32_t expected = (leads << 1) | ((lead3 | lead4) << 2) | (lead4 << 3);
+    uint32_t errors = ((expected ^ conts) | ~(ascii | leads | conts)) & 0xFFFF;
+
+    // 最初の誤りかASCII文字の手前までで、その中で終わる文字だけを扱う。
+    uint32_t end = u8_count_trailing_zeros(errors | ascii | 0x10000);
+    uint32_t starts = leads & ((1u << end) - 1);
+    if (!starts)
+        return 0;
+
+    alignas(16) uint8_t bytes[16 + 4] = { 0 };
+    _mm_store_si128(reinterpret_cast<__m128i *>(bytes), block);
+
+    // 冗長な表現、サロゲート、範囲外の値を確かめながらデコードする。
+    uint32_t next = 0;
+    for (; starts; starts &= starts - 1)
+    {
+        uint32_t i = u8_count_trailing_zeros(starts);
+        uint32_t n = s_lengths[bytes[i] >> 4];
+        if (i + n > end)
+            break;
+        uint32_t bits = (uint32_t(bytes[i] & s_lead_masks[n]) << 18) | (uint32_t(bytes[i + 1] & 0x3F) << 12) |
+                        (uint32_t(bytes[i + 2] & 0x3F) << 6) | uint32_t(bytes[i + 3] & 0x3F);
+        uint32_t value = bits >> (6 * (4 - n));
+        if (value < s_min_values[n] || (value - 0xD800) < 0x800 || value > 0x10FFFF)
+            break;
+        u32s[count] = value;
+        offsets[count++] = uint32_t(pos + i);
+        next = i + n;
+    }
+    return next;
+}
+
+// コードポイントと境界をまとめて取り出す（SSE2版）。16バイトずつ判定する。
+size_t u8_decode_sse2(const char *ptr, size_t len, uint32_t *u32s, uint32_t *offsets, size_t max_count)
+{
+    size_t count = 0, pos = 0;
+    while (count < max_count && pos < len)
+    {
+        if (pos + 16 <= len && count + 16 <= max_count)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + pos));
+            uint32_t ascii = ~uint32_t(_mm_movemask_epi8(block)) & 0xFFFF;
+            if (ascii & 1)
+            {
+                // 先頭から続くASCII文字をまとめて広げる。
+                u8_widen_ascii_sse2(block, pos, u32s + count, offsets + count);
+                size_t n = (ascii == 0xFFFF) ? 16 : u8_count_trailing_zeros(~ascii);
+                count += n;
+                pos += n;
+                continue;
+            }
+            if (uint32_t n = u8_decode_non_ascii_sse2(block, ascii, pos, u32s, offsets, count))
+            {
+                pos += n;
+                continue;
+            }
+        }
+
+        // それ以外は1文字ずつ。
+        int skip = u8_decode_one(ptr + pos, len - pos, &u32s[count]);
+        if (!skip)
+            break;
+        offsets[count++] = uint32_t(pos);
+        pos += skip;
+    }
+    offsets[count] = uint32_t(pos);
+    return count;
+}
+
+// コードポイントと境界をまとめて取り出す（AVX2版）。SSE2版に加えて、
+// 3バイトの文字（かな・漢字）の並びは4文字ずつバイトを並べ替えてデコードする。
+U8_TARGET_AVX2
+size_t u8_decode_avx2(const char *ptr, size_t len, uint32_t *u32s, uint32_t *offsets, size_t max_count)
+{
+    // 3バイトの文字を4つ、32ビットの各要素に「第3バイト、第2バイト、第1バイト、0」の順に並べる。
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i mask_c0 = _mm_set1_epi8(char(0xC0)), cont = _mm_set1_epi8(char(0x80));
+    const __m128i mask_f0 = _mm_set1_epi8(char(0xF0)), lead3 = _mm_set1_epi8(char(0xE0));
+    const __m128i steps = _mm_setr_epi32(0, 3, 6, 9);
+
+    size_t count = 0, pos = 0;
+    while (count < max_count && pos < len)
+    {
+        if (pos + 16 <= len && count + 16 <= max_count)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + pos));
+            uint32_t ascii = ~uint32_t(_mm_movemask_epi8(block)) & 0xFFFF;
+            if (ascii & 1)
+            {
+                // 先頭から続くASCII文字をまとめて広げる。
+                u8_widen_ascii_sse2(block, pos, u32s + count, offsets + count);
+                size_t n = (ascii == 0xFFFF) ? 16 : u8_count_trailing_zeros(~ascii);
+                count += n;
+                pos += n;
+                continue;
+            }
+
+            // 先頭の12バイトが3バイトの文字4つか？
+            uint32_t conts = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(block, mask_c0), cont)));
+            uint32_t leads = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(block, mask_f0), lead3)));
+            if ((conts & 0xFFF) == 0xDB6 && (leads & 0xFFF) == 0x249)
+            {
+                __m128i x = _mm_shuffle_epi8(block, shuffle);
+                __m128i value = _mm_or_si128(_mm_and_si128(x, _mm_set1_epi32(0x3F)),
+                                _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 2), _mm_set1_epi32(0xFC0)),
+                                             _mm_and_si128(_mm_srli_epi32(x, 4), _mm_set1_epi32(0xF000))));
+                // 冗長な表現とサロゲートがなければ書き込む。
+                __m128i bad = _mm_or_si128(_mm_cmplt_epi32(value, _mm_set1_epi32(0x800)),
+                                           _mm_cmpeq_epi32(_mm_and_si128(value, _mm_set1_epi32(0xF800)), _mm_set1_epi32(0xD800)));
+                if (!_mm_movemask_epi8(bad))
+                {
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(u32s + count), value);
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(offsets + count), _mm_add_epi32(_mm_set1_epi32(int(pos)), steps));
+                    count += 4;
+                    pos += 12;
+                    continue;
+                }
+            }
+
+            if (uint32_t n = u8_decode_non_ascii_sse2(block, ascii, pos, u32s, offsets, count))
+            {
+                pos += n;
+                continue;
+            }
+        }
+
+        // それ以外は1文字ずつ。
+        int skip = u8_decode_one(ptr + pos, len - pos, &u32s[count]);
+        if (!skip)
+            break;
+        offsets[count++] = uint32_t(pos);
+        pos += skip;
+    }
+    offsets[count] = uint32_t(pos);
+    return count;
+}
+#endif // def U8_HAVE_X86_SIMD
+
+// 実行時にCPUに合った実装を選ぶ。
+U8_DECODE_FN u8_select_decode(void)
+{
+#ifdef U8_HAVE_X86_SIMD
+    if (u8_cpu_has_avx2())
+        return u8_decode_avx2;
+    if (u8_cpu_has_sse2())
+        return u8_decode_sse2;
+#endif
+    return u8_decode_scalar;
+}
+
+// コードポイントと境界をまとめて取り出す。
+inline size_t u8_decode(const char *ptr, size_t len, uint32_t *u32s, uint32_t *offsets, size_t max_count)
+{
+    static const U8_DECODE_FN s_fn = u8_select_decode();
+    return s_fn(ptr, len, u32s, offsets, max_count);
+}
+
+// UTF-8文字列が正しいか検証する。
+bool u8_is_valid(std::string_view str)
+{
+    uint32_t u32s[U8_DECODE_BLOCK + 1], offsets[U8_DECODE_BLOCK + 1];
+    for (size_t ich = 0; ich < str.size(); )
+    {
+        // ASCIIの並びはまとめて飛ばす。
+        ich += u8_ascii_prefix(&str[ich], str.size() - ich);
+        if (ich >= str.size())
+            break;
+
+        // ASCII以外はまとめて検証する。
+        size_t count = u8_decode(&str[ich], str.size() - ich, u32s, offsets, U8_DECODE_BLOCK);
+        if (!count)
+            return false;
+        ich += offsets[count];
+    }
+    return true;
+}
+
+// 1文字のUTF-8文字列の分類を取得する。
+uint8_t u8_char_class(const char *ptr)
+{
+    int skip;
+    uint32_t u32 = u32_from_u8(ptr, &skip);
+    if (skip <= 0 || ptr[skip] != 0)
+        return U8CC_NONE;
+    return u8_char_class(u32);
+}
+
+// UTF-8文字列の1文字（書記素クラスタ）。元の文字列を参照する。
+struct U8_SEGMENT
+{
+    std::string_view m_str; // 文字のバイト列。結合文字や異体字セレクタなども含む。
+    uint32_t m_u32;         // 最初のコードポイント
+};
+
+// UTF-8文字列の文字の区切り。
+typedef std::vector<U8_SEGMENT> U8_CHARS;
+
+// 末尾の途中で切れたUTF-8シーケンスを除いた長さを返す。
+size_t u8_complete_prefix(const char *ptr, size_t len)
+{
+    // 最後の先頭バイトを3バイトまで遡って探す。
+    for (size_t back = 1; back <= 3 && back <= len; ++back)
+    {
+        uint8_t ch = uint8_t(ptr[len - back]);
+        if (!u8_is_lead(ch))
+            continue;
+        int skip = u8_get_skip_chars(ch);
+        if (skip > 0 && size_t(skip) > back)
+            return len - back;
+        break;
+    }
+    return len;
+}
+
+// 書記素クラスタの境界の判定の状態。
+struct U8_GRAPHEME_STATE
+{
+    U8_GCB m_prev;          // 直前の文字の性質
+    bool m_emoji;           // Extended_Pictographic Extend* の後か？
+    bool m_emoji_zwj;       // Extended_Pictographic Extend* ZWJ の後か？
+    bool m_odd_ri;          // 奇数個のRegional_Indicatorが続いた後か？
+
+    U8_GRAPHEME_STATE(U8_GCB first)
+        : m_prev(first)
+        , m_emoji(first == U8_GCB_EXTENDED_PICTOGRAPHIC)
+        , m_emoji_zwj(false)
+        , m_odd_ri(first == U8_GCB_REGIONAL_INDICATOR)
+    {
+    }
+};
+
+// 次の文字の前で書記素クラスタが区切れるか判定して、状態を進める（UAX #29）。
+bool u8_grapheme_break(U8_GRAPHEME_STATE& state, U8_GCB next)
+{
+    U8_GCB prev = state.m_prev;
+    bool ret;
+    if (prev == U8_GCB_CR && next == U8_GCB_LF) // GB3
+        ret = false;
+    else if (prev == U8_GCB_CR || prev == U8_GCB_LF || prev == U8_GCB_CONTROL) // GB4
+        ret = true;
+    else if (next == U8_GCB_CR || next == U8_GCB_LF || next == U8_GCB_CONTROL) // GB5
+        ret = true;
+    else if (prev == U8_GCB_L && (next == U8_GCB_L || next == U8_GCB_V || next == U8_GCB_LV || next == U8_GCB_LVT)) // GB6
+        ret = false;
+    else if ((prev == U8_GCB_LV || prev == U8_GCB_V) && (next == U8_GCB_V || next == U8_GCB_T)) // GB7
+        ret = false;
+    else if ((prev == U8_GCB_LVT || prev == U8_GCB_T) && next == U8_GCB_T) // GB8
+        ret = false;
+    else if (next == U8_GCB_EXTEND || next == U8_GCB_ZWJ || next == U8_GCB_SPACINGMARK) // GB9, GB9a
+        ret = false;
+    else if (prev == U8_GCB_PREPEND) // GB9b
+        ret = false;
+    else if (state.m_emoji_zwj && next == U8_GCB_EXTENDED_PICTOGRAPHIC) // GB11
+        ret = false;
+    else if (state.m_odd_ri && next == U8_GCB_REGIONAL_INDICATOR) // GB12, GB13
+        ret = false;
+    else // GB999
+        ret = true;
+
+    state.m_emoji_zwj = (state.m_emoji && next == U8_GCB_ZWJ);
+    state.m_emoji = (next == U8_GCB_EXTENDED_PICTOGRAPHIC) || (state.m_emoji && next == U8_GCB_EXTEND);
+    state.m_odd_ri = (next == U8_GCB_REGIONAL_INDICATOR) && !state.m_odd_ri;
+    state.m_prev = next;
+    return ret;
+}
+
+// posから始まる書記素クラスタ（UAX #29の拡張書記素クラスタ）の終わりの位置を返す。
+// *firstは最初のコードポイント。posが不正なシーケンスなら0を返す。
+size_t u8_grapheme_end(std::string_view str, size_t pos, uint32_t *first)
+{
+    size_t len = u8_decode_one(&str[pos], str.size() - pos, first);
+    if (!len)
+        return 0;
+
+    U8_GRAPHEME_STATE state(u8_gcb(*first));
+    size_t end = pos + len;
+    while (end < str.size())
+    {
+        uint32_t u32;
+        len = u8_decode_one(&str[end], str.size() - end, &u32);
+        if (!len || u8_grapheme_break(state, u8_gcb(u32)))
+            break;
+        end += len;
+    }
+    return end;
+}
+
+// UTF-8文字列を実際の文字（書記素クラスタ）に区切る。文字ごとのメモリ確保はしない。
+// コードポイントと境界はdecodeでまとめて取り出す。不正なシーケンスはU+FFFDとして区切り、falseを返す。
+bool u8_split_chars(U8_CHARS& chars, std::string_view str, U8_DECODE_FN decode)
+{
+    // 呼び出し側は作業領域を使い回すので、予約しない。バイト数で予約すると、文字より何倍も多く確保してしまう。
+    chars.clear();
+
+    bool valid = true;
+    uint32_t u32s[U8_DECODE_BLOCK + 1], offsets[U8_DECODE_BLOCK + 1];
+    U8_GRAPHEME_STATE state(U8_GCB_CONTROL);
+    size_t start = 0;       // 区切っていない文字の開始位置。
+    uint32_t first = 0;     // その最初のコードポイント。
+    bool pending = false;   // 区切っていない文字があるか？
+    for (size_t ich = 0; ich < str.size(); )
+    {
+        size_t count = decode(&str[ich], str.size() - ich, u32s, offsets, U8_DECODE_BLOCK);
+        if (!count)
+        {
+            // 不正なシーケンスは次の先頭バイトまでを1文字にする。
+            if (pending)
+                chars.push_back({ str.substr(start, ich - start), first });
+            pending = false;
+            valid = false;
+            size_t end = ich + 1;
+            while (end < str.size() && !u8_is_lead(str[end]))
+                ++end;
+            chars.push_back({ str.substr(ich, end - ich), 0xFFFD });
+            ich = end;
+            continue;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            U8_GCB gcb = u8_gcb(u32s[i]);
+            if (pending && !u8_grapheme_break(state, gcb))
+                continue;
+            size_t pos = ich + offsets[i];
+            if (pending)
+                chars.push_back({ str.substr(start, pos - start), first });
+            state = U8_GRAPHEME_STATE(gcb);
+            start = pos;
+            first = u32s[i];
+            pending = true;
+        }
+        ich += offsets[count];
+    }
+    if (pending)
+        chars.push_back({ str.substr(start), first });
+
+    return valid;
+}
+
+// UTF-8文字列を実際の文字（書記素クラスタ）に区切る。
+bool u8_split_chars(U8_CHARS& chars, std::string_view str)
+{
+    static const U8_DECODE_FN s_fn = u8_select_decode();
+    return u8_split_chars(chars, str, s_fn);
+}
+
+void u8_split_chars_unittest(void)
+{
+#ifndef NDEBUG
+    U8_CHARS chars;
+    assert(u8_split_chars(chars, u8"aあ𠮷"));
+    assert(chars.size() == 3);
+    assert(chars[0].m_str == "a" && chars[0].m_u32 == 'a');
+    assert(chars[1].m_str == u8"あ" && chars[1].m_u32 == 0x3042);
+    assert(chars[2].m_str == u8"𠮷" && chars[2].m_u32 == 0x20BB7);
+    assert(u8_split_chars(chars, ""));
+    assert(chars.empty());
+
+    // 不正なシーケンス
+    assert(!u8_is_valid("\xC0\xAF"));         // 冗長な表現
+    assert(!u8_is_valid("\xED\xA0\x80"));     // サロゲート
+    assert(!u8_is_valid("\xF4\x90\x80\x80")); // U+10FFFFを超える
+    assert(!u8_is_valid("\xE3\x81"));         // 途中で切れている
+    assert(!u8_is_valid("\x80"));              // 継続バイト
+    assert(!u8_split_chars(chars, "a\xE3\x81" "b"));
+    assert(chars.size() == 3 && chars[1].m_u32 == 0xFFFD && chars[2].m_u32 == 'b');
+
+    // 書記素クラスタ
+    assert(u8_split_chars(chars, u8"か\u3099e\u0301\r\n")); // 結合文字、CRLF
+    assert(chars.size() == 3 && chars[0].m_u32 == 0x304B && chars[1].m_str == u8"e\u0301");
+    assert(u8_split_chars(chars, u8"葛\U000E0100辻")); // 異体字セレクタ（IVS）
+    assert(chars.size() == 2 && chars[0].m_str == u8"葛\U000E0100");
+    assert(u8_split_chars(chars, u8"\U0001F468\u200D\U0001F469\u200D\U0001F467\U0001F44D\U0001F3FD")); // ZWJ、肌の色
+    assert(chars.size() == 2);
+    assert(u8_split_chars(chars, u8"\U0001F1EF\U0001F1F5\U0001F1FA")); // 国旗
+    assert(chars.size() == 2 && chars[0].m_str.size() == 8);
+    assert(u8_split_chars(chars, u8"\u1100\u1161\u11A8")); // ハングルの字母
+    assert(chars.size() == 1);
+
+    // どの実装でも結果が同じか？
+    static const U8_ASCII_PREFIX_FN s_fns[] =
+    {
+        u8_ascii_prefix_scalar,
+#ifdef U8_HAVE_X86_SIMD
+        u8_cpu_has_sse2() ? u8_ascii_prefix_sse2 : u8_ascii_prefix_scalar,
+        u8_cpu_has_avx2() ? u8_ascii_prefix_avx2 : u8_ascii_prefix_scalar,
+#endif
+    };
+    std::string str(100, 'a');
+    for (size_t i = 0; i <= str.size(); ++i)
+    {
+        std::string s = str;
+        if (i < s.size())
+            s[i] = char(0xE3);
+        for (auto fn : s_fns)
+            assert(fn(s.data(), s.size()) == i);
+    }
+
+    // まとめてデコードしても、1文字ずつデコードしたのと同じか？
+    static const U8_DECODE_FN s_decode_fns[] =
+    {
+        u8_decode_scalar,
+#ifdef U8_HAVE_X86_SIMD
+        u8_cpu_has_sse2() ? u8_decode_sse2 : u8_decode_scalar,
+        u8_cpu_has_avx2() ? u8_decode_avx2 : u8_decode_scalar,
+#endif
+    };
+    static const char *const s_texts[] =
+    {
+        u8"ASCII only, longer than sixteen bytes.",
+        u8"あいうえおかきくけこさしすせそたちつてと", // 3バイトの文字の並び
+        u8"山田 太郎 様 (Yamada Taro) 〒100-0001 東京都千代田区",
+        u8"か\u3099葛\U000E0100e\u0301\r\n\U0001F468\u200D\U0001F469",
+        "\xE3\x81\x82\xE3\x81\x84\xE3\x81\x86\xE3\x81\x88\xED\xA0\x80\xE3\x81\x8A", // サロゲート
+        "\xE3\x81\x82\xE3\x81\x84\xE3\x81\x86\xE3\x81\x88\xE0\x80\x80\xE3\x81\x8A", // 冗長な表現
+        "abcdefghijklmno\xE3\x81pqrstuvwxyz0123456789", // 途中で切れている
+        "\xE3\x81\x82\xED\xA0\x80\xE3\x81\x84\xE3\x81\x86\xE3\x81\x88\xE3\x81\x8A", // 先頭近くのサロゲート
+        "\xC3\xA9\xF0\x9F\x98\x80\xC0\xAF\xE3\x81\x82\xF4\x90\x80\x80" "abcdefghijklmnop", // 冗長な表現と範囲外
+        "\xC3\xA9\xC3\xBC\xF0\x9F\x98\x80\xE3\x81\x82\xE3\x81\x84\x80\xE3\x81\x86\xC3\xA9\xC3\xA9\xC3\xA9", // はぐれた継続バイト
+    };
+    for (auto text : s_texts)
+    {
+        std::string_view view = text;
+        uint32_t u32s[U8_DECODE_BLOCK + 1], offsets[U8_DECODE_BLOCK + 1];
+        uint32_t u32s0[U8_DECODE_BLOCK + 1], offsets0[U8_DECODE_BLOCK + 1];
+        size_t count0 = u8_decode_scalar(view.data(), view.size(), u32s0, offsets0, 16);
+        U8_CHARS chars0;
+        bool valid0 = u8_split_chars(chars0, view, u8_decode_scalar);
+        for (auto fn : s_decode_fns)
+        {
+            size_t count = fn(view.data(), view.size(), u32s, offsets, 16);
+            assert(count == count0 && offsets[count] == offsets0[count0]);
+            for (size_t i = 0; i < count; ++i)
+                assert(u32s[i] == u32s0[i] && offsets[i] == offsets0[i]);
+
+            U8_CHARS chars1;
+            assert(u8_split_chars(chars1, view, fn) == valid0 && chars1.size() == chars0.size());
+            for (size_t i = 0; i < chars0.size(); ++i)
+                assert(chars1[i].m_str.data() == chars0[i].m_str.data() && chars1[i].m_str.size() == chars0[i].m_str.size() && chars1[i].m_u32 == chars0[i].m_u32);
+        }
+        assert(valid0 == u8_is_valid(view));
+    }
+#endif
+}
+
+// 行の文字を一度に分類する。
+void u8_classify_chars(std::vector<uint8_t>& classes, const U8_CHARS& chars)
+{
+    classes.resize(chars.size());
+    for (size_t ich = 0; ich < chars.size(); ++ich)
+        classes[ich] = u8_char_class(chars[ich].m_u32);
+}
+
+// 文字はスペースか？
+static inline bool u8_is_space(const char *ptr)
+{
+    return (u8_char_class(ptr) & U8CC_SPACE) != 0;
+}
+
+// カッコ（タイプ1）か？
+static inline bool u8_is_paren_type_1(const char *ptr)
+{
+    return (u8_char_class(ptr) & U8CC_PAREN_TYPE_1) != 0;
+}
+
+// カッコ（タイプ2）か？
+static inline bool u8_is_paren_type_2(const char *ptr)
+{
+    return (u8_char_class(ptr) & U8CC_PAREN_TYPE_2) != 0;
+}
+
+// カッコ（タイプ3）か？
+static inline bool u8_is_paren_type_3(const char *ptr)
+{
+    return (u8_char_class(ptr) & U8CC_PAREN_TYPE_3) != 0;
+}
+
+// 句読点か？
+static inline bool u8_is_comma_period(const char *ptr)
+{
+    return (u8_char_class(ptr) & U8CC_COMMA_PERIOD) != 0;
+}
+
+// 横棒か？
+static inline bool u8_is_hyphen_dash(const char *ptr)
+{
+    return (u8_char_class(ptr) & U8CC_HYPHEN_DASH) != 0;
+}
+
+// 小さいカナか？
+static inline bool u8_is_small_kana(const char *ptr)
+{
+    return (u8_char_class(ptr) & U8CC_SMALL_KANA) != 0;
+}
+
+// 文字の種類の区分（ヒストグラムのビン）。
+enum U8_SCRIPT_BIN : uint8_t
+{
+    U8SB_OTHER = 0,     // その他
+    U8SB_LATIN,         // ラテン文字
+    U8SB_HIRAGANA,      // ひらがな
+    U8SB_KATAKANA,      // カタカナ
+    U8SB_HAN,           // 漢字（日中韓で共通）
+    U8SB_HAN_EXT_A,     // 漢字（拡張A）
+    U8SB_HAN_MISC,      // 部首と新しい統合漢字・互換漢字
+    U8SB_HAN_EXT,       // 漢字（追加漢字面など）
+    U8SB_HANGUL,        // ハングル
+    U8SB_FULLWIDTH,     // 全角英数と半角カナ
+    U8SB_CJK_PUNCT,     // CJKの記号と句読点
+    U8SB_MAX
+};
+
+// 文字の範囲と区分。
+struct U8_SCRIPT_RANGE
+{
+    uint32_t m_first;
+    uint32_t m_last;
+    U8_SCRIPT_BIN m_bin;
+};
+
+// 非ASCIIの区分の範囲。m_firstの昇順で、重ならないこと。
+static constexpr U8_SCRIPT_RANGE g_u8_script_ranges[] =
+{
+    { 0x00C0, 0x024F, U8SB_LATIN },         // Latin-1 Supplement..Latin Extended-B
+    { 0x1100, 0x11FF, U8SB_HANGUL },        // Hangul Jamo
+    { 0x2E80, 0x2EFF, U8SB_HAN_MISC },      // CJK Radicals Supplement
+    { 0x2F00, 0x2FDF, U8SB_HAN_MISC },      // CJK Radicals
+    { 0x3000, 0x303F, U8SB_CJK_PUNCT },     // CJK Symbols and Punctuation
+    { 0x3040, 0x309F, U8SB_HIRAGANA },      // Hiragana
+    { 0x30A0, 0x30FF, U8SB_KATAKANA },      // Katakana
+    { 0x3130, 0x318F, U8SB_HANGUL },        // Hangul Compatibility Jamo
+    { 0x31F0, 0x31FF, U8SB_KATAKANA },      // Katakana Phonetic Extensions
+    { 0x3400, 0x4DB5, U8SB_HAN_EXT_A },     // CJK Unified Ideographs Extension A
+    { 0x4DB6, 0x4DBF, U8SB_HAN_EXT },       // CJK Unified Ideographs Extension A (later)
+    { 0x4E00, 0x9FCB, U8SB_HAN },           // CJK Unified Ideographs
+    { 0x9FCC, 0x9FFF, U8SB_HAN_MISC },      // CJK Unified Ideographs (later)
+    { 0xA960, 0xA97F, U8SB_HANGUL },        // Hangul Jamo Extended-A
+    { 0xAC00, 0xD7AF, U8SB_HANGUL },        // Hangul Syllables
+    { 0xD7B0, 0xD7FF, U8SB_HANGUL },        // Hangul Jamo Extended-B
+    { 0xF900, 0xFA6A, U8SB_HAN },           // CJK Compatibility Ideographs
+    { 0xFA6B, 0xFAFF, U8SB_HAN_MISC },      // CJK Compatibility Ideographs (later)
+    { 0xFF01, 0xFF9D, U8SB_FULLWIDTH },     // Fullwidth ASCII and Halfwidth Katakana
+    { 0xFFA0, 0xFFDF, U8SB_HANGUL },        // Halfwidth Hangul
+    { 0x20000, 0x2A6DF, U8SB_HAN_EXT },     // CJK Unified Ideographs Extension B
+    { 0x2A700, 0x2EBEF, U8SB_HAN_EXT },     // CJK Unified Ideographs Extension C..F
+    { 0x2F800, 0x2FA1F, U8SB_HAN_EXT },     // CJK Compatibility Ideographs Supplement
+    { 0x30000, 0x323AF, U8SB_HAN_EXT },     // CJK Unified Ideographs Extension G..H
+};
+
+constexpr bool u8_script_ranges_are_sorted(void)
+{
+    for (size_t i = 0; i < _countof(g_u8_script_ranges); ++i)
+    {
+        if (g_u8_script_ranges[i].m_first > g_u8_script_ranges[i].m_last)
+            return false;
+        if (i > 0 && g_u8_script_ranges[i - 1].m_last >= g_u8_script_ranges[i].m_first)
+            return false;
+    }
+    return true;
+}
+static_assert(u8_script_ranges_are_sorted(), "g_u8_script_ranges must be sorted and disjoint");
+
+// 文字の区分を二分探索で取得する。
+constexpr U8_SCRIPT_BIN u8_script_bin(uint32_t u32)
+{
+    if (u32 < 0x80)
+        return (uint32_t((u32 | 0x20) - 'a') < 26) ? U8SB_LATIN : U8SB_OTHER;
+
+    size_t lo = 0, hi = _countof(g_u8_script_ranges);
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (g_u8_script_ranges[mid].m_last < u32)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < _countof(g_u8_script_ranges) && g_u8_script_ranges[lo].m_first <= u32)
+        return g_u8_script_ranges[lo].m_bin;
+    return U8SB_OTHER;
+}
+static_assert(u8_script_bin('A') == U8SB_LATIN, "");
+static_assert(u8_script_bin('1') == U8SB_OTHER, "");
+static_assert(u8_script_bin(0x3042) == U8SB_HIRAGANA, "");
+static_assert(u8_script_bin(0x4DB5) == U8SB_HAN_EXT_A, "");
+static_assert(u8_script_bin(0x4DB6) == U8SB_HAN_EXT, "");
+static_assert(u8_script_bin(0xD55C) == U8SB_HANGUL, "");
+static_assert(u8_script_bin(0x323B0) == U8SB_OTHER, "");
+
+// テキストの文字の種類のヒストグラム。
+struct U8_SCRIPT_HISTOGRAM
+{
+    size_t m_counts[U8SB_MAX] = { 0 };
+    bool m_invalid = false; // 不正なUTF-8があったか？
+
+    size_t count(U8_SCRIPT_BIN bin) const
+    {
+        return m_counts[bin];
+    }
+
+    // 日本語らしさ。2: かなを含む、1: 漢字や全角文字を含む、0: それ以外。
+    int japanese_level() const
+    {
+        if (m_invalid)
+            return 0;
+        if (count(U8SB_HIRAGANA) || count(U8SB_KATAKANA))
+            return 2;
+        if (count(U8SB_HAN) || count(U8SB_HAN_EXT_A) || count(U8SB_FULLWIDTH) || count(U8SB_CJK_PUNCT))
+            return 1;
+        return 0;
+    }
+
+    // 中国語らしさ。1: 漢字を含む、0: それ以外。
+    int chinese_level() const
+    {
+        if (m_invalid)
+            return 0;
+        if (count(U8SB_HAN) || count(U8SB_HAN_EXT_A) || count(U8SB_HAN_MISC) ||
+            count(U8SB_HAN_EXT) || count(U8SB_CJK_PUNCT))
+        {
+            return 1;
+        }
+        return 0;
+    }
+
+    // 韓国語らしさ。2: ハングルを含む、1: 漢字を含む、0: それ以外。
+    int korean_level() const
+    {
+        if (m_invalid)
+            return 0;
+        if (count(U8SB_HANGUL))
+            return 2;
+        if (count(U8SB_HAN) || count(U8SB_HAN_MISC) || count(U8SB_CJK_PUNCT))
+            return 1;
+        return 0;
+    }
+};
+
+// 一度のデコードでテキストの文字の種類を数えて加える。不正なUTF-8があればそこで止める。
+// テキストを分けて与えるときは、文字の途中で分けないこと。
+void u8_script_histogram_add(U8_SCRIPT_HISTOGRAM& hist, std::string_view str)
+{
+    if (hist.m_invalid)
+        return;
+    for (size_t ich = 0; ich < str.size(); )
+    {
+        uint8_t ch = uint8_t(str[ich]);
+        if (ch < 0x80)
+        {
+            hist.m_counts[U8SB_OTHER + (uint32_t((ch | 0x20) - 'a') < 26)]++;
+            ++ich;
+            continue;
+        }
+
+        uint32_t u32;
+        int skip = u8_decode_one(&str[ich], str.size() - ich, &u32);
+        if (!skip)
+        {
+            hist.m_invalid = true;
+            break;
+        }
+        hist.m_counts[u8_script_bin(u32)]++;
+        ich += skip;
+    }
+}
+
+// 一度のデコードでテキストの文字の種類を数える。
+void u8_script_histogram(U8_SCRIPT_HISTOGRAM& hist, std::string_view str)
+{
+    hist = U8_SCRIPT_HISTOGRAM();
+    u8_script_histogram_add(hist, str);
+}
+
+// UTF-8文字列が日本語テキストかどうか判定する。
+int u8_is_japanese_text(const char *str)
+{
+    U8_SCRIPT_HISTOGRAM hist;
+    u8_script_histogram(hist, str);
+    return hist.japanese_level();
+}
+
+void u8_is_japanese_text_unittest(void)
+{
+#ifndef NDEBUG
+    assert(!u8_is_japanese_text(u8""));
+    assert(!u8_is_japanese_text(u8"ABCabc123"));
+    assert(u8_is_japanese_text(u8"あ")); // Hiragana
+    assert(u8_is_japanese_text(u8"ア")); // Katanaka
+    assert(u8_is_japanese_text(u8"ｱ")); // Halfwidth Katanaka
+    assert(u8_is_japanese_text(u8"漢字")); // Kanji
+    assert(u8_is_japanese_text(u8"ＡＢＣ")); // Fullwidth ASCII
+
+    U8_SCRIPT_HISTOGRAM hist;
+    u8_script_histogram(hist, u8"Aあ漢한");
+    assert(hist.count(U8SB_LATIN) == 1 && hist.count(U8SB_HIRAGANA) == 1);
+    assert(hist.count(U8SB_HAN) == 1 && hist.count(U8SB_HANGUL) == 1);
+    assert(hist.japanese_level() == 2 && hist.chinese_level() == 1 && hist.korean_level() == 2);
+    u8_script_histogram(hist, u8"\U00020BB7"); // Extension B
+    assert(hist.japanese_level() == 0 && hist.chinese_level() == 1 && hist.korean_level() == 0);
+    u8_script_histogram(hist, "\xE3\x81");
+    assert(hist.m_invalid && !hist.japanese_level());
+#endif
+}
+
+// UTF-8文字列が中国語テキストかどうか判定する。
+int u8_is_chinese_text(const char *str)
+{
+    U8_SCRIPT_HISTOGRAM hist;
+    u8_script_histogram(hist, str);
+    return hist.chinese_level();
+}
+
+// UTF-8文字列が韓国語テキストかどうか判定する。
+int u8_is_korean_text(const char *str)
+{
+    U8_SCRIPT_HISTOGRAM hist;
+    u8_script_histogram(hist, str);
+    return hist.korean_level();
+}
+
+// スケーリング済みフォントのキャッシュの項目。
+struct PDF_SCALED_FONT_ENTRY
+{
+    cairo_font_face_t *m_face;
+    double m_font_size;
+    cairo_matrix_t m_ctm;
+    cairo_scaled_font_t *m_scaled_font;
+};
+
+// スケーリング済みフォントのキャッシュ（LRU）。
+// トイAPIのようにcairo_tの状態を変えずに、フェイス・サイズ・行列ごとのフォントを保持する。
+struct PDF_SCALED_FONT_CACHE
+{
+    std::list<PDF_SCALED_FONT_ENTRY> m_entries; // 最近使ったものが先頭。
+    cairo_font_options_t *m_options = nullptr;
+    size_t m_hits = 0;
+    size_t m_misses = 0;
+};
+
+// スケーリング済みフォントのキャッシュの最大項目数。
+#define PDF_SCALED_FONT_CACHE_SIZE 8
+
+// フォントサイズ1.0における文字のメトリックスのキャッシュ（フォントフェイスごと）。
+// テキストのエクステントはフォントサイズに比例するので、一度だけ測れば済む。
+struct PDF_METRICS_CACHE
+{
+    cairo_font_extents_t m_font_extents; // フォントのエクステント。
+    std::unordered_map<uint32_t, cairo_text_extents_t> m_char_extents; // コードポイントから文字のエクステントへ。
+    // 複数のコードポイントからなる文字のエクステント。キーはm_cluster_keysの文字列を指すので、
+    // 引くときは文字列を作らない。m_cluster_keysの要素は追加しても移動しない。
+    std::unordered_map<std::string_view, cairo_text_extents_t> m_cluster_extents;
+    std::deque<std::string> m_cluster_keys;
+};
+
+// 行のテキストのグリフ。文字ichのグリフはm_glyphs[m_char_first[ich]]からm_glyphs[m_char_first[ich + 1]]の手前まで。
+struct PDF_ROW_GLYPHS
+{
+    std::vector<cairo_glyph_t> m_glyphs;
+    std::vector<size_t> m_char_first;
+};
+
+// 同じ変換行列で描画するグリフの並び。
+struct PDF_GLYPH_RUN
+{
+    cairo_matrix_t m_matrix; // 変換行列（平行移動なし）。
+    std::vector<cairo_glyph_t> m_glyphs;
+};
+
+#ifdef PDFPLACA_USE_HARFBUZZ
+
+// HarfBuzzで整形したグリフ（フォントサイズ1.0での値。yは上向き）。
+struct PDF_SHAPED_GLYPH
+{
+    unsigned long m_index;      // グリフ番号。
+    uint32_t m_cluster;         // 元のテキストでのバイト位置。
+    double m_x_advance, m_y_advance;
+    double m_x_offset, m_y_offset;
+};
+
+// 整形済みの行のテキスト。
+struct PDF_SHAPED_TEXT
+{
+    std::vector<PDF_SHAPED_GLYPH> m_glyphs;
+    double m_advance;           // 進行方向の長さの合計。
+    double m_column_width;      // 縦書きの列の幅（グリフの横方向の送り幅の最大値）。
+};
+
+// 整形済みテキストのキャッシュ（書字方向ごと）。最近使ったものが先頭。
+// m_indexのキーはm_entriesの文字列を指すので、引くときは文字列を作らない。
+struct PDF_SHAPED_TEXT_CACHE
+{
+    std::list<std::pair<std::string, PDF_SHAPED_TEXT>> m_entries;
+    std::unordered_map<std::string_view, std::list<std::pair<std::string, PDF_SHAPED_TEXT>>::iterator> m_index;
+};
+
+// 整形済みテキストのキャッシュの最大項目数（書字方向ごと）。超えたら最も古いものを捨てる。
+#define PDF_SHAPED_TEXT_CACHE_SIZE 1024
+
+// フォントフェイスごとのHarfBuzzの状態。
+// 用字はテキストから決まるので、整形済みテキストはフェイス・書字方向・テキストで引けば、用字ごとに引くのと同じになる。
+struct PDF_HB_FACE
+{
+    hb_face_t *m_face = nullptr;
+    hb_font_t *m_font = nullptr;    // フォントの単位（upem）のままの大きさ。
+#ifdef CAIRO_HAS_WIN32_FONT
+    HFONT m_hFont = nullptr;        // m_faceが表を読み込むフォント。
+#endif
+    double m_upem = 1;
+    std::unordered_map<uint64_t, hb_shape_plan_t *> m_plans;    // 用字と書字方向からシェーププランへ。
+    PDF_SHAPED_TEXT_CACHE m_shaped[2];  // 横書き、縦書き。
+};
+
+#endif // def PDFPLACA_USE_HARFBUZZ
+
+// 描画の文脈。キャッシュと、描画中のジョブの状態を持つ。
+// グローバル変数を使わないので、文脈ごとに別のスレッドで描画してよい。一つの文脈を同時に使ってはいけない。
+struct PDF_FONT_PROFILE;
+struct PDF_PAGE_LAYOUT;
+
+struct PLACARD_CONTEXT
+{
+    std::unordered_map<std::string, cairo_font_face_t *> m_font_faces; // フォント名から解決済みのフォントフェイスへ。参照を保持する。
+    std::unordered_map<cairo_font_face_t *, std::shared_ptr<const PDF_FONT_PROFILE>> m_font_profiles; // フォントフェイスごとのプロファイル。
+    PDF_SCALED_FONT_CACHE m_scaled_font_cache; // スケーリング済みフォントのキャッシュ。
+    std::unordered_map<cairo_font_face_t *, PDF_METRICS_CACHE> m_metrics_caches; // フォントフェイスごとのメトリックスキャッシュ。
+#ifdef PDFPLACA_USE_HARFBUZZ
+    std::unordered_map<cairo_font_face_t *, PDF_HB_FACE> m_hb_faces; // フォントフェイスごとのHarfBuzzの状態。読み込めなかったフェイスも覚えておく。
+#endif
+    const PLACARD_JOB *m_job = nullptr; // 描画中のジョブ。
+    bool m_vertical = false;            // 縦書きか？（エラーのテキストは横書きにする）
+    double m_y_adjust = 0;              // Y方向の補正(pt)。
+    FILE *m_log = stdout;               // 進行状況の出力先。PDFを標準出力に書くときは標準エラー出力。
+    PDF_PAGE_LAYOUT *m_layout = nullptr; // レイアウト中のページ。
+    // 行を描画するときの作業領域。行ごとに確保し直さずに使い回す。
+    std::string m_row_text;                 // 全角に変換した行のテキスト。
+    U8_CHARS m_row_chars;                   // 行の文字。
+    std::vector<uint8_t> m_row_classes;     // 行の文字の分類。
+    PDF_ROW_GLYPHS m_row_glyphs;            // 行のグリフ。
+    std::vector<double> m_row_advances;     // 整形済みの行の文字ごとの送り幅。
+    std::vector<PDF_GLYPH_RUN> m_row_runs;  // 行のグリフの並び。
+    std::vector<PLACARD_CONTEXT *> m_layout_workers; // ページのレイアウトを並列に求める作業者の文脈。
+};
+
+// フェイス・サイズ・行列に対応するスケーリング済みフォントを取得する。参照はキャッシュが保持する。
+cairo_scaled_font_t *pdf_get_scaled_font(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, double font_size, const cairo_matrix_t& ctm)
+{
+    auto& cache = ctx.m_scaled_font_cache;
+    for (auto it = cache.m_entries.begin(); it != cache.m_entries.end(); ++it)
+    {
+        if (it->m_face == face && it->m_font_size == font_size &&
+            it->m_ctm.xx == ctm.xx && it->m_ctm.yx == ctm.yx &&
+            it->m_ctm.xy == ctm.xy && it->m_ctm.yy == ctm.yy)
+        {
+            ++cache.m_hits;
+            cache.m_entries.splice(cache.m_entries.begin(), cache.m_entries, it);
+            return it->m_scaled_font;
+        }
+    }
+    ++cache.m_misses;
+
+    if (!cache.m_options)
+    {
+        // PDFサーフェスと同じく、ヒンティングしない。メトリックスはサイズに比例する。
+        cache.m_options = cairo_font_options_create();
+        cairo_font_options_set_hint_style(cache.m_options, CAIRO_HINT_STYLE_NONE);
+        cairo_font_options_set_hint_metrics(cache.m_options, CAIRO_HINT_METRICS_OFF);
+    }
+
+    // 最も古いものを捨てる。
+    if (cache.m_entries.size() >= PDF_SCALED_FONT_CACHE_SIZE)
+    {
+        cairo_scaled_font_destroy(cache.m_entries.back().m_scaled_font);
+        cache.m_entries.pop_back();
+    }
+
+    cairo_matrix_t font_matrix;
+    cairo_matrix_init_scale(&font_matrix, font_size, font_size);
+    cairo_matrix_t linear_ctm = ctm;
+    linear_ctm.x0 = linear_ctm.y0 = 0;
+    auto scaled_font = cairo_scaled_font_create(face, &font_matrix, &linear_ctm, cache.m_options);
+    cache.m_entries.push_front({ face, font_size, linear_ctm, scaled_font });
+    return scaled_font;
+}
+
+// 単位行列でのスケーリング済みフォントを取得する。
+cairo_scaled_font_t *pdf_get_scaled_font(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, double font_size)
+{
+    cairo_matrix_t identity;
+    cairo_matrix_init_identity(&identity);
+    return pdf_get_scaled_font(ctx, face, font_size, identity);
+}
+
+// スケーリング済みフォントのキャッシュを破棄する。
+void pdf_clear_scaled_font_cache(PLACARD_CONTEXT& ctx)
+{
+    auto& cache = ctx.m_scaled_font_cache;
+    for (auto& entry : cache.m_entries)
+        cairo_scaled_font_destroy(entry.m_scaled_font);
+    cache.m_entries.clear();
+    if (cache.m_options)
+    {
+        cairo_font_options_destroy(cache.m_options);
+        cache.m_options = nullptr;
+    }
+}
+
+// フォントフェイスのメトリックスキャッシュを取得する。
+PDF_METRICS_CACHE& pdf_get_metrics_cache(PLACARD_CONTEXT& ctx, cairo_font_face_t *face)
+{
+    auto it = ctx.m_metrics_caches.find(face);
+    if (it != ctx.m_metrics_caches.end())
+        return it->second;
+
+    // フォントフェイスが解放されてアドレスが再利用されないように参照を保持する。
+    cairo_font_face_reference(face);
+
+    auto& cache = ctx.m_metrics_caches[face];
+    cairo_scaled_font_extents(pdf_get_scaled_font(ctx, face, 1), &cache.m_font_extents);
+    return cache;
+}
+
+#ifdef PDFPLACA_USE_HARFBUZZ
+
+// フォントフェイスに対応するHarfBuzzの状態を取得する。読み込めなければnullptrを返す。
+PDF_HB_FACE *pdf_get_hb_face(PLACARD_CONTEXT& ctx, cairo_font_face_t *face)
+{
+    auto it = ctx.m_hb_faces.find(face);
+    if (it != ctx.m_hb_faces.end())
+        return it->second.m_font ? &it->second : nullptr;
+
+    // フォントフェイスが解放されてアドレスが再利用されないように参照を保持する。
+    cairo_font_face_reference(face);
+
+    auto& hb = ctx.m_hb_faces[face];
+    cairo_scaled_font_t *scaled_font = pdf_get_scaled_font(ctx, face, 1);
+    if (cairo_scaled_font_status(scaled_font) != CAIRO_STATUS_SUCCESS)
+        return nullptr;
+
+#ifdef CAIRO_HAS_WIN32_FONT
+    if (cairo_scaled_font_get_type(scaled_font) == CAIRO_FONT_TYPE_WIN32)
+    {
+        // GDIは表ごとに読み込むので、TTCのフォントでも正しく読める。
+        HDC hDC = CreateCompatibleDC(NULL);
+        if (hDC)
+        {
+            if (cairo_win32_scaled_font_select_font(scaled_font, hDC) == CAIRO_STATUS_SUCCESS)
+            {
+                LOGFONTW lf;
+                if (GetObjectW(GetCurrentObject(hDC, OBJ_FONT), sizeof(lf), &lf))
+                    hb.m_hFont = CreateFontIndirectW(&lf);
+                cairo_win32_scaled_font_done_font(scaled_font);
+            }
+            DeleteDC(hDC);
+        }
+        if (hb.m_hFont)
+            hb.m_face = hb_gdi_face_create(hb.m_hFont);
+    }
+#endif
+
+#ifdef CAIRO_HAS_FT_FONT
+    if (cairo_scaled_font_get_type(scaled_font) == CAIRO_FONT_TYPE_FT)
+    {
+        FT_Face ft_face = cairo_ft_scaled_font_lock_face(scaled_font);
+        if (ft_face)
+        {
+            hb.m_face = hb_ft_face_create_referenced(ft_face);
+            cairo_ft_scaled_font_unlock_face(scaled_font);
+        }
+    }
+#endif
+
+    if (!hb.m_face)
+        return nullptr;
+
+    hb.m_upem = hb_face_get_upem(hb.m_face);
+    hb.m_font = hb_font_create(hb.m_face);
+    hb_ot_font_set_funcs(hb.m_font);
+    hb_font_set_scale(hb.m_font, int(hb.m_upem), int(hb.m_upem));
+    return &hb;
+}
+
+// HarfBuzzの状態をすべて破棄する。
+void pdf_clear_hb_faces(PLACARD_CONTEXT& ctx)
+{
+    for (auto& pair : ctx.m_hb_faces)
+    {
+        auto& hb = pair.second;
+        for (auto& plan : hb.m_plans)
+            hb_shape_plan_destroy(plan.second);
+        if (hb.m_font)
+            hb_font_destroy(hb.m_font);
+        if (hb.m_face)
+            hb_face_destroy(hb.m_face);
+#ifdef CAIRO_HAS_WIN32_FONT
+        if (hb.m_hFont)
+            DeleteObject(hb.m_hFont);
+#endif
+        cairo_font_face_destroy(pair.first);
+    }
+    ctx.m_hb_faces.clear();
+}
+
+#endif // def PDFPLACA_USE_HARFBUZZ
+
+// メトリックスキャッシュをすべて破棄する。
+void pdf_clear_metrics_caches(PLACARD_CONTEXT& ctx)
+{
+    for (auto& pair : ctx.m_metrics_caches)
+        cairo_font_face_destroy(pair.first);
+    ctx.m_metrics_caches.clear();
+#ifdef PDFPLACA_USE_HARFBUZZ
+    pdf_clear_hb_faces(ctx);
+#endif
+}
+
+// フォントフェイスとフォントサイズでの文字のエクステントを取得する（キャッシュ付き）。
+void pdf_char_extents(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, double font_size, const U8_SEGMENT& text_char, cairo_text_extents_t *extents)
+{
+    if (text_char.m_str.empty())
+    {
+        *extents = cairo_text_extents_t();
+        return;
+    }
+
+    auto& cache = pdf_get_metrics_cache(ctx, face);
+    if (text_char.m_str.size() <= 4 && u8_get_skip_chars(text_char.m_str[0]) == int(text_char.m_str.size()))
+    {
+        // 1つのコードポイントはコードポイントで引く。
+        auto it = cache.m_char_extents.find(text_char.m_u32);
+        if (it == cache.m_char_extents.end())
+        {
+            // フォントサイズ1.0で測る。
+            char buf[8];
+            std::memcpy(buf, text_char.m_str.data(), text_char.m_str.size());
+            buf[text_char.m_str.size()] = 0;
+            cairo_text_extents_t unit_extents;
+            cairo_scaled_font_text_extents(pdf_get_scaled_font(ctx, face, 1), buf, &unit_extents);
+            it = cache.m_char_extents.emplace(text_char.m_u32, unit_extents).first;
+        }
+        *extents = it->second;
+    }
+    else
+    {
+        // 書記素クラスタは文字列で引く。追加するときだけキーの文字列を確保する。
+        auto it = cache.m_cluster_extents.find(text_char.m_str);
+        if (it == cache.m_cluster_extents.end())
+        {
+            // フォントサイズ1.0で測る。
+            const std::string& key = cache.m_cluster_keys.emplace_back(text_char.m_str);
+            cairo_text_extents_t unit_extents;
+            cairo_scaled_font_text_extents(pdf_get_scaled_font(ctx, face, 1), key.c_str(), &unit_extents);
+            it = cache.m_cluster_extents.emplace(key, unit_extents).first;
+        }
+        *extents = it->second;
+    }
+
+    extents->x_bearing *= font_size;
+    extents->y_bearing *= font_size;
+    extents->width *= font_size;
+    extents->height *= font_size;
+    extents->x_advance *= font_size;
+    extents->y_advance *= font_size;
+}
+
+// フォントフェイスとフォントサイズでの文字のエクステントを取得する（キャッシュ付き）。
+void pdf_char_extents(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, double font_size, const char *text_char, cairo_text_extents_t *extents)
+{
+    // 1文字でなければキャッシュしない。
+    int skip;
+    uint32_t u32 = u32_from_u8(text_char, &skip);
+    if (*text_char && (skip <= 0 || text_char[skip] != 0))
+    {
+        cairo_scaled_font_text_extents(pdf_get_scaled_font(ctx, face, font_size), text_char, extents);
+        return;
+    }
+
+    pdf_char_extents(ctx, face, font_size, U8_SEGMENT { text_char, u32 }, extents);
+}
+
+// フォントフェイスとフォントサイズでのフォントのエクステントを取得する（キャッシュ付き）。
+void pdf_font_extents(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, double font_size, cairo_font_extents_t *font_extents)
+{
+    *font_extents = pdf_get_metrics_cache(ctx, face).m_font_extents;
+    font_extents->ascent *= font_size;
+    font_extents->descent *= font_size;
+    font_extents->height *= font_size;
+    font_extents->max_x_advance *= font_size;
+    font_extents->max_y_advance *= font_size;
+}
+
+// フォントフェイスが日本語対応か判定する。
+bool pdf_is_font_japanese(PLACARD_CONTEXT& ctx, cairo_font_face_t *face)
+{
+    cairo_text_extents_t extents;
+    pdf_char_extents(ctx, face, 30, u8"あ", &extents);
+    return !(extents.width < 1 || extents.height < 1);
+}
+
+// フォントフェイスが中国語対応か判定する。
+bool pdf_is_font_chinese(PLACARD_CONTEXT& ctx, cairo_font_face_t *face)
+{
+    cairo_text_extents_t extents;
+    pdf_char_extents(ctx, face, 30, u8"沉", &extents);
+    return !(extents.width < 1 || extents.height < 1);
+}
+
+// フォントフェイスが韓国語対応か判定する。
+bool pdf_is_font_korean(PLACARD_CONTEXT& ctx, cairo_font_face_t *face)
+{
+    cairo_text_extents_t extents;
+    pdf_char_extents(ctx, face, 30, u8"작", &extents);
+    return !(extents.width < 1 || extents.height < 1);
+}
+
+// 原点を中心として複素数xを回転する。
+template <typename T>
+inline std::complex<T>
+complex_rotate(std::complex<T> c, const T& theta)
+{
+    return c * std::polar<T>(1, theta);
+}
+
+// 複素数xを平行移動する。
+template <typename T>
+inline std::complex<T>
+complex_translate(std::complex<T> c, const T& x0, const T& y0)
+{
+    return c + std::complex<T>(x0, y0);
+}
+
+// 二つの値がほとんど等しいか？
+inline bool is_nearly_equal(double x0, double x1)
+{
+    return std::fabs(x1 - x0) < 0.25;
+}
+
+// フォントに収録されている文字の集合（コードポイントごとに1ビット）。
+// 0x110000個のコードポイントを256個ずつのページに分けた2段階の表で、空のページと満杯のページは共有する。
+struct PDF_CHAR_COVERAGE
+{
+    std::vector<uint16_t> m_page_index;             // ページ番号。0は空のページ、1は満杯のページ。
+    std::vector<std::array<uint32_t, 8>> m_pages;   // 各ページのビット列。
+
+    PDF_CHAR_COVERAGE() : m_page_index(0x110000 / 256, 0), m_pages(2)
+    {
+        m_pages[0].fill(0);
+        m_pages[1].fill(0xFFFFFFFF);
+    }
+
+    // コードポイントが収録されているか？
+    bool has(uint32_t u32) const
+    {
+        if (u32 >= 0x110000)
+            return false;
+        auto& page = m_pages[m_page_index[u32 >> 8]];
+        return (page[(u32 >> 5) & 7] >> (u32 & 31)) & 1;
+    }
+
+    // コードポイントを追加する。
+    void add(uint32_t u32)
+    {
+        if (u32 >= 0x110000)
+            return;
+        auto& index = m_page_index[u32 >> 8];
+        if (index == 1)
+            return;
+        if (index == 0)
+        {
+            index = uint16_t(m_pages.size());
+            m_pages.emplace_back();
+            m_pages.back().fill(0);
+        }
+        m_pages[index][(u32 >> 5) & 7] |= (1U << (u32 & 31));
+    }
+
+    // コードポイントの範囲を追加する。
+    void add_range(uint32_t first, uint32_t last)
+    {
+        if (last >= 0x110000)
+            last = 0x10FFFF;
+        for (uint32_t u32 = first; u32 <= last && u32 >= first; )
+        {
+            if ((u32 & 0xFF) == 0 && u32 + 0xFF <= last) // ページ全体か？
+            {
+                m_page_index[u32 >> 8] = 1;
+                u32 += 0x100;
+            }
+            else
+            {
+                add(u32);
+                ++u32;
+            }
+        }
+    }
+};
+
+// ビッグエンディアンの値を読む。
+inline uint16_t pdf_read_u16(const uint8_t *ptr)
+{
+    return uint16_t((ptr[0] << 8) | ptr[1]);
+}
+inline uint32_t pdf_read_u32(const uint8_t *ptr)
+{
+    return (uint32_t(ptr[0]) << 24) | (uint32_t(ptr[1]) << 16) | (uint32_t(ptr[2]) << 8) | ptr[3];
+}
+
+// TrueType/OpenTypeの'cmap'テーブルを読んで、グリフのあるコードポイントを追加する。
+// 全Unicodeのフォーマット12を優先し、なければ基本多言語面のフォーマット4を読む。
+// 読めるサブテーブルがなければfalseを返す。
+bool pdf_parse_cmap(const uint8_t *data, size_t size, PDF_CHAR_COVERAGE& coverage)
+{
+    if (size < 4)
+        return false;
+
+    // Unicodeのサブテーブルを探す。
+    size_t format4 = 0, format12 = 0;
+    size_t num_tables = pdf_read_u16(data + 2);
+    for (size_t i = 0; i < num_tables && 4 + 8 * (i + 1) <= size; ++i)
+    {
+        const uint8_t *record = data + 4 + 8 * i;
+        uint16_t platform = pdf_read_u16(record), encoding = pdf_read_u16(record + 2);
+        size_t offset = pdf_read_u32(record + 4);
+        if (offset + 2 > size || offset < 4)
+            continue;
+        bool unicode = (platform == 0) || (platform == 3 && (encoding == 1 || encoding == 10));
+        if (!unicode)
+            continue;
+        uint16_t format = pdf_read_u16(data + offset);
+        if (format == 12 && !format12)
+            format12 = offset;
+        else if (format == 4 && !format4)
+            format4 = offset;
+    }
+
+    if (format12)
+    {
+        // 連続した範囲のグループの並び。
+        if (format12 + 16 > size)
+            return false;
+        const uint8_t *table = data + format12;
+        size_t num_groups = pdf_read_u32(table + 12);
+        if (num_groups > (size - format12 - 16) / 12)
+            return false;
+        for (size_t i = 0; i < num_groups; ++i)
+        {
+            const uint8_t *group = table + 16 + 12 * i;
+            uint32_t first = pdf_read_u32(group), last = pdf_read_u32(group + 4);
+            uint32_t glyph = pdf_read_u32(group + 8);
+            if (glyph == 0) // 最初のコードポイントは.notdefに割り当てられている。
+                ++first;
+            if (first <= last)
+                coverage.add_range(first, last);
+        }
+        return true;
+    }
+
+    if (format4)
+    {
+        // 区間ごとに、差分か、グリフ番号の配列で割り当てる。
+        if (format4 + 14 > size)
+            return false;
+        const uint8_t *table = data + format4;
+        size_t length = std::min<size_t>(pdf_read_u16(table + 2), size - format4);
+        size_t seg_count = pdf_read_u16(table + 6) / 2;
+        if (16 + 8 * seg_count > length)
+            return false;
+        const uint8_t *ends = table + 14, *starts = ends + 2 * seg_count + 2;
+        const uint8_t *deltas = starts + 2 * seg_count, *range_offsets = deltas + 2 * seg_count;
+        for (size_t i = 0; i < seg_count; ++i)
+        {
+            uint32_t first = pdf_read_u16(starts + 2 * i), last = pdf_read_u16(ends + 2 * i);
+            uint16_t delta = pdf_read_u16(deltas + 2 * i), range_offset = pdf_read_u16(range_offsets + 2 * i);
+            if (last == 0xFFFF) // 最後の区間は番兵。
+                last = 0xFFFE;
+            for (uint32_t u32 = first; u32 <= last; ++u32)
+            {
+                uint16_t glyph;
+                if (range_offset == 0)
+                {
+                    glyph = uint16_t(u32 + delta);
+                }
+                else
+                {
+                    size_t pos = (range_offsets + 2 * i - table) + range_offset + 2 * (u32 - first);
+                    if (pos + 2 > length)
+                        break;
+                    glyph = pdf_read_u16(table + pos);
+                    if (glyph)
+                        glyph = uint16_t(glyph + delta);
+                }
+                if (glyph)
+                    coverage.add(u32);
+            }
+        }
+        return true;
+    }
+
+    return false;
+}
+
+// テキストのうち、フォントに収録されていない文字を列挙する。
+// 既定で無視できる文字（異体字セレクタ、ZWJなど）は字形を持たないことが多いので数えない。
+bool pdf_find_missing_chars(const PDF_CHAR_COVERAGE& coverage, std::string_view str, std::vector<uint32_t>& missing)
+{
+    missing.clear();
+    for (size_t ich = 0; ich < str.size(); )
+    {
+        uint32_t u32;
+        int skip = u8_decode_one(&str[ich], str.size() - ich, &u32);
+        if (!skip)
+            break;
+        ich += skip;
+        if (u32 < 0x20 || u32 == 0x7F) // 制御文字は描画しない。
+            continue;
+        if (!coverage.has(u32) && !u8_is_default_ignorable(u32))
+            missing.push_back(u32);
+    }
+    std::sort(missing.begin(), missing.end());
+    missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+    return !missing.empty();
+}
+
+void pdf_parse_cmap_unittest(void)
+{
+#ifndef NDEBUG
+    // バイト列を組み立てる。
+    struct WRITER
+    {
+        std::vector<uint8_t> m_data;
+        void u16(uint32_t value) { m_data.push_back(uint8_t(value >> 8)); m_data.push_back(uint8_t(value)); }
+        void u32(uint32_t value) { u16(value >> 16); u16(value & 0xFFFF); }
+    };
+
+    // フォーマット4: 'A'-'C'は差分で、U+3042-U+3044は配列で（U+3043はグリフなし）。
+    {
+        WRITER w;
+        w.u16(0); w.u16(1);             // バージョン、テーブル数
+        w.u16(3); w.u16(1); w.u32(12);  // Windows, Unicode BMP
+        const uint32_t seg_count = 3;
+        w.u16(4); w.u16(14 + 8 * seg_count + 2 + 6); w.u16(0); // フォーマット、長さ、言語
+        w.u16(seg_count * 2); w.u16(4); w.u16(1); w.u16(2);
+        w.u16(0x43); w.u16(0x3044); w.u16(0xFFFF);  // 終わり
+        w.u16(0);                                   // 予約
+        w.u16(0x41); w.u16(0x3042); w.u16(0xFFFF);  // 始まり
+        w.u16(uint16_t(3 - 0x41)); w.u16(0); w.u16(1); // 差分
+        w.u16(0); w.u16(4); w.u16(0);               // 配列へのオフセット
+        w.u16(10); w.u16(0); w.u16(12);             // グリフ番号の配列
+        PDF_CHAR_COVERAGE coverage;
+        assert(pdf_parse_cmap(w.m_data.data(), w.m_data.size(), coverage));
+        assert(!coverage.has(0x40) && coverage.has(0x41) && coverage.has(0x43) && !coverage.has(0x44));
+        assert(coverage.has(0x3042) && !coverage.has(0x3043) && coverage.has(0x3044));
+        assert(!coverage.has(0xFFFF) && !coverage.has(0x1F600) && !coverage.has(0x20000));
+    }
+
+    // フォーマット12: 基本多言語面の外も、収録されている文字だけが入る。
+    {
+        WRITER w;
+        w.u16(0); w.u16(2);
+        w.u16(1); w.u16(0); w.u32(20);  // Macintosh（読まない）
+        w.u16(3); w.u16(10); w.u32(20); // Windows, Unicode full
+        const uint32_t num_groups = 3;
+        w.u16(12); w.u16(0); w.u32(16 + 12 * num_groups); w.u32(0); w.u32(num_groups);
+        w.u32(0x20); w.u32(0x7E); w.u32(0);         // U+0020は.notdef
+        w.u32(0x1F600); w.u32(0x1F64F); w.u32(100);
+        w.u32(0x20000); w.u32(0x2A6DF); w.u32(200);
+        PDF_CHAR_COVERAGE coverage;
+        assert(pdf_parse_cmap(w.m_data.data(), w.m_data.size(), coverage));
+        assert(!coverage.has(0x20) && coverage.has(0x21) && coverage.has(0x7E) && !coverage.has(0x7F));
+        assert(coverage.has(0x1F600) && coverage.has(0x1F64F) && !coverage.has(0x1F650));
+        assert(coverage.has(0x20000) && coverage.has(0x2A6DF) && !coverage.has(0x2A6E0));
+        assert(!coverage.has(0x10000) && !coverage.has(0x10FFFF));
+    }
+
+    // 異体字セレクタ（IVS）付きの名前。セレクタはフォーマット14にしかないが、欠けた文字とは見なさない。
+    {
+        WRITER w;
+        w.u16(0); w.u16(1);
+        w.u16(3); w.u16(1); w.u32(12);
+        const uint32_t seg_count = 3;
+        w.u16(4); w.u16(14 + 8 * seg_count + 2); w.u16(0);
+        w.u16(seg_count * 2); w.u16(4); w.u16(1); w.u16(2);
+        w.u16(0x57CE); w.u16(0x845B); w.u16(0xFFFF);    // 終わり（城、葛）
+        w.u16(0);
+        w.u16(0x57CE); w.u16(0x845B); w.u16(0xFFFF);    // 始まり
+        w.u16(uint16_t(6 - 0x57CE)); w.u16(uint16_t(5 - 0x845B)); w.u16(1);
+        w.u16(0); w.u16(0); w.u16(0);
+        PDF_CHAR_COVERAGE coverage;
+        assert(pdf_parse_cmap(w.m_data.data(), w.m_data.size(), coverage));
+        std::vector<uint32_t> missing;
+        assert(!coverage.has(0xE0100) && !coverage.has(0xFE00));
+        assert(!pdf_find_missing_chars(coverage, u8"葛\U000E0100城", missing) && missing.empty());
+        assert(!pdf_find_missing_chars(coverage, u8"葛\uFE00\u200D城\u200C\u180B\U000E0041\uFEFF", missing));
+        assert(pdf_find_missing_chars(coverage, u8"葛\U000E0100飾", missing) && missing.size() == 1 && missing[0] == 0x98FE);
+    }
+
+    // 壊れたテーブル。
+    {
+        static const uint8_t s_broken[] = { 0, 0, 0, 1, 0, 3, 0, 10, 0, 0, 0, 12, 0, 12, 0, 0, 0xFF, 0xFF, 0xFF, 0xFF };
+        PDF_CHAR_COVERAGE coverage;
+        assert(!pdf_parse_cmap(s_broken, sizeof(s_broken), coverage));
+        assert(!pdf_parse_cmap(s_broken, 3, coverage));
+    }
+#endif
+}
+
+// フォントフェイスの文字マップを読み込む。読めないフォントならfalseを返す。
+bool pdf_get_char_coverage(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, PDF_CHAR_COVERAGE& coverage)
+{
+    cairo_scaled_font_t *scaled_font = pdf_get_scaled_font(ctx, face, 1);
+    if (cairo_scaled_font_status(scaled_font) != CAIRO_STATUS_SUCCESS)
+        return false;
+
+#ifdef CAIRO_HAS_WIN32_FONT
+    if (cairo_scaled_font_get_type(scaled_font) == CAIRO_FONT_TYPE_WIN32)
+    {
+        HDC hDC = CreateCompatibleDC(NULL);
+        if (!hDC)
+            return false;
+
+        bool ret = false;
+        if (cairo_win32_scaled_font_select_font(scaled_font, hDC) == CAIRO_STATUS_SUCCESS)
+        {
+            // 'cmap'テーブルを読めば、基本多言語面の外の文字も正しく分かる。
+            const DWORD cmap_tag = 'c' | ('m' << 8) | ('a' << 16) | ('p' << 24);
+            DWORD cbSize = GetFontData(hDC, cmap_tag, 0, nullptr, 0);
+            if (cbSize && cbSize != GDI_ERROR)
+            {
+                std::vector<uint8_t> cmap(cbSize);
+                if (GetFontData(hDC, cmap_tag, 0, cmap.data(), cbSize) == cbSize)
+                    ret = pdf_parse_cmap(cmap.data(), cmap.size(), coverage);
+            }
+
+            // 読めなければ、GDIが報告する範囲を使う。GDIは基本多言語面しか報告しないので、
+            // それ以外の文字は収録されていないとみなす。
+            cbSize = ret ? 0 : GetFontUnicodeRanges(hDC, nullptr);
+            if (cbSize)
+            {
+                std::vector<BYTE> buf(cbSize);
+                auto pGlyphSet = reinterpret_cast<GLYPHSET *>(buf.data());
+                if (GetFontUnicodeRanges(hDC, pGlyphSet))
+                {
+                    for (DWORD iRange = 0; iRange < pGlyphSet->cRanges; ++iRange)
+                    {
+                        auto& range = pGlyphSet->ranges[iRange];
+                        if (range.cGlyphs)
+                            coverage.add_range(range.wcLow, range.wcLow + range.cGlyphs - 1);
+                    }
+                    ret = true;
+                }
+            }
+            cairo_win32_scaled_font_done_font(scaled_font);
+        }
+        DeleteDC(hDC);
+        return ret;
+    }
+#endif
+
+#ifdef CAIRO_HAS_FT_FONT
+    if (cairo_scaled_font_get_type(scaled_font) == CAIRO_FONT_TYPE_FT)
+    {
+        FT_Face ft_face = cairo_ft_scaled_font_lock_face(scaled_font);
+        if (!ft_face)
+            return false;
+
+        FT_UInt glyph_index;
+        FT_ULong u32 = FT_Get_First_Char(ft_face, &glyph_index);
+        while (glyph_index)
+        {
+            coverage.add(uint32_t(u32));
+            u32 = FT_Get_Next_Char(ft_face, u32, &glyph_index);
+        }
+
+        cairo_ft_scaled_font_unlock_face(scaled_font);
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+// フォントの能力のプロファイル。選択したフォントフェイスごとに一度だけ求める。
+struct PDF_FONT_PROFILE
+{
+    cairo_font_face_t *m_face;              // フォントフェイス。参照は文脈のm_font_facesが保持する。
+    bool m_japanese;                        // 日本語に対応しているか？
+    bool m_chinese;                         // 中国語に対応しているか？
+    bool m_korean;                          // 韓国語に対応しているか？
+    bool m_fixed_pitch;                     // 等幅フォントか？
+    cairo_font_extents_t m_font_extents;    // フォントサイズ1.0でのフォントのエクステント。
+    bool m_has_coverage;                    // 文字マップを読み込めたか？
+    PDF_CHAR_COVERAGE m_coverage;           // 収録されている文字の集合。
+
+    // 中国語・日本語・韓国語のいずれかに対応しているか？
+    bool is_cjk() const
+    {
+        return m_japanese || m_chinese || m_korean;
+    }
+
+    // フォントサイズでのフォントのエクステントを取得する。
+    void get_font_extents(double font_size, cairo_font_extents_t *font_extents) const
+    {
+        font_extents->ascent = m_font_extents.ascent * font_size;
+        font_extents->descent = m_font_extents.descent * font_size;
+        font_extents->height = m_font_extents.height * font_size;
+        font_extents->max_x_advance = m_font_extents.max_x_advance * font_size;
+        font_extents->max_y_advance = m_font_extents.max_y_advance * font_size;
+    }
+};
+
+// フォントフェイスは等幅フォントか？
+bool pdf_is_fixed_pitch_font(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, const PDF_FONT_PROFILE& profile)
+{
+    cairo_text_extents_t extents;
+    pdf_char_extents(ctx, face, 30, "w", &extents);
+
+    double x0 = extents.x_advance * 4, x1;
+    if (profile.m_japanese)
+    {
+        pdf_char_extents(ctx, face, 30, u8"目", &extents);
+        x1 = extents.x_advance * 2;
+    }
+    else if (profile.m_chinese)
+    {
+        pdf_char_extents(ctx, face, 30, u8"沉", &extents);
+        x1 = extents.x_advance * 2;
+    }
+    else if (profile.m_korean)
+    {
+        pdf_char_extents(ctx, face, 30, u8"작", &extents);
+        x1 = extents.x_advance * 2;
+    }
+    else
+    {
+        pdf_char_extents(ctx, face, 30, "i", &extents);
+        x1 = extents.x_advance * 4;
+    }
+
+    return is_nearly_equal(x0, x1);
+}
+
+// フォントフェイスのプロファイルを求める。一度求めたら文脈に覚えておき、次のジョブでも使う。
+const PDF_FONT_PROFILE& pdf_get_font_profile(PLACARD_CONTEXT& ctx, cairo_font_face_t *face)
+{
+    auto& entry = ctx.m_font_profiles[face];
+    if (entry)
+        return *entry;
+
+    auto profile_ptr = std::make_shared<PDF_FONT_PROFILE>();
+    auto& profile = *profile_ptr;
+    profile.m_face = face;
+    profile.m_japanese = pdf_is_font_japanese(ctx, face);
+    profile.m_chinese = pdf_is_font_chinese(ctx, face);
+    profile.m_korean = pdf_is_font_korean(ctx, face);
+    profile.m_fixed_pitch = pdf_is_fixed_pitch_font(ctx, face, profile);
+    profile.m_font_extents = pdf_get_metrics_cache(ctx, face).m_font_extents;
+    profile.m_coverage = PDF_CHAR_COVERAGE();
+    profile.m_has_coverage = pdf_get_char_coverage(ctx, face, profile.m_coverage);
+    entry = profile_ptr;
+    return profile;
+}
+
+// 名前のフォントフェイスを解決する。解決したフォントフェイスは文脈に覚えておき、次のジョブでも使う。
+cairo_font_face_t *pdf_select_font(PLACARD_CONTEXT& ctx, const char *name)
+{
+    auto it = ctx.m_font_faces.find(name);
+    if (it == ctx.m_font_faces.end())
+    {
+        cairo_font_face_t *face = cairo_toy_font_face_create(name, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+        it = ctx.m_font_faces.emplace(name, face).first;
+    }
+    return it->second;
+}
+
+// 解決済みのフォントフェイスとプロファイルを破棄する。
+void pdf_clear_font_faces(PLACARD_CONTEXT& ctx)
+{
+    ctx.m_font_profiles.clear();
+    for (auto& pair : ctx.m_font_faces)
+        cairo_font_face_destroy(pair.second);
+    ctx.m_font_faces.clear();
+}
+
+// テキストにフォントに収録されていない文字があるか？あれば表示する。
+bool pdf_has_missing_chars(const PDF_FONT_PROFILE& profile, std::string_view str)
+{
+    if (!profile.m_has_coverage)
+        return false;
+
+    std::vector<uint32_t> missing;
+    if (!pdf_find_missing_chars(profile.m_coverage, str, missing))
+        return false;
+
+    fprintf(stderr, "missing characters:");
+    for (auto u32 : missing)
+        fprintf(stderr, " U+%04X", u32);
+    fprintf(stderr, "\n");
+    return true;
+}
+
+// PDFに出力したときのテキストの幅の合計を返す。
+double pdf_get_total_text_width(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, double font_size, const U8_CHARS& chars)
+{
+    double text_width = 0;
+    for (size_t ich = 0; ich < chars.size(); ++ich)
+    {
+        cairo_text_extents_t extents;
+        pdf_char_extents(ctx, face, font_size, chars[ich], &extents);
+        text_width += extents.x_advance;
+    }
+
+    return text_width;
+}
+
+// 小さいカナの縮小率。
+#define SMALL_KANA_RATIO 0.55
+
+void pdf_get_h_text_width_and_height(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, double font_size, const U8_CHARS& chars, double& text_width, double& text_height)
+{
+    text_width = text_height = 0;
+    cairo_text_extents_t extents;
+    cairo_font_extents_t font_extents;
+    pdf_font_extents(ctx, face, font_size, &font_extents);
+    for (auto& text_char : chars)
+    {
+        pdf_char_extents(ctx, face, font_size, text_char, &extents);
+        if (text_height < extents.height)
+            text_height = extents.height;
+        if (text_height < font_extents.height)
+            text_height = font_extents.height;
+        text_width += extents.x_advance;
+    }
+}
+
+// 縦書きでの文字の幅と送り幅を文字のエクステントと分類から求める。
+void pdf_get_v_char_width_and_height(const cairo_text_extents_t& extents, uint8_t char_class, double& char_width, double& char_height)
+{
+    if (char_class & U8CC_SPACE) // スペースか？
+    {
+        char_width = extents.width;
+        char_height = extents.x_advance;
+    }
+    else if (char_class & U8CC_SMALL_KANA) // 小さいカナか？
+    {
+        char_width = extents.width * SMALL_KANA_RATIO;
+        char_height = extents.height * SMALL_KANA_RATIO;
+    }
+    else if (char_class & U8CC_HYPHEN_DASH) // 横棒か？
+    {
+        char_width = extents.height;
+        char_height = extents.width;
+    }
+    else if (char_class & U8CC_PAREN) // カッコか？
+    {
+        char_width = extents.height;
+        char_height = extents.width;
+    }
+    else
+    {
+        char_width = extents.width;
+        char_height = extents.height;
+    }
+}
+
+void pdf_get_v_text_width_and_height(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, double font_size, const U8_CHARS& chars, const std::vector<uint8_t>& classes, double& text_width, double& text_height)
+{
+    text_width = text_height = 0;
+    cairo_text_extents_t extents;
+    for (size_t ich = 0; ich < chars.size(); ++ich)
+    {
+        pdf_char_extents(ctx, face, font_size, chars[ich], &extents);
+        double char_width, char_height;
+        pdf_get_v_char_width_and_height(extents, classes[ich], char_width, char_height);
+        if (text_width < char_width)
+            text_width = char_width;
+        text_height += char_height;
+    }
+}
+
+void pdf_get_v_text_width_and_height_fixed(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, double font_size, const U8_CHARS& chars, double& text_width, double& text_height)
+{
+    text_width = text_height = 0;
+    cairo_text_extents_t extents;
+    cairo_font_extents_t font_extents;
+    pdf_font_extents(ctx, face, font_size, &font_extents);
+    for (auto& text_char : chars)
+    {
+        pdf_char_extents(ctx, face, font_size, text_char, &extents);
+        if (text_width < extents.width)
+            text_width = extents.width;
+        text_height += extents.x_advance;
+    }
+}
+
+// 領域に収まるフォントサイズと拡大率を求める。
+// text_widthとtext_heightはフォントサイズ1.0でのテキストの幅と高さ。
+// テキストの大きさはフォントサイズと拡大率に比例するので、反復せずに直接求まる。
+bool pdf_solve_text_fit(double text_width, double text_height, double width, double height, double fill_ratio, double threshold, double& font_size, double& scale_x, double& scale_y)
+{
+    scale_x = scale_y = 1;
+    font_size = 10;
+
+    if (text_width <= 0 || text_height <= 0)
+        return false;
+
+    // それぞれの方向で領域を埋めるフォントサイズ。
+    double size_x = width * fill_ratio / text_width;
+    double size_y = height * fill_ratio / text_height;
+
+    // 先に埋まる方向でフォントサイズが決まる。
+    font_size = std::min(size_x, size_y);
+    if (!(font_size < 10000))
+        return false;
+
+    // もう一方の方向は拡大率で埋める。
+    if (threshold >= 1.1)
+    {
+        scale_x = size_x / font_size;
+        scale_y = size_y / font_size;
+    }
+
+    return true;
+}
+
+// 以前の反復によるフォントサイズと拡大率の調整（テストとベンチマーク用）。反復回数を返す。
+// 反復のたびに行全体を測り直していたので、測る回数は反復回数+1になる。
+int pdf_fit_text_by_loop(double text_width, double text_height, double width, double height, double fill_ratio, double growth, double threshold, double& font_size, double& scale_x, double& scale_y)
+{
+    scale_x = scale_y = 1;
+    font_size = 10;
+
+    int iterations = 0;
+    for (;; ++iterations)
+    {
+        double w = text_width * font_size, h = text_height * font_size;
+        if (font_size >= 10000)
+            return -1;
+
+        if (w * scale_x < width * fill_ratio && h * scale_y < height * fill_ratio)
+            font_size *= growth;
+        else if (threshold < 1.1)
+            break;
+        else if (w * scale_x < width * fill_ratio)
+            scale_x *= growth;
+        else if (h * scale_y < height * fill_ratio)
+            scale_y *= growth;
+        else
+            break;
+    }
+    return iterations;
+}
+
+void pdf_solve_text_fit_unittest(void)
+{
+#ifndef NDEBUG
+    static const struct
+    {
+        double text_width, text_height, width, height, fill_ratio, growth, threshold;
+    } s_cases[] =
+    {
+        { 5.0, 1.2, 800, 200, 0.9, 1.1, 1.5 },   // 横長の行
+        { 20.0, 1.1, 800, 120, 0.9, 1.1, 1.5 },  // 長い行
+        { 1.0, 1.2, 800, 500, 0.9, 1.1, 1.0 },   // 拡大しない
+        { 0.9, 6.0, 150, 540, 0.95, 1.05, 1.5 }, // 縦書きの列
+        { 1.0, 30.0, 60, 540, 0.95, 1.05, 1.5 }, // 長い列
+    };
+    for (auto& c : s_cases)
+    {
+        double font_size0, scale_x0, scale_y0;
+        int iterations = pdf_fit_text_by_loop(c.text_width, c.text_height, c.width, c.height,
+                                              c.fill_ratio, c.growth, c.threshold,
+                                              font_size0, scale_x0, scale_y0);
+        double font_size1, scale_x1, scale_y1;
+        bool ok = pdf_solve_text_fit(c.text_width, c.text_height, c.width, c.height,
+                                     c.fill_ratio, c.threshold, font_size1, scale_x1, scale_y1);
+        assert(ok && iterations > 1);
+
+        // 反復では1ステップ分だけ大きくなりうる。
+        double w0 = c.text_width * font_size0 * scale_x0, w1 = c.text_width * font_size1 * scale_x1;
+        double h0 = c.text_height * font_size0 * scale_y0, h1 = c.text_height * font_size1 * scale_y1;
+        assert(font_size1 <= font_size0 * 1.000001 && font_size0 < font_size1 * c.growth * 1.000001);
+        assert(w1 <= w0 * 1.000001 && w0 < w1 * c.growth * c.growth);
+        assert(h1 <= h0 * 1.000001 && h0 < h1 * c.growth * c.growth);
+    }
+#endif
+}
+
+// Do scaling for drawing horizontal text
+bool pdf_scaling_h_text(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, const U8_CHARS& chars, double width, double height, double& font_size, double& scale_x, double& scale_y, double threshold)
+{
+    scale_x = scale_y = 1;
+    font_size = 10;
+
+    if (chars.empty())
+        return false;
+
+    // Measure at font size 1.0
+    double text_width, text_height;
+    pdf_get_h_text_width_and_height(ctx, face, 1, chars, text_width, text_height);
+
+    // Solve the font size and scale
+    if (!pdf_solve_text_fit(text_width, text_height, width, height, 0.9, threshold, font_size, scale_x, scale_y))
+        return false;
+
+    size_t len = chars.size();
+
+    text_width *= font_size;
+    text_height *= font_size;
+
+    if ((text_width * scale_x / len) / (text_height * scale_y) > threshold)
+        scale_x = threshold * (text_height * scale_y) * len / text_width;
+    if ((text_height * scale_y) / (text_width * scale_x / len) > threshold)
+        scale_y = threshold * (text_width * scale_x / len) / text_height;
+
+    return true;
+}
+
+// Do scaling for drawing vertical text
+bool pdf_scaling_v_text(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, const U8_CHARS& chars, const std::vector<uint8_t>& classes,  double width, double height, double& font_size, double& scale_x, double& scale_y, double threshold)
+{
+    scale_x = scale_y = 1;
+    font_size = 10;
+
+    if (chars.empty())
+        return false;
+
+    // Measure at font size 1.0
+    double text_width, text_height;
+    pdf_get_v_text_width_and_height(ctx, face, 1, chars, classes, text_width, text_height);
+
+    // Solve the font size and scale
+    if (!pdf_solve_text_fit(text_width, text_height, width, height, 0.95, threshold, font_size, scale_x, scale_y))
+        return false;
+
+    size_t len = chars.size();
+
+    text_width *= font_size;
+    text_height *= font_size;
+
+    if ((text_width * scale_x) / (text_height * scale_y / len) > threshold)
+        scale_x = threshold * (text_height * scale_y / len) / text_width;
+    else if ((text_height * scale_y / len) / (text_width * scale_x) > threshold)
+        scale_y = threshold * (text_width * scale_x) * len / text_height;
+
+    return true;
+}
+
+// Do scaling for drawing vertical text (fixed-pitch)
+bool pdf_scaling_v_text_fixed(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, const U8_CHARS& chars,  double width, double height, double& font_size, double& scale_x, double& scale_y, double threshold)
+{
+    scale_x = scale_y = 1;
+    font_size = 10;
+
+    if (chars.empty())
+        return false;
+
+    // Measure at font size 1.0
+    double text_width, text_height;
+    pdf_get_v_text_width_and_height_fixed(ctx, face, 1, chars, text_width, text_height);
+
+    // Solve the font size and scale
+    if (!pdf_solve_text_fit(text_width, text_height, width, height, 0.95, threshold, font_size, scale_x, scale_y))
+        return false;
+
+    size_t len = chars.size();
+
+    text_width *= font_size;
+    text_height *= font_size;
+
+    if ((text_width * scale_x) / (text_height * scale_y / len) > threshold)
+        scale_x = threshold * (text_height * scale_y / len) / text_width;
+    else if ((text_height * scale_y / len) / (text_width * scale_x) > threshold)
+        scale_y = threshold * (text_width * scale_x) * len / text_height;
+
+    return true;
+}
+
+// フォントフェイスとフォントサイズで行のテキストをグリフに変換する。
+bool pdf_text_to_glyphs(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, double font_size, std::string_view text, const U8_CHARS& chars, PDF_ROW_GLYPHS& row)
+{
+    row.m_glyphs.clear();
+    row.m_char_first.clear();
+
+    cairo_glyph_t *glyphs = nullptr;
+    int num_glyphs = 0;
+    cairo_text_cluster_t *clusters = nullptr;
+    int num_clusters = 0;
+    cairo_text_cluster_flags_t cluster_flags;
+    auto scaled_font = pdf_get_scaled_font(ctx, face, font_size);
+    cairo_status_t status = cairo_scaled_font_text_to_glyphs(scaled_font, 0, 0, text.data(), int(text.size()),
+                                                             &glyphs, &num_glyphs,
+                                                             &clusters, &num_clusters, &cluster_flags);
+    if (status != CAIRO_STATUS_SUCCESS)
+        return false;
+
+    row.m_glyphs.assign(glyphs, glyphs + num_glyphs);
+
+    // クラスタを文字に対応付ける。charsはtextを区切ったもの。
+    // 複数の文字からなるクラスタのグリフは最初の文字に、複数のクラスタからなる文字には全部のグリフを割り当てる。
+    row.m_char_first.resize(chars.size() + 1);
+    size_t ich = 0, iGlyph = 0, ib = 0;
+    for (int iCluster = 0; iCluster < num_clusters; ++iCluster)
+    {
+        while (ich < chars.size() && size_t(chars[ich].m_str.data() - text.data()) <= ib)
+            row.m_char_first[ich++] = iGlyph;
+        iGlyph += clusters[iCluster].num_glyphs;
+        ib += clusters[iCluster].num_bytes;
+    }
+    while (ich <= chars.size())
+        row.m_char_first[ich++] = iGlyph;
+
+    cairo_glyph_free(glyphs);
+    cairo_text_cluster_free(clusters);
+
+    return ib == text.size();
+}
+
+// 文字のグリフを並びに追加する。matrixは文字を原点に描画するときの変換行列。
+// 平行移動を除いた変換が直前の並びと同じなら、その並びにまとめる。
+void pdf_add_char_glyphs(std::vector<PDF_GLYPH_RUN>& runs, const PDF_ROW_GLYPHS& row, size_t ich, const cairo_matrix_t& matrix)
+{
+    size_t first = row.m_char_first[ich], last = row.m_char_first[ich + 1];
+    if (first == last)
+        return;
+
+    cairo_matrix_t linear = matrix;
+    linear.x0 = linear.y0 = 0;
+
+    // 文字の原点を並びの座標系に変換する。
+    cairo_matrix_t inverse = linear;
+    if (cairo_matrix_invert(&inverse) != CAIRO_STATUS_SUCCESS)
+        return;
+    double x0 = matrix.x0, y0 = matrix.y0;
+    cairo_matrix_transform_point(&inverse, &x0, &y0);
+
+    if (runs.empty() ||
+        runs.back().m_matrix.xx != linear.xx || runs.back().m_matrix.yx != linear.yx ||
+        runs.back().m_matrix.xy != linear.xy || runs.back().m_matrix.yy != linear.yy)
+    {
+        // 並びのグリフは行の残りのグリフより多くならないので、一度だけ確保する。
+        runs.push_back({ linear, {} });
+        runs.back().m_glyphs.reserve(row.m_glyphs.size() - first);
+    }
+
+    auto& run = runs.back();
+    double base_x = row.m_glyphs[first].x, base_y = row.m_glyphs[first].y;
+    for (size_t iGlyph = first; iGlyph < last; ++iGlyph)
+    {
+        cairo_glyph_t glyph = row.m_glyphs[iGlyph];
+        glyph.x += x0 - base_x;
+        glyph.y += y0 - base_y;
+        run.m_glyphs.push_back(glyph);
+    }
+}
+
+// ページのレイアウトの描画命令。背景の塗りつぶしか、グリフの並び。
+struct PDF_LAYOUT_ITEM
+{
+    bool m_fill;                        // 背景の塗りつぶしか？（でなければグリフの並び）
+    uint32_t m_color;                   // 色（0xRRGGBB）。
+    double m_x, m_y, m_width, m_height; // 塗りつぶす長方形。
+    cairo_font_face_t *m_face;          // グリフのフォントフェイス。参照は描画の文脈が保持する。
+    cairo_matrix_t m_font_matrix;       // グリフのフォント行列。
+    PDF_GLYPH_RUN m_run;                // グリフの並び。
+};
+
+// 1ページのレイアウト（行の分割、大きさの計算、グリフの配置の結果）。
+// 作業者のスレッドで求めて、PDFサーフェスを持つスレッドがpdf_emit_page_layoutで描画する。
+struct PDF_PAGE_LAYOUT
+{
+    std::vector<PDF_LAYOUT_ITEM> m_items;
+};
+
+// 背景の塗りつぶしをページのレイアウトに追加する。
+void pdf_layout_fill(PLACARD_CONTEXT& ctx, uint32_t color, double x, double y, double width, double height)
+{
+    PDF_LAYOUT_ITEM item = { };
+    item.m_fill = true;
+    item.m_color = color;
+    item.m_x = x;
+    item.m_y = y;
+    item.m_width = width;
+    item.m_height = height;
+    ctx.m_layout->m_items.push_back(std::move(item));
+}
+
+// フォントフェイスとフォントサイズで描画するグリフの並びをページのレイアウトに追加する。
+// フォント行列は描画するときにだけ設定する。
+void pdf_layout_glyph_runs(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, double font_size, std::vector<PDF_GLYPH_RUN>& runs)
+{
+    cairo_matrix_t font_matrix;
+    cairo_matrix_init_scale(&font_matrix, font_size, font_size);
+    for (auto& run : runs)
+    {
+        PDF_LAYOUT_ITEM item = { };
+        item.m_fill = false;
+        item.m_color = ctx.m_job->m_text_color;
+        item.m_face = face;
+        item.m_font_matrix = font_matrix;
+        item.m_run = std::move(run);
+        ctx.m_layout->m_items.push_back(std::move(item));
+    }
+    runs.clear();
+}
+
+// ページのレイアウトを描画する。グリフの並びごとに一回だけcairo_show_glyphsを呼ぶ。
+void pdf_emit_page_layout(cairo_t *cr, const PDF_PAGE_LAYOUT& layout)
+{
+    for (auto& item : layout.m_items)
+    {
+        cairo_save(cr); // 描画状態を保存
+        auto r = get_r_value(item.m_color);
+        auto g = get_g_value(item.m_color);
+        auto b = get_b_value(item.m_color);
+        cairo_set_source_rgb(cr, r / 255.0, g / 255.0, b / 255.0);
+        if (item.m_fill)
+        {
+            cairo_rectangle(cr, item.m_x, item.m_y, item.m_width, item.m_height);
+            cairo_fill(cr);
+        }
+        else
+        {
+            // 変換行列は絶対的なものなので、単位行列から描画する。
+            cairo_set_font_face(cr, item.m_face);
+            cairo_set_font_matrix(cr, &item.m_font_matrix);
+            cairo_identity_matrix(cr);
+            cairo_transform(cr, &item.m_run.m_matrix);
+            cairo_show_glyphs(cr, item.m_run.m_glyphs.data(), int(item.m_run.m_glyphs.size()));
+        }
+        cairo_restore(cr); // 描画状態を元に戻す
+    }
+}
+
+// 横書き用の文字のグリフを並びに追加する。
+// extentsとfont_extentsは描画するフォントサイズでのエクステント。
+void pdf_draw_h_char(PLACARD_CONTEXT& ctx, const U8_SEGMENT& text_char, double x, double y, double scale_x, double scale_y, cairo_text_extents_t& extents, cairo_font_extents_t& font_extents, const PDF_ROW_GLYPHS& row, size_t ich, std::vector<PDF_GLYPH_RUN>& runs)
+{
+    // 補正分。
+    y += ctx.m_y_adjust;
+
+    // テキストのグリフを追加
+    {
+        // テキストの基準位置を調整
+        double x_pos = x;
+        double y_pos = y + font_extents.ascent * scale_y;
+        cairo_matrix_t matrix;
+        cairo_matrix_init_translate(&matrix, x_pos, y_pos);  // 指定位置に移動
+
+        // スケーリングを適用
+        cairo_matrix_scale(&matrix, scale_x, scale_y);
+
+        // 座標(0, 0)から描画
+        pdf_add_char_glyphs(runs, row, ich, matrix);
+    }
+}
+
+// 縦書き用の文字のグリフを並びに追加する。
+// extentsとfont_extentsは描画するフォントサイズでのエクステント。extentsは書き換える。
+void pdf_draw_v_char(PLACARD_CONTEXT& ctx, const U8_SEGMENT& text_char, uint8_t char_class, double x, double y, double scale_x, double scale_y, cairo_text_extents_t& extents, cairo_font_extents_t& font_extents, const PDF_ROW_GLYPHS& row, size_t ich, std::vector<PDF_GLYPH_RUN>& runs)
+{
+    // 補正分。
+    y += ctx.m_y_adjust;
+
+    // 句読点なら右にずらす。
+    if (char_class & U8CC_COMMA_PERIOD)
+        x += extents.width * scale_x * 0.75;
+
+    // 小さいカナなら右にずらす。
+    if (char_class & U8CC_SMALL_KANA)
+    {
+        scale_x *= SMALL_KANA_RATIO;
+        scale_y *= SMALL_KANA_RATIO;
+        x += extents.width * scale_x * 0.5;
+    }
+
+    // 横棒なら縦と横を入れ替える。
+    if (char_class & U8CC_HYPHEN_DASH) // 横棒か？
+    {
+        std::swap(extents.width, extents.height);
+        std::swap(extents.x_bearing, extents.y_bearing);
+    }
+
+    // カッコなら縦と横を入れ替える。
+    if (char_class & U8CC_PAREN) // カッコか？
+    {
+        std::swap(extents.width, extents.height);
+        std::swap(extents.x_bearing, extents.y_bearing);
+    }
+
+    double scaled_width = extents.width * scale_x;
+
+    // テキストのグリフを追加
+    cairo_matrix_t matrix;
+    {
+        if (char_class & U8CC_HYPHEN_DASH) // 横棒か？
+        {
+            // テキストの基準位置を調整
+            double x_pos = x - extents.x_bearing * scale_x - scaled_width / 2;
+            double y_pos = y - extents.y_bearing * scale_y;
+            cairo_matrix_init_translate(&matrix, x_pos, y_pos);  // 指定位置に移動
+
+            // スケーリングを適用
+            cairo_matrix_scale(&matrix, scale_x, -scale_y);
+
+            // 回転。
+            cairo_matrix_rotate(&matrix, -M_PI / 2);
+        }
+        else if (char_class & U8CC_PAREN_TYPE_1) // カッコ（タイプ1）か？
+        {
+            // テキストの基準位置を調整
+            double x_pos = x - scaled_width * 0.55 + extents.height * scale_x / 2;
+            double y_pos = y - extents.y_bearing * scale_y;
+            cairo_matrix_init_translate(&matrix, x_pos, y_pos);  // 指定位置に移動
+
+            // スケーリングを適用
+            cairo_matrix_scale(&matrix, scale_x, scale_y);
+
+            // 回転。
+            cairo_matrix_rotate(&matrix, M_PI / 2);
+        }
+        else if (char_class & U8CC_PAREN_TYPE_2) // カッコ（タイプ2）か？
+        {
+            // テキストの基準位置を調整
+            double x_pos = x + scaled_width * 0.6 + extents.x_bearing * scale_x;
+            double y_pos = y - extents.y_bearing * scale_y;
+            cairo_matrix_init_translate(&matrix, x_pos, y_pos);  // 指定位置に移動
+
+            // スケーリングを適用
+            cairo_matrix_scale(&matrix, scale_x, scale_y);
+
+            // 回転。
+            cairo_matrix_rotate(&matrix, M_PI / 2);
+        }
+        else if (char_class & U8CC_PAREN_TYPE_3) // カッコ（タイプ3）か？
+        {
+            // テキストの基準位置を調整
+            double x_pos = x - scaled_width * 0.55 + extents.y_bearing * scale_x;
+            double y_pos = y - extents.y_bearing * scale_y;
+            cairo_matrix_init_translate(&matrix, x_pos, y_pos);  // 指定位置に移動
+
+            // スケーリングを適用
+            cairo_matrix_scale(&matrix, scale_x, scale_y);
+
+            // 回転。
+            cairo_matrix_rotate(&matrix, M_PI / 2);
+        }
+        else
+        {
+            // テキストの基準位置を調整
+            double x_pos = x - extents.x_advance * scale_x / 2;
+            double y_pos = y - extents.y_bearing * scale_y;
+            cairo_matrix_init_translate(&matrix, x_pos, y_pos);  // 指定位置に移動
+
+            // スケーリングを適用
+            cairo_matrix_scale(&matrix, scale_x, scale_y);
+        }
+    }
+
+    // 座標(0, 0)から描画
+    pdf_add_char_glyphs(runs, row, ich, matrix);
+}
+
+#ifdef PDFPLACA_USE_HARFBUZZ
+
+// 横書きで使う機能（カーニング）。
+static const hb_feature_t g_hb_h_features[] =
+{
+    { HB_TAG('k', 'e', 'r', 'n'), 1, HB_FEATURE_GLOBAL_START, HB_FEATURE_GLOBAL_END },
+};
+
+// 縦書きで使う機能（縦書き用の字形）。
+static const hb_feature_t g_hb_v_features[] =
+{
+    { HB_TAG('v', 'e', 'r', 't'), 1, HB_FEATURE_GLOBAL_START, HB_FEATURE_GLOBAL_END },
+    { HB_TAG('v', 'r', 't', '2'), 1, HB_FEATURE_GLOBAL_START, HB_FEATURE_GLOBAL_END },
+};
+
+// 行のテキストをHarfBuzzで整形する（キャッシュ付き）。整形できなければnullptrを返す。
+// 戻り値は次に整形するまで有効。
+const PDF_SHAPED_TEXT *pdf_shape_text(PLACARD_CONTEXT& ctx, cairo_font_face_t *face, std::string_view text, bool vertical)
+{
+    PDF_HB_FACE *hb = pdf_get_hb_face(ctx, face);
+    if (!hb || text.size() > INT_MAX)
+        return nullptr;
+
+    auto& cache = hb->m_shaped[vertical];
+    auto found = cache.m_index.find(text);
+    if (found != cache.m_index.end())
+    {
+        cache.m_entries.splice(cache.m_entries.begin(), cache.m_entries, found->second);
+        return &found->second->second;
+    }
+
+    const hb_feature_t *features = vertical ? g_hb_v_features : g_hb_h_features;
+    unsigned int num_features = unsigned(vertical ? _countof(g_hb_v_features) : _countof(g_hb_h_features));
+
+    hb_buffer_t *buffer = hb_buffer_create();
+    hb_buffer_add_utf8(buffer, text.data(), int(text.size()), 0, int(text.size()));
+    hb_buffer_set_direction(buffer, vertical ? HB_DIRECTION_TTB : HB_DIRECTION_LTR);
+    hb_buffer_set_cluster_level(buffer, HB_BUFFER_CLUSTER_LEVEL_MONOTONE_GRAPHEMES);
+    hb_buffer_guess_segment_properties(buffer);
+
+    // 用字と書字方向ごとのシェーププランを使い回す。
+    hb_segment_properties_t props;
+    hb_buffer_get_segment_properties(buffer, &props);
+    uint64_t plan_key = (uint64_t(props.script) << 8) | uint64_t(props.direction);
+    hb_shape_plan_t *&plan = hb->m_plans[plan_key];
+    if (!plan)
+        plan = hb_shape_plan_create_cached(hb->m_face, &props, features, num_features, nullptr);
+
+    if (!hb_shape_plan_execute(plan, hb->m_font, buffer, features, num_features))
+    {
+        hb_buffer_destroy(buffer);
+        return nullptr;
+    }
+
+    // 最も古いものを捨てる。その項目は新しいテキストに使い回す。
+    if (cache.m_entries.size() >= PDF_SHAPED_TEXT_CACHE_SIZE)
+    {
+        cache.m_index.erase(cache.m_entries.back().first);
+        cache.m_entries.splice(cache.m_entries.begin(), cache.m_entries, std::prev(cache.m_entries.end()));
+        cache.m_entries.front().first.assign(text);
+    }
+    else
+    {
+        cache.m_entries.emplace_front(std::string(text), PDF_SHAPED_TEXT());
+    }
+    cache.m_index.emplace(cache.m_entries.front().first, cache.m_entries.begin());
+
+    auto& shaped = cache.m_entries.front().second;
+    unsigned int num_glyphs = 0;
+    const hb_glyph_info_t *infos = hb_buffer_get_glyph_infos(buffer, &num_glyphs);
+    const hb_glyph_position_t *positions = hb_buffer_get_glyph_positions(buffer, nullptr);
+    shaped.m_glyphs.resize(num_glyphs);
+    shaped.m_advance = shaped.m_column_width = 0;
+    for (unsigned int iGlyph = 0; iGlyph < num_glyphs; ++iGlyph)
+    {
+        auto& glyph = shaped.m_glyphs[iGlyph];
+        glyph.m_index = infos[iGlyph].codepoint;
+        glyph.m_cluster = infos[iGlyph].cluster;
+        glyph.m_x_advance = positions[iGlyph].x_advance / hb->m_upem;
+        glyph.m_y_advance = positions[iGlyph].y_advance / hb->m_upem;
+        glyph.m_x_offset = positions[iGlyph].x_offset / hb->m_upem;
+        glyph.m_y_offset = positions[iGlyph].y_offset / hb->m_upem;
+
+        if (vertical)
+        {
+            shaped.m_advance -= glyph.m_y_advance;
+            double h_advance = hb_font_get_glyph_h_advance(hb->m_font, infos[iGlyph].codepoint) / hb->m_upem;
+            if (shaped.m_column_width < h_advance)
+                shaped.m_column_width = h_advance;
+        }
+        else
+        {
+            shaped.m_advance += glyph.m_x_advance;
+        }
+    }
+
+    hb_buffer_destroy(buffer);
+    return &shaped;
+}
+
+// 整形済みのテキストを文字ごとのグリフに分ける。charsはtextを区切ったもの。
+// グリフの位置はフォントサイズfont_sizeでの、文字の始点からの相対位置（yは下向き）。
+// advancesには文字ごとの進行方向の送り幅（フォントサイズ1.0）を返す。
+void pdf_shaped_to_glyphs(const PDF_SHAPED_TEXT& shaped, std::string_view text, const U8_CHARS& chars, bool vertical, double font_size, PDF_ROW_GLYPHS& row, std::vector<double>& advances)
+{
+    size_t num_glyphs = shaped.m_glyphs.size();
+    row.m_glyphs.resize(num_glyphs);
+    row.m_char_first.assign(chars.size() + 1, num_glyphs);
+    advances.assign(chars.size(), 0);
+
+    // クラスタは単調に増えるので、文字と一緒に進める。
+    // 複数の文字からなるクラスタのグリフは最初の文字に割り当てる。
+    size_t ich = 0;
+    double pen_x = 0, pen_y = 0;
+    for (size_t iGlyph = 0; iGlyph < num_glyphs; ++iGlyph)
+    {
+        auto& glyph = shaped.m_glyphs[iGlyph];
+        size_t old_ich = ich;
+        while (ich < chars.size() && size_t(chars[ich].m_str.data() - text.data()) <= glyph.m_cluster)
+            row.m_char_first[ich++] = iGlyph;
+        if (ich != old_ich)
+            pen_x = pen_y = 0;
+
+        auto& out = row.m_glyphs[iGlyph];
+        out.index = glyph.m_index;
+        out.x = (pen_x + glyph.m_x_offset) * font_size;
+        out.y = (pen_y - glyph.m_y_offset) * font_size;
+        pen_x += glyph.m_x_advance;
+        pen_y -= glyph.m_y_advance;
+
+        if (ich)
+            advances[ich - 1] += vertical ? -glyph.m_y_advance : glyph.m_x_advance;
+    }
+}
+
+// 整形済みの文字のグリフを並びに追加する。(x, y)は文字の始点。
+void pdf_add_shaped_char_glyphs(std::vector<PDF_GLYPH_RUN>& runs, const PDF_ROW_GLYPHS& row, size_t ich, double x, double y, double scale_x, double scale_y)
+{
+    size_t first = row.m_char_first[ich];
+    if (first == row.m_char_first[ich + 1])
+        return;
+
+    cairo_matrix_t matrix;
+    cairo_matrix_init_translate(&matrix, x, y);  // 指定位置に移動
+    cairo_matrix_scale(&matrix, scale_x, scale_y);  // スケーリングを適用
+
+    // 最初のグリフが原点に来るので、その位置までずらす。
+    cairo_matrix_translate(&matrix, row.m_glyphs[first].x, row.m_glyphs[first].y);
+    pdf_add_char_glyphs(runs, row, ich, matrix);
+}
+
+// Do scaling for drawing shaped horizontal text
+bool pdf_scaling_h_shaped(const PDF_FONT_PROFILE& profile, const PDF_SHAPED_TEXT& shaped, size_t len, double width, double height, double& font_size, double& scale_x, double& scale_y, double threshold)
+{
+    scale_x = scale_y = 1;
+    font_size = 10;
+
+    if (!len)
+        return false;
+
+    // Measure at font size 1.0
+    double text_width = shaped.m_advance;
+    double text_height = profile.m_font_extents.height;
+
+    // Solve the font size and scale
+    if (!pdf_solve_text_fit(text_width, text_height, width, height, 0.9, threshold, font_size, scale_x, scale_y))
+        return false;
+
+    text_width *= font_size;
+    text_height *= font_size;
+
+    if ((text_width * scale_x / len) / (text_height * scale_y) > threshold)
+        scale_x = threshold * (text_height * scale_y) * len / text_width;
+    if ((text_height * scale_y) / (text_width * scale_x / len) > threshold)
+        scale_y = threshold * (text_width * scale_x / len) / text_height;
+
+    return true;
+}
+
+// Do scaling for drawing shaped vertical text
+bool pdf_scaling_v_shaped(const PDF_SHAPED_TEXT& shaped, size_t len, double width, double height, double& font_size, double& scale_x, double& scale_y, double threshold)
+{
+    scale_x = scale_y = 1;
+    font_size = 10;
+
+    if (!len)
+        return false;
+
+    // Measure at font size 1.0
+    double text_width = shaped.m_column_width;
+    double text_height = shaped.m_advance;
+
+    // Solve the font size and scale
+    if (!pdf_solve_text_fit(text_width, text_height, width, height, 0.95, threshold, font_size, scale_x, scale_y))
+        return false;
+
+    text_width *= font_size;
+    text_height *= font_size;
+
+    if ((text_width * scale_x) / (text_height * scale_y / len) > threshold)
+        scale_x = threshold * (text_height * scale_y / len) / text_width;
+    else if ((text_height * scale_y / len) / (text_width * scale_x) > threshold)
+        scale_y = threshold * (text_width * scale_x) * len / text_height;
+
+    return true;
+}
+
+// Draw horizontal text shaped by HarfBuzz. Returns false if it cannot be shaped.
+bool pdf_draw_h_text_shaped(PLACARD_CONTEXT& ctx, const PDF_FONT_PROFILE& profile, std::string_view text, const U8_CHARS& chars, double x0, double y0, double width, double height, double threshold)
+{
+    const PDF_SHAPED_TEXT *shaped = pdf_shape_text(ctx, profile.m_face, text, false);
+    if (!shaped)
+        return false;
+
+    // Calculate scaling and font size
+    double font_size, scale_x, scale_y;
+    if (!pdf_scaling_h_shaped(profile, *shaped, chars.size(), width, height, font_size, scale_x, scale_y, threshold))
+        return false;
+
+    // Split the glyphs to characters
+    PDF_ROW_GLYPHS& row = ctx.m_row_glyphs;
+    std::vector<double>& advances = ctx.m_row_advances;
+    pdf_shaped_to_glyphs(*shaped, text, chars, false, font_size, row, advances);
+
+    cairo_font_extents_t font_extents;
+    profile.get_font_extents(font_size, &font_extents);
+
+    // Place each character one by one on the baseline
+    std::vector<PDF_GLYPH_RUN>& runs = ctx.m_row_runs;
+    double total_text_width = shaped->m_advance * font_size * scale_x;
+    double x = x0;
+    double y = y0 + (height - font_extents.height * scale_y) / 2 + font_extents.ascent * scale_y + ctx.m_y_adjust;
+    auto each_blank_width = (width - total_text_width) / (chars.size() + 1);
+    for (size_t ich = 0; ich < chars.size(); ++ich)
+    {
+        x += each_blank_width;
+        pdf_add_shaped_char_glyphs(runs, row, ich, x, y, scale_x, scale_y);
+        x += advances[ich] * font_size * scale_x;
+    }
+
+    // Lay out the glyphs at once
+    pdf_layout_glyph_runs(ctx, profile.m_face, font_size, runs);
+
+    return true;
+}
+
+// Draw vertical text shaped by HarfBuzz. Returns false if it cannot be shaped.
+// The vertical forms and origins come from the font, so no per-class adjustment is needed.
+bool pdf_draw_v_text_shaped(PLACARD_CONTEXT& ctx, const PDF_FONT_PROFILE& profile, std::string_view text, const U8_CHARS& chars, double x0, double y0, double width, double height, double threshold)
+{
+    const PDF_SHAPED_TEXT *shaped = pdf_shape_text(ctx, profile.m_face, text, true);
+    if (!shaped)
+        return false;
+
+    // Calculate scaling and font size
+    double font_size, scale_x, scale_y;
+    if (!pdf_scaling_v_shaped(*shaped, chars.size(), width, height, font_size, scale_x, scale_y, threshold))
+        return false;
+
+    // Split the glyphs to characters
+    PDF_ROW_GLYPHS& row = ctx.m_row_glyphs;
+    std::vector<double>& advances = ctx.m_row_advances;
+    pdf_shaped_to_glyphs(*shaped, text, chars, true, font_size, row, advances);
+
+    double text_height = shaped->m_advance * font_size * scale_y;
+    auto each_blank_height = (height - text_height) / (chars.size() + 1);
+    while (each_blank_height <= font_size * scale_y * 0.1)
+    {
+        scale_x *= 0.95;
+        scale_y *= 0.95;
+
+        text_height = shaped->m_advance * font_size * scale_y;
+        each_blank_height = (height - text_height) / (chars.size() + 1);
+    }
+
+    // Place each character one by one. The vertical origin is the top center.
+    std::vector<PDF_GLYPH_RUN>& runs = ctx.m_row_runs;
+    double x = x0 + width / 2;
+    double y = y0 + ctx.m_y_adjust;
+    for (size_t ich = 0; ich < chars.size(); ++ich)
+    {
+        y += each_blank_height;
+        pdf_add_shaped_char_glyphs(runs, row, ich, x, y, scale_x, scale_y);
+        y += advances[ich] * font_size * scale_y;
+    }
+
+    // Lay out the glyphs at once
+    pdf_layout_glyph_runs(ctx, profile.m_face, font_size, runs);
+
+    return true;
+}
+
+#endif // def PDFPLACA_USE_HARFBUZZ
+
+// Draw horizontal scaled text
+bool pdf_draw_h_text(PLACARD_CONTEXT& ctx, const PDF_FONT_PROFILE& profile, std::string_view text, double x0, double y0, double width, double height, double threshold)
+{
+    if (text.empty())
+        return false;
+
+    // Split to characters
+    U8_CHARS& chars = ctx.m_row_chars;
+    u8_split_chars(chars, text);
+
+#ifdef PDFPLACA_USE_HARFBUZZ
+    // Shape with HarfBuzz if possible
+    if (pdf_draw_h_text_shaped(ctx, profile, text, chars, x0, y0, width, height, threshold))
+        return true;
+#endif
+
+    // Calculate scaling and font size
+    double font_size, scale_x, scale_y;
+    if (!pdf_scaling_h_text(ctx, profile.m_face, chars, width, height, font_size, scale_x, scale_y, threshold))
+        return false;
+
+    // Convert to glyphs
+    PDF_ROW_GLYPHS& row = ctx.m_row_glyphs;
+    if (!pdf_text_to_glyphs(ctx, profile.m_face, font_size, text, chars, row))
+        return false;
+
+    cairo_font_extents_t font_extents;
+    profile.get_font_extents(font_size, &font_extents);
+
+    // Place each character one by one
+    std::vector<PDF_GLYPH_RUN>& runs = ctx.m_row_runs;
+    double total_text_width = pdf_get_total_text_width(ctx, profile.m_face, font_size, chars) * scale_x;
+    double text_height = font_extents.height * scale_y;
+    double x = x0;
+    auto each_blank_width = (width - total_text_width) / (chars.size() + 1);
+    for (size_t ich = 0; ich < chars.size(); ++ich)
+    {
+        x += each_blank_width;
+
+        auto& text_char = chars[ich];
+
+        cairo_text_extents_t extents;
+        pdf_char_extents(ctx, profile.m_face, font_size, text_char, &extents);
+
+        double y = y0 + (height - font_extents.height * scale_y) / 2;
+        pdf_draw_h_char(ctx, text_char, x, y, scale_x, scale_y, extents, font_extents, row, ich, runs);
+
+        x += extents.x_advance * scale_x;
+    }
+
+    // Lay out the glyphs at once
+    pdf_layout_glyph_runs(ctx, profile.m_face, font_size, runs);
+
+    return true;
+}
+
+// 半角から全角への変換表。0は変換しない。
+struct U8_FULLWIDTH_TABLE
+{
+    uint16_t m_ascii[0x80];                 // U+0000..U+007F
+    uint16_t m_halfwidth[0xFFEF - 0xFF61];  // U+FF61..U+FFEE
+};
+
+constexpr U8_FULLWIDTH_TABLE u8_make_fullwidth_table(void)
+{
+    U8_FULLWIDTH_TABLE table = { };
+
+    // ASCII
+    table.m_ascii[0x20] = 0x3000;
+    for (uint32_t ch = 0x21; ch <= 0x7E; ++ch)
+        table.m_ascii[ch] = uint16_t(0xFF01 + (ch - 0x21));
+
+    // 半角カナ（U+FF61..U+FF9F）
+    const uint16_t kana[] =
+    {
+        0x3002, 0x300C, 0x300D, 0x3001, 0x30FB, 0x30F2, 0x30A1, 0x30A3, // ｡｢｣､･ｦｧｨ
+        0x30A5, 0x30A7, 0x30A9, 0x30E3, 0x30E5, 0x30E7, 0x30C3, 0x30FC, // ｩｪｫｬｭｮｯｰ
+        0x30A2, 0x30A4, 0x30A6, 0x30A8, 0x30AA, 0x30AB, 0x30AD, 0x30AF, // ｱｲｳｴｵｶｷｸ
+        0x30B1, 0x30B3, 0x30B5, 0x30B7, 0x30B9, 0x30BB, 0x30BD, 0x30BF, // ｹｺｻｼｽｾｿﾀ
+        0x30C1, 0x30C4, 0x30C6, 0x30C8, 0x30CA, 0x30CB, 0x30CC, 0x30CD, // ﾁﾂﾃﾄﾅﾆﾇﾈ
+        0x30CE, 0x30CF, 0x30D2, 0x30D5, 0x30D8, 0x30DB, 0x30DE, 0x30DF, // ﾉﾊﾋﾌﾍﾎﾏﾐ
+        0x30E0, 0x30E1, 0x30E2, 0x30E4, 0x30E6, 0x30E8, 0x30E9, 0x30EA, // ﾑﾒﾓﾔﾕﾖﾗﾘ
+        0x30EB, 0x30EC, 0x30ED, 0x30EF, 0x30F3, 0x309B, 0x309C,         // ﾙﾚﾛﾜﾝﾞﾟ
+    };
+    for (size_t i = 0; i < _countof(kana); ++i)
+        table.m_halfwidth[i] = kana[i];
+
+    // 半角ハングル（U+FFA0..U+FFDC）
+    table.m_halfwidth[0xFFA0 - 0xFF61] = 0x3164;
+    for (uint32_t ch = 0xFFA1; ch <= 0xFFBE; ++ch)
+        table.m_halfwidth[ch - 0xFF61] = uint16_t(0x3131 + (ch - 0xFFA1));
+    for (uint32_t ch = 0xFFC2; ch <= 0xFFC7; ++ch)
+        table.m_halfwidth[ch - 0xFF61] = uint16_t(0x314F + (ch - 0xFFC2));
+    for (uint32_t ch = 0xFFCA; ch <= 0xFFCF; ++ch)
+        table.m_halfwidth[ch - 0xFF61] = uint16_t(0x3155 + (ch - 0xFFCA));
+    for (uint32_t ch = 0xFFD2; ch <= 0xFFD7; ++ch)
+        table.m_halfwidth[ch - 0xFF61] = uint16_t(0x315B + (ch - 0xFFD2));
+    for (uint32_t ch = 0xFFDA; ch <= 0xFFDC; ++ch)
+        table.m_halfwidth[ch - 0xFF61] = uint16_t(0x3161 + (ch - 0xFFDA));
+
+    // 半角の記号（U+FFE8..U+FFEE）
+    const uint16_t symbols[] = { 0x2502, 0x2190, 0x2191, 0x2192, 0x2193, 0x25A0, 0x25CB };
+    for (size_t i = 0; i < _countof(symbols); ++i)
+        table.m_halfwidth[0xFFE8 - 0xFF61 + i] = symbols[i];
+
+    return table;
+}
+
+static constexpr U8_FULLWIDTH_TABLE g_u8_fullwidth_table = u8_make_fullwidth_table();
+
+static_assert(g_u8_fullwidth_table.m_ascii['A'] == 0xFF21, "");
+static_assert(g_u8_fullwidth_table.m_ascii['~'] == 0xFF5E, "");
+static_assert(g_u8_fullwidth_table.m_halfwidth[0xFF71 - 0xFF61] == 0x30A2, ""); // ｱ
+static_assert(g_u8_fullwidth_table.m_halfwidth[0xFF9D - 0xFF61] == 0x30F3, ""); // ﾝ
+static_assert(g_u8_fullwidth_table.m_halfwidth[0xFFBE - 0xFF61] == 0x314E, ""); // ﾾ
+static_assert(g_u8_fullwidth_table.m_halfwidth[0xFFDC - 0xFF61] == 0x3163, ""); // ￜ
+
+// 1文字の全角への変換。0は変換しない。
+constexpr uint32_t u32_to_fullwidth(uint32_t u32)
+{
+    if (u32 < 0x80)
+        return g_u8_fullwidth_table.m_ascii[u32];
+    if (0xFF61 <= u32 && u32 <= 0xFFEE)
+        return g_u8_fullwidth_table.m_halfwidth[u32 - 0xFF61];
+    switch (u32)
+    {
+    case 0x00A2: return 0xFFE0; // ¢
+    case 0x00A3: return 0xFFE1; // £
+    case 0x00AC: return 0xFFE2; // ¬
+    case 0x00AF: return 0xFFE3; // ¯
+    case 0x00A6: return 0xFFE4; // ¦
+    case 0x00A5: return 0xFFE5; // ¥
+    case 0x20A9: return 0xFFE6; // ₩
+    }
+    return 0;
+}
+
+// カタカナに濁点・半濁点を合成する。合成できなければ0を返す。
+constexpr uint32_t u32_compose_kana(uint32_t kana, uint32_t mark)
+{
+    if (mark == 0xFF9E) // ﾞ
+    {
+        if ((0x30AB <= kana && kana <= 0x30C2 && (kana & 1)) || // カ..チ
+            (0x30C4 <= kana && kana <= 0x30C8 && !(kana & 1)) || // ツ..ト
+            (0x30CF <= kana && kana <= 0x30DB && (kana - 0x30CF) % 3 == 0)) // ハ..ホ
+        {
+            return kana + 1;
+        }
+        switch (kana)
+        {
+        case 0x30A6: return 0x30F4; // ヴ
+        case 0x30EF: return 0x30F7; // ヷ
+        case 0x30F2: return 0x30FA; // ヺ
+        }
+    }
+    else if (mark == 0xFF9F) // ﾟ
+    {
+        if (0x30CF <= kana && kana <= 0x30DB && (kana - 0x30CF) % 3 == 0) // ハ..ホ
+            return kana + 2;
+    }
+    return 0;
+}
+static_assert(u32_compose_kana(0x30AB, 0xFF9E) == 0x30AC, ""); // ガ
+static_assert(u32_compose_kana(0x30C4, 0xFF9E) == 0x30C5, ""); // ヅ
+static_assert(u32_compose_kana(0x30D5, 0xFF9F) == 0x30D7, ""); // プ
+static_assert(u32_compose_kana(0x30A2, 0xFF9E) == 0, "");
+
+// UTF-32の1文字をUTF-8で書き込む。書き込んだ後の位置を返す。
+inline char *u8_put_char(char *out, uint32_t u32)
+{
+    if (u32 < 0x80)
+    {
+        *out++ = char(u32);
+    }
+    else if (u32 < 0x800)
+    {
+        *out++ = char(0xC0 | (u32 >> 6));
+        *out++ = char(0x80 | (u32 & 0x3F));
+    }
+    else if (u32 < 0x10000)
+    {
+        *out++ = char(0xE0 | (u32 >> 12));
+        *out++ = char(0x80 | ((u32 >> 6) & 0x3F));
+        *out++ = char(0x80 | (u32 & 0x3F));
+    }
+    else
+    {
+        *out++ = char(0xF0 | (u32 >> 18));
+        *out++ = char(0x80 | ((u32 >> 12) & 0x3F));
+        *out++ = char(0x80 | ((u32 >> 6) & 0x3F));
+        *out++ = char(0x80 | (u32 & 0x3F));
+    }
+    return out;
+}
+
+// 縦書きに備えて、半角文字を全角文字に変換する。
+// 等幅フォントでなければ、半角スペースはそのまま残す。
+void u8_to_fullwidth(std::string& ret, std::string_view text, bool fixed_pitch_font)
+{
+    // どの文字も3バイト以内に変換されるので、一度だけ確保する（retの容量が足りれば確保しない）。
+    ret.resize(text.size() * 3);
+    char *out = &ret[0];
+
+    for (size_t ich = 0; ich < text.size(); )
+    {
+        // ASCIIの並び
+        size_t count = u8_ascii_prefix(&text[ich], text.size() - ich);
+        for (size_t end = ich + count; ich < end; ++ich)
+        {
+            uint8_t ch = uint8_t(text[ich]);
+            uint32_t wide = g_u8_fullwidth_table.m_ascii[ch];
+            if (!wide || (ch == ' ' && !fixed_pitch_font))
+                *out++ = char(ch);
+            else
+                out = u8_put_char(out, wide);
+        }
+        if (ich >= text.size())
+            break;
+
+        uint32_t u32;
+        size_t len = u8_decode_one(&text[ich], text.size() - ich, &u32);
+        if (!len) // 不正なバイトはそのまま。
+        {
+            *out++ = text[ich++];
+            continue;
+        }
+
+        uint32_t wide = u32_to_fullwidth(u32);
+        if (!wide)
+        {
+            std::memcpy(out, &text[ich], len);
+            out += len;
+            ich += len;
+            continue;
+        }
+        ich += len;
+
+        // 半角カナの濁点・半濁点を合成する。
+        if (0x30A0 <= wide && wide <= 0x30FF && ich < text.size())
+        {
+            uint32_t mark;
+            size_t mark_len = u8_decode_one(&text[ich], text.size() - ich, &mark);
+            if (mark_len)
+            {
+                if (uint32_t composed = u32_compose_kana(wide, mark))
+                {
+                    wide = composed;
+                    ich += mark_len;
+                }
+            }
+        }
+
+        out = u8_put_char(out, wide);
+    }
+
+    ret.resize(out - ret.data());
+}
+
+std::string u8_to_fullwidth(std::string_view text, bool fixed_pitch_font)
+{
+    std::string ret;
+    u8_to_fullwidth(ret, text, fixed_pitch_font);
+    return ret;
+}
+
+void u8_to_fullwidth_unittest(void)
+{
+#ifndef NDEBUG
+    assert(u8_to_fullwidth(u8"Ab 1", true) == u8"Ａｂ　１");
+    assert(u8_to_fullwidth(u8"Ab 1", false) == u8"Ａｂ １");
+    assert(u8_to_fullwidth(u8"　漢\n", true) == u8"　漢\n");
+    assert(u8_to_fullwidth(u8"ｶﾞｷﾞｸﾊﾟｱﾞｳﾞ", true) == u8"ガギクパア゛ヴ");
+    assert(u8_to_fullwidth(u8"ﾞ¥₩ￚ", true) == u8"゛￥￦ㅡ");
+    std::string str(5000, 'a'); // 長さの制限はない。
+    assert(u8_to_fullwidth(str, true).size() == str.size() * 3);
+#endif
+}
+
+// Draw vertical scaled text
+bool pdf_draw_v_text(PLACARD_CONTEXT& ctx, const PDF_FONT_PROFILE& profile, std::string_view text, double x0, double y0, double width, double height, double threshold)
+{
+    if (text.empty())
+        return false;
+
+    // Fullwidth mapping
+    std::string& mapped_text = ctx.m_row_text;
+    if (profile.is_cjk())
+        u8_to_fullwidth(mapped_text, text, profile.m_fixed_pitch);
+    else
+        mapped_text.assign(text.data(), text.size());
+
+    // Split to characters
+    U8_CHARS& chars = ctx.m_row_chars;
+    u8_split_chars(chars, mapped_text);
+
+#ifdef PDFPLACA_USE_HARFBUZZ
+    // Shape with HarfBuzz if possible
+    if (pdf_draw_v_text_shaped(ctx, profile, mapped_text, chars, x0, y0, width, height, threshold))
+        return true;
+#endif
+
+    // Classify characters
+    std::vector<uint8_t>& classes = ctx.m_row_classes;
+    u8_classify_chars(classes, chars);
+
+    // Calculate scaling and font size
+    double font_size, scale_x, scale_y;
+    if (!pdf_scaling_v_text(ctx, profile.m_face, chars, classes, width, height, font_size, scale_x, scale_y, threshold))
+        return false;
+
+    // Convert to glyphs
+    PDF_ROW_GLYPHS& row = ctx.m_row_glyphs;
+    if (!pdf_text_to_glyphs(ctx, profile.m_face, font_size, mapped_text, chars, row))
+        return false;
+
+    // get text height
+    double text_width, text_height;
+    pdf_get_v_text_width_and_height(ctx, profile.m_face, font_size, chars, classes, text_width, text_height);
+    text_width *= scale_x;
+    text_height *= scale_y;
+
+    auto each_blank_height = (height - text_height) / (chars.size() + 1);
+    while (each_blank_height <= font_size * scale_y * 0.1)
+    {
+        scale_x *= 0.95;
+        scale_y *= 0.95;
+
+        pdf_get_v_text_width_and_height(ctx, profile.m_face, font_size, chars, classes, text_width, text_height);
+        text_width *= scale_x;
+        text_height *= scale_y;
+        each_blank_height = (height - text_height) / (chars.size() + 1);
+    }
+
+    // Place each character one by one
+    std::vector<PDF_GLYPH_RUN>& runs = ctx.m_row_runs;
+    double y = y0;
+    for (size_t ich = 0; ich < chars.size(); ++ich)
+    {
+        y += each_blank_height;
+
+        auto& text_char = chars[ich];
+
+        cairo_text_extents_t extents;
+        pdf_char_extents(ctx, profile.m_face, font_size, text_char, &extents);
+
+        cairo_font_extents_t font_extents;
+        profile.get_font_extents(font_size, &font_extents);
+
+        double x = x0 + width / 2;
+        pdf_draw_v_char(ctx, text_char, classes[ich], x, y, scale_x, scale_y, extents, font_extents, row, ich, runs);
+
+        pdf_char_extents(ctx, profile.m_face, font_size, text_char, &extents);
+
+        if (classes[ich] & U8CC_SPACE)
+            y += extents.x_advance * scale_y;
+        else if (classes[ich] & U8CC_SMALL_KANA)
+            y += extents.height * scale_y * SMALL_KANA_RATIO;
+        else if (classes[ich] & U8CC_HYPHEN_DASH)
+            y += extents.width * scale_y;
+        else if (classes[ich] & U8CC_PAREN)
+            y += extents.width * scale_y;
+        else
+            y += extents.height * scale_y;
+    }
+
+    // Lay out the glyphs at once
+    pdf_layout_glyph_runs(ctx, profile.m_face, font_size, runs);
+
+    return true;
+}
+
+// Draw vertical scaled text (fixed-pitch)
+bool pdf_draw_v_text_fixed(PLACARD_CONTEXT& ctx, const PDF_FONT_PROFILE& profile, std::string_view text, double x0, double y0, double width, double height, double threshold)
+{
+    if (text.empty())
+        return false;
+
+    // Fullwidth mapping
+    std::string& mapped_text = ctx.m_row_text;
+    if (profile.is_cjk())
+        u8_to_fullwidth(mapped_text, text, profile.m_fixed_pitch);
+    else
+        mapped_text.assign(text.data(), text.size());
+
+    // Split to characters
+    U8_CHARS& chars = ctx.m_row_chars;
+    u8_split_chars(chars, mapped_text);
+
+#ifdef PDFPLACA_USE_HARFBUZZ
+    // Shape with HarfBuzz if possible
+    if (pdf_draw_v_text_shaped(ctx, profile, mapped_text, chars, x0, y0, width, height, threshold))
+        return true;
+#endif
+
+    // Classify characters
+    std::vector<uint8_t>& classes = ctx.m_row_classes;
+    u8_classify_chars(classes, chars);
+
+    // Calculate scaling and font size
+    double font_size, scale_x, scale_y;
+    if (!pdf_scaling_v_text_fixed(ctx, profile.m_face, chars, width, height, font_size, scale_x, scale_y, threshold))
+        return false;
+
+    // Convert to glyphs
+    PDF_ROW_GLYPHS& row = ctx.m_row_glyphs;
+    if (!pdf_text_to_glyphs(ctx, profile.m_face, font_size, mapped_text, chars, row))
+        return false;
+
+    // get text height
+    double text_width, text_height;
+    pdf_get_v_text_width_and_height_fixed(ctx, profile.m_face, font_size, chars, text_width, text_height);
+    text_width *= scale_x;
+    text_height *= scale_y;
+    auto each_blank_height = (height - text_height) / (chars.size() + 1);
+    while (each_blank_height <= 0)
+    {
+        scale_x *= 0.95;
+        scale_y *= 0.95;
+
+        pdf_get_v_text_width_and_height(ctx, profile.m_face, font_size, chars, classes, text_width, text_height);
+        text_width *= scale_x;
+        text_height *= scale_y;
+        each_blank_height = (height - text_height) / (chars.size() + 1);
+    }
+
+    std::vector<PDF_GLYPH_RUN>& runs = ctx.m_row_runs;
+    double y = y0;
+    for (size_t ich = 0; ich < chars.size(); ++ich)
+    {
+        y += each_blank_height;
+
+        auto& text_char = chars[ich];
+
+        cairo_text_extents_t extents;
+        pdf_char_extents(ctx, profile.m_face, font_size, text_char, &extents);
+
+        cairo_font_extents_t font_extents;
+        profile.get_font_extents(font_size, &font_extents);
+
+        double x = x0 + width / 2 - extents.x_advance * scale_x / 2;
+
+        // 変換行列や位置などを調整する。
+        cairo_matrix_t matrix;
+        double dx = 0, dy = ctx.m_y_adjust;
+        if (classes[ich] & U8CC_SMALL_KANA) // 小さいカナか？
+        {
+            dx += font_extents.height * scale_x * 0.27;
+            dy += -font_extents.height * scale_y * 0.3;
+            cairo_matrix_init(&matrix,
+                scale_x * 0.75, 0, 0, scale_y * 0.75,
+                x + dx,
+                y - font_extents.descent * scale_y + font_extents.height * scale_y + dy);
+        }
+        else if (classes[ich] & U8CC_HYPHEN_DASH) // 横棒か？
+        {
+            cairo_matrix_init(&matrix,
+                0, scale_y, scale_x, 0,
+                x + (font_extents.height - font_extents.descent) * scale_x + dx,
+                y - font_extents.height * scale_y + font_extents.height * scale_y + dy);
+        }
+        else if (classes[ich] & U8CC_PAREN_TYPE_1) // カッコ（タイプ1）か？
+        {
+            cairo_matrix_init(&matrix,
+                0, scale_y, -scale_x, 0,
+                x + font_extents.descent * scale_x + dx,
+                y + dy);
+        }
+        else if (classes[ich] & U8CC_PAREN_TYPE_2) // カッコ（タイプ2）か？
+        {
+            cairo_matrix_init(&matrix,
+                0, scale_y, -scale_x, 0,
+                x + font_extents.descent * scale_x + dx,
+                y + dy);
+        }
+        else if (classes[ich] & U8CC_PAREN_TYPE_3) // カッコ（タイプ3）か？
+        {
+            cairo_matrix_init(&matrix,
+                0, scale_y, -scale_x, 0,
+                x + font_extents.descent * scale_x + dx,
+                y + dy);
+        }
+        else
+        {
+            if (classes[ich] & U8CC_COMMA_PERIOD) // 句読点か？
+            {
+                dx += extents.x_advance * scale_x * 0.5;
+                dy += -extents.x_advance * scale_y * 0.5;
+            }
+            cairo_matrix_init(&matrix,
+                scale_x, 0, 0, scale_y,
+                x + dx,
+                y - font_extents.descent * scale_y + font_extents.height * scale_y + dy);
+        }
+        pdf_add_char_glyphs(runs, row, ich, matrix);
+
+        y += extents.x_advance * scale_y;
+    }
+
+    // 変換行列は絶対的なもの。pdf_emit_page_layoutは単位行列から描画する。
+    pdf_layout_glyph_runs(ctx, profile.m_face, font_size, runs);
+
+    return true;
+}
+
+// 禁則処理。文字prevと文字nextの間で改行してよいか？
+constexpr bool u8_can_break_between(uint32_t prev, uint8_t prev_class, uint32_t next, uint8_t next_class)
+{
+    // 行頭禁則：句読点・小さいカナ・閉じカッコ・スペースは行頭に置かない。
+    if (next_class & (U8CC_COMMA_PERIOD | U8CC_SMALL_KANA | U8CC_SPACE))
+        return false;
+    if ((next_class & U8CC_PAREN) && !(next_class & U8CC_OPENING))
+        return false;
+
+    // 行末禁則：開きカッコは行末に置かない。
+    if (prev_class & U8CC_OPENING)
+        return false;
+
+    // 英数字の単語の途中では改行しない。
+    if (prev < 0x80 && next < 0x80 && !(prev_class & U8CC_SPACE))
+        return false;
+
+    return true;
+}
+static_assert(u8_can_break_between(0x3042, U8CC_NONE, 0x3044, U8CC_NONE), "");
+static_assert(!u8_can_break_between(0x3042, U8CC_NONE, 0x3002, U8CC_COMMA_PERIOD), "");
+static_assert(!u8_can_break_between(0x300C, U8CC_PAREN_TYPE_2 | U8CC_OPENING, 0x3042, U8CC_NONE), "");
+static_assert(!u8_can_break_between(0x3042, U8CC_NONE, 0x300D, U8CC_PAREN_TYPE_3), "");
+static_assert(!u8_can_break_between('a', U8CC_NONE, 'b', U8CC_NONE), "");
+static_assert(u8_can_break_between(' ', U8CC_SPACE, 'b', U8CC_NONE), "");
+
+// 文字の手前の改行の種類。
+enum PDF_WRAP_BREAK : uint8_t
+{
+    PDF_WRAP_NONE = 0,      // 改行できない
+    PDF_WRAP_ALLOWED,       // 改行できる
+    PDF_WRAP_FORCED,        // 明示的な改行
+};
+
+// 自動改行の最適化。行の幅の最大値が最小になるように、改行位置の候補で文字の並びを分ける。
+// 行数ごとに動的計画法で一段ずつ求める。最適な最後の行の始まりは行末とともに単調に進むので、
+// 一段あたりO(n)の算術で済む。行の末尾のスペースは幅に数えない。
+struct PDF_WRAP_SOLVER
+{
+    std::vector<size_t> m_pos;          // 改行位置の候補（文字の番号）。先頭は0、末尾は文字数。
+    std::vector<size_t> m_trim;         // 候補で終わる行の末尾のスペースを除いた終わり（文字の番号）。
+    std::vector<double> m_start;        // 候補から始まる行の始点（送り幅の累積）。
+    std::vector<double> m_end;          // 候補で終わる行の終点（送り幅の累積）。
+    std::vector<size_t> m_last_forced;  // 候補より前で最後の明示的な改行の候補。なければ0。
+    std::vector<std::vector<double>> m_widths;  // m_widths[j][c]：候補cまでをj + 1行以下に分けたときの最大の行の幅。
+    std::vector<std::vector<size_t>> m_from;    // m_from[j][c]：最後の行の始まりの候補。cならj行以下で済む。
+
+    // 文字ごとの送り幅・分類・改行の種類から候補を作る。
+    void init(const std::vector<double>& advances, const std::vector<uint8_t>& classes, const std::vector<uint8_t>& breaks)
+    {
+        m_pos.clear();
+        m_trim.clear();
+        m_start.clear();
+        m_end.clear();
+        m_last_forced.clear();
+        m_widths.clear();
+        m_from.clear();
+
+        double sum = 0, trimmed_sum = 0;
+        size_t trim = 0, last_forced = 0;
+        for (size_t ich = 0; ich <= advances.size(); ++ich)
+        {
+            if (ich == 0 || ich == advances.size() || breaks[ich] != PDF_WRAP_NONE)
+            {
+                m_pos.push_back(ich);
+                m_trim.push_back(trim);
+                m_start.push_back(sum);
+                m_end.push_back(trimmed_sum);
+                m_last_forced.push_back(last_forced);
+                if (ich < advances.size() && breaks[ich] == PDF_WRAP_FORCED)
+                    last_forced = m_pos.size() - 1;
+            }
+            if (ich < advances.size())
+            {
+                sum += advances[ich];
+                if (!(classes[ich] & U8CC_SPACE))
+                {
+                    trimmed_sum = sum;
+                    trim = ich + 1;
+                }
+            }
+        }
+    }
+
+    // 分けられる行数の上限。
+    size_t max_rows() const
+    {
+        return m_pos.size() - 1;
+    }
+
+    // 候補aから候補cまでの行の幅。明示的な改行をまたぐなら無限大。
+    double width(size_t a, size_t c) const
+    {
+        if (m_last_forced[c] > a)
+            return HUGE_VAL;
+        return std::max(0.0, m_end[c] - m_start[a]);
+    }
+
+    // 行数を一つ増やしたときの最大の行の幅を求める。
+    double add_row()
+    {
+        size_t j = m_widths.size(), num_cands = m_pos.size();
+        m_widths.emplace_back(num_cands);
+        m_from.emplace_back(num_cands);
+        auto& widths = m_widths[j];
+        auto& from = m_from[j];
+        widths[0] = 0;
+        from[0] = 0;
+
+        if (j == 0)
+        {
+            for (size_t c = 1; c < num_cands; ++c)
+            {
+                widths[c] = width(0, c);
+                from[c] = 0;
+            }
+            return widths[num_cands - 1];
+        }
+
+        const auto& prev = m_widths[j - 1];
+        size_t a = 0;
+        for (size_t c = 1; c < num_cands; ++c)
+        {
+            // 前の段の幅は単調に増え、最後の行の幅は単調に減るので、その交点を探す。
+            while (a + 1 < c && std::max(prev[a + 1], width(a + 1, c)) <= std::max(prev[a], width(a, c)))
+                ++a;
+
+            widths[c] = std::max(prev[a], width(a, c));
+            from[c] = a;
+            if (prev[c] <= widths[c])
+            {
+                widths[c] = prev[c];
+                from[c] = c;
+            }
+        }
+        return widths[num_cands - 1];
+    }
+
+    // num_rows行以下での分け方を取得する。rowsは文字の番号の範囲（末尾のスペースを除く）。
+    void get_rows(size_t num_rows, std::vector<std::pair<size_t, size_t>>& rows) const
+    {
+        rows.clear();
+        size_t c = m_pos.size() - 1, j = num_rows - 1;
+        while (c > 0)
+        {
+            size_t a = m_from[j][c];
+            if (a == c)
+            {
+                --j;
+                continue;
+            }
+            rows.emplace_back(m_pos[a], std::max(m_pos[a], m_trim[c]));
+            c = a;
+            if (j)
+                --j;
+        }
+        std::reverse(rows.begin(), rows.end());
+    }
+};
+
+void pdf_wrap_solver_unittest(void)
+{
+#ifndef NDEBUG
+    // 素朴な動的計画法と比べる。
+    uint32_t seed = 1;
+    auto random = [&](uint32_t n) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) % n;
+    };
+    for (int iTest = 0; iTest < 300; ++iTest)
+    {
+        size_t len = 1 + random(40);
+        std::vector<double> advances(len);
+        std::vector<uint8_t> classes(len), breaks(len);
+        for (size_t ich = 0; ich < len; ++ich)
+        {
+            advances[ich] = 0.25 * (1 + random(8));
+            classes[ich] = (random(6) == 0) ? uint8_t(U8CC_SPACE) : uint8_t(U8CC_NONE);
+            breaks[ich] = (ich == 0) ? uint8_t(PDF_WRAP_NONE) : (random(8) == 0) ? uint8_t(PDF_WRAP_FORCED) : uint8_t(random(3));
+        }
+
+        PDF_WRAP_SOLVER solver;
+        solver.init(advances, classes, breaks);
+        size_t num_cands = solver.m_pos.size();
+        std::vector<double> prev;
+        for (size_t num_rows = 1; num_rows <= solver.max_rows(); ++num_rows)
+        {
+            std::vector<double> expected(num_cands, HUGE_VAL);
+            expected[0] = 0;
+            for (size_t c = 1; c < num_cands; ++c)
+            {
+                if (num_rows == 1)
+                {
+                    expected[c] = solver.width(0, c);
+                    continue;
+                }
+                expected[c] = prev[c];
+                for (size_t a = 0; a < c; ++a)
+                    expected[c] = std::min(expected[c], std::max(prev[a], solver.width(a, c)));
+            }
+
+            double width = solver.add_row();
+            assert(width == expected[num_cands - 1]);
+            for (size_t c = 0; c < num_cands; ++c)
+                assert(solver.m_widths[num_rows - 1][c] == expected[c]);
+            prev = expected;
+
+            // 分け方がその幅を実現していること。
+            std::vector<std::pair<size_t, size_t>> rows;
+            solver.get_rows(num_rows, rows);
+            assert(!rows.empty() && rows.size() <= num_rows && rows[0].first == 0);
+            if (width == HUGE_VAL)
+                continue;
+            double max_width = 0;
+            for (size_t iRow = 0; iRow < rows.size(); ++iRow)
+            {
+                double row_width = 0;
+                for (size_t ich = rows[iRow].first; ich < rows[iRow].second; ++ich)
+                    row_width += advances[ich];
+                max_width = std::max(max_width, row_width);
+                if (iRow > 0)
+                    assert(breaks[rows[iRow].first] != PDF_WRAP_NONE);
+                for (size_t ich = rows[iRow].first + 1; ich < rows[iRow].second; ++ich)
+                    assert(breaks[ich] != PDF_WRAP_FORCED);
+            }
+            assert(std::abs(max_width - width) < 1e-9);
+        }
+    }
+#endif
+}
+
+// 自動改行で分ける行の数の上限。
+#define PDF_WRAP_MAX_ROWS 64
+
+// 行を自動で改行する。全部の行のうち最も小さいフォントサイズが最大になるように改行位置を選ぶ。
+// 明示的な改行と空の行はそのまま保つ。wrappedの各行はrowsの部分文字列。
+void pdf_auto_wrap_rows(PLACARD_CONTEXT& ctx, const PDF_FONT_PROFILE& profile, const std::vector<std::string_view>& rows, std::vector<std::string_view>& wrapped, double page_width, double page_height, double margin)
+{
+    // 文字ごとの分類・フォントサイズ1.0での送り幅・改行の種類を求める。送り幅はキャッシュから引く。
+    cairo_font_face_t *face = profile.m_face;
+    U8_CHARS chars, row_chars;
+    std::vector<uint8_t> classes, breaks;
+    std::vector<double> advances;
+    std::vector<size_t> row_first(rows.size() + 1);
+    size_t num_empty_rows = 0;
+    double thickness = ctx.m_vertical ? 0 : profile.m_font_extents.height;
+    for (size_t iRow = 0; iRow < rows.size(); ++iRow)
+    {
+        row_first[iRow] = chars.size();
+        u8_split_chars(row_chars, rows[iRow]);
+        if (row_chars.empty())
+            ++num_empty_rows;
+
+        for (size_t ich = 0; ich < row_chars.size(); ++ich)
+        {
+            auto& text_char = row_chars[ich];
+            uint8_t char_class = u8_char_class(text_char.m_u32);
+
+            cairo_text_extents_t extents;
+            pdf_char_extents(ctx, face, 1, text_char, &extents);
+            double advance = extents.x_advance;
+            if (ctx.m_vertical)
+            {
+                double char_width;
+                pdf_get_v_char_width_and_height(extents, char_class, char_width, advance);
+                if (thickness < char_width)
+                    thickness = char_width;
+            }
+
+            uint8_t char_break = PDF_WRAP_NONE;
+            if (ich == 0)
+                char_break = chars.empty() ? PDF_WRAP_NONE : PDF_WRAP_FORCED;
+            else if (u8_can_break_between(chars.back().m_u32, classes.back(), text_char.m_u32, char_class))
+                char_break = PDF_WRAP_ALLOWED;
+
+            chars.push_back(text_char);
+            classes.push_back(char_class);
+            advances.push_back(advance);
+            breaks.push_back(char_break);
+        }
+    }
+    row_first[rows.size()] = chars.size();
+
+    if (chars.empty() || thickness <= 0)
+    {
+        wrapped = rows;
+        return;
+    }
+
+    // 行数を増やしながら、最小のフォントサイズが最大になる行数を探す。
+    // 行の高さは行数とともに減るので、それだけで今の最良に届かなくなったら打ち切る。
+    PDF_WRAP_SOLVER solver;
+    solver.init(advances, classes, breaks);
+    double along = (ctx.m_vertical ? page_height : page_width) - 2 * margin;
+    double across_all = ctx.m_vertical ? page_width : page_height;
+    size_t best_rows = 0;
+    double best_size = 0;
+    for (size_t num_rows = 1; num_rows <= std::min(solver.max_rows(), size_t(PDF_WRAP_MAX_ROWS)); ++num_rows)
+    {
+        size_t total_rows = num_rows + num_empty_rows;
+        double across = (across_all - margin * (total_rows + 1)) / total_rows;
+        if (across <= 0 || across / thickness <= best_size)
+            break;
+
+        double width = solver.add_row();
+        double size = across / thickness;
+        if (width > 0)
+            size = std::min(size, along / width);
+        if (best_size < size)
+        {
+            best_size = size;
+            best_rows = num_rows;
+        }
+    }
+
+    if (!best_rows)
+    {
+        wrapped = rows;
+        return;
+    }
+
+    // 明示的な行ごとに、分けた行を並べる。
+    std::vector<std::pair<size_t, size_t>> spans;
+    solver.get_rows(best_rows, spans);
+    wrapped.clear();
+    size_t iSpan = 0;
+    for (size_t iRow = 0; iRow < rows.size(); ++iRow)
+    {
+        if (row_first[iRow] == row_first[iRow + 1])
+        {
+            wrapped.push_back(rows[iRow]);
+            continue;
+        }
+        for (; iSpan < spans.size() && spans[iSpan].first < row_first[iRow + 1]; ++iSpan)
+        {
+            size_t first = spans[iSpan].first, last = spans[iSpan].second;
+            if (first == last)
+            {
+                wrapped.push_back(std::string_view());
+                continue;
+            }
+            const char *begin = chars[first].m_str.data();
+            const char *end = chars[last - 1].m_str.data() + chars[last - 1].m_str.size();
+            wrapped.push_back(std::string_view(begin, size_t(end - begin)));
+        }
+    }
+}
+
+// 横書きの1ページをレイアウトする。
+bool pdfplaca_layout_h_page(PLACARD_CONTEXT& ctx, const PDF_FONT_PROFILE& profile, const std::vector<std::string_view>& rows, double page_width, double page_height, double printable_width, double printable_height, double margin)
+{
+    double y = margin;
+    double row_height = (page_height - margin * (rows.size() + 1)) / rows.size();
+    for (size_t iRow = 0; iRow < rows.size(); ++iRow)
+    {
+        // Fill text background
+        pdf_layout_fill(ctx, ctx.m_job->m_back_color, margin, y, printable_width, row_height);
+        // Draw horizontal text
+        pdf_draw_h_text(ctx, profile, rows[iRow], margin, y, printable_width, row_height, ctx.m_job->m_threshold);
+        // Advance
+        y += row_height;
+        // Advance
+        y += margin;
+    }
+
+    return true;
+}
+
+// 縦書きの1ページをレイアウトする。
+bool pdfplaca_layout_v_page(PLACARD_CONTEXT& ctx, const PDF_FONT_PROFILE& profile, const std::vector<std::string_view>& rows, double page_width, double page_height, double printable_width, double printable_height, double margin)
+{
+    double x = 0;
+    double row_width = (page_width - margin * (rows.size() + 1)) / rows.size();
+    for (size_t iRow = 0; iRow < rows.size(); ++iRow)
+    {
+        // Advance
+        x += margin;
+        // Convert X coordinate
+        double x0 = (2 * margin + printable_width) - (x + row_width);
+        // Fill text background
+        pdf_layout_fill(ctx, ctx.m_job->m_back_color, x0, margin, row_width, printable_height);
+        // Draw vertical text
+        if (profile.m_fixed_pitch && profile.m_japanese)
+            pdf_draw_v_text_fixed(ctx, profile, rows[iRow], x0, margin, row_width, printable_height, ctx.m_job->m_threshold);
+        else
+            pdf_draw_v_text(ctx, profile, rows[iRow], x0, margin, row_width, printable_height, ctx.m_job->m_threshold);
+        // Advance
+        x += row_width;
+    }
+
+    return true;
+}
+
+// ページをレイアウトする。フォントフェイスとフォントサイズはプロファイルと行から決まり、cairo_tは使わない。
+// レイアウトは文脈と行だけから決まるので、ページごとに別のスレッドで求めてよい。
+bool pdfplaca_layout_page(PLACARD_CONTEXT& ctx, const PDF_FONT_PROFILE& profile, const std::vector<std::string_view>& rows, double page_width, double page_height, double printable_width, double printable_height, double margin, PDF_PAGE_LAYOUT& layout)
+{
+    layout.m_items.clear();
+    ctx.m_layout = &layout;
+
+    // Automatic line breaking
+    std::vector<std::string_view> wrapped_rows;
+    if (ctx.m_job->m_auto_wrap)
+        pdf_auto_wrap_rows(ctx, profile, rows, wrapped_rows, page_width, page_height, margin);
+    const auto& page_rows = ctx.m_job->m_auto_wrap ? wrapped_rows : rows;
+
+    bool ret;
+    if (ctx.m_vertical) // Vertical writing?
+        ret = pdfplaca_layout_v_page(ctx, profile, page_rows, page_width, page_height, printable_width, printable_height, margin);
+    else
+        ret = pdfplaca_layout_h_page(ctx, profile, page_rows, page_width, page_height, printable_width, printable_height, margin);
+
+    ctx.m_layout = nullptr;
+    return ret;
+}
+
+// 標準入力から一度に読み込む大きさ。
+#define PDF_TEXT_CHUNK_SIZE (64 * 1024)
+
+// 手元にあるテキストを一度に渡す大きさ。キャッシュに収まるように分ける。
+#define PDF_TEXT_VIEW_CHUNK_SIZE (1024 * 1024)
+
+// テキストの入力元。--textの文字列、メモリーマップしたファイル、標準入力のいずれか。
+struct PDF_TEXT_SOURCE
+{
+    std::string m_owned;            // --textから変換した文字列
+    std::string_view m_view;        // テキスト全体（標準入力では空）
+    bool m_stdin = false;           // 標準入力から読むか？
+    bool m_unescape = true;         // エスケープを解除するか？（ファイルはそのまま）
+#ifdef _WIN32
+    HANDLE m_hFile = INVALID_HANDLE_VALUE;
+    HANDLE m_hMapping = nullptr;
+#else
+    int m_fd = -1;
+#endif
+    void *m_pView = nullptr;
+
+    PDF_TEXT_SOURCE() = default;
+    PDF_TEXT_SOURCE(const PDF_TEXT_SOURCE&) = delete;
+    PDF_TEXT_SOURCE& operator=(const PDF_TEXT_SOURCE&) = delete;
+
+    ~PDF_TEXT_SOURCE()
+    {
+        close();
+    }
+
+    // --textの文字列を入力元にする。
+    bool open_text(const _TCHAR *text)
+    {
+        close();
+#ifdef UNICODE
+        if (!ansi_from_wide(m_owned, text, wcslen(text), CP_UTF8))
+            return false;
+#else
+        m_owned = text;
+#endif
+        m_view = m_owned;
+        return true;
+    }
+
+    // UTF-8の文字列を入力元にする。
+    void open_utf8(const char *text)
+    {
+        close();
+        m_owned = text;
+        m_view = m_owned;
+    }
+
+    // ファイルを入力元にする。"-"なら標準入力。
+    bool open_file(const _TCHAR *path)
+    {
+        close();
+        m_unescape = false;
+
+        if (_tcscmp(path, _T("-")) == 0)
+        {
+#ifdef _WIN32
+            _setmode(_fileno(stdin), _O_BINARY);
+#endif
+            m_stdin = true;
+            return true;
+        }
+
+#ifdef _WIN32
+        m_hFile = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (m_hFile == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m_hFile, &size) || uint64_t(size.QuadPart) > SIZE_MAX)
+            return false;
+        if (!size.QuadPart) // 空のファイルはマップできない。
+            return true;
+
+        m_hMapping = CreateFileMapping(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!m_hMapping)
+            return false;
+        m_pView = MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+        if (!m_pView)
+            return false;
+        m_view = std::string_view(reinterpret_cast<const char *>(m_pView), size_t(size.QuadPart));
+#else
+#ifdef UNICODE
+        std::string filename = ansi_from_wide(path, CP_UTF8);
+#else
+        std::string filename = path;
+#endif
+        m_fd = ::open(filename.c_str(), O_RDONLY);
+        if (m_fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(m_fd, &st) != 0)
+            return false;
+        if (!st.st_size) // 空のファイルはマップできない。
+            return true;
+
+        void *pView = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, m_fd, 0);
+        if (pView == MAP_FAILED)
+            return false;
+        m_pView = pView;
+        m_view = std::string_view(reinterpret_cast<const char *>(m_pView), size_t(st.st_size));
+        madvise(m_pView, m_view.size(), MADV_SEQUENTIAL);
+#endif
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (m_pView)
+            UnmapViewOfFile(m_pView);
+        if (m_hMapping)
+            CloseHandle(m_hMapping);
+        if (m_hFile != INVALID_HANDLE_VALUE)
+            CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+        m_hMapping = nullptr;
+#else
+        if (m_pView)
+            munmap(m_pView, m_view.size());
+        if (m_fd >= 0)
+            ::close(m_fd);
+        m_fd = -1;
+#endif
+        m_pView = nullptr;
+        m_owned.clear();
+        m_view = std::string_view();
+        m_stdin = false;
+        m_unescape = true;
+    }
+
+    // 出力の大きさの見込み。分からなければ0。
+    size_t size_hint() const
+    {
+        return m_view.size();
+    }
+
+    // テキストを分けて順にfnに渡す。UTF-8の文字の途中では分けない。
+    // fnがfalseを返すか、読み込みに失敗すればfalseを返す。
+    template <typename T_FN>
+    bool read(T_FN fn)
+    {
+        if (!m_stdin)
+        {
+            std::string_view view = m_view;
+            while (!view.empty())
+            {
+                size_t len = view.size();
+                if (len > PDF_TEXT_VIEW_CHUNK_SIZE)
+                    len = u8_complete_prefix(view.data(), PDF_TEXT_VIEW_CHUNK_SIZE);
+                if (!len) // 不正なバイトの並び。そのまま渡して検証に任せる。
+                    len = view.size();
+                if (!fn(view.substr(0, len)))
+                    return false;
+                view.remove_prefix(len);
+            }
+            return true;
+        }
+
+        // 途中で切れたUTF-8シーケンスは次の読み込みに持ち越す。
+        std::vector<char> buf(PDF_TEXT_CHUNK_SIZE + 4);
+        size_t carry = 0;
+        for (;;)
+        {
+            size_t count = fread(&buf[carry], 1, PDF_TEXT_CHUNK_SIZE, stdin);
+            if (!count)
+            {
+                if (ferror(stdin))
+                    return false;
+                // 最後に残ったバイトは不正なシーケンス。検証に任せる。
+                return !carry || fn(std::string_view(buf.data(), carry));
+            }
+
+            size_t total = carry + count;
+            size_t len = u8_complete_prefix(buf.data(), total);
+            if (!fn(std::string_view(buf.data(), len)))
+                return false;
+            carry = total - len;
+            std::memmove(buf.data(), buf.data() + len, carry);
+        }
+    }
+};
+
+// テキストがCJKなのにフォントが対応していなければ、代わりに描画するエラーのテキストを返す。
+const char *pdfplaca_get_font_error(const PDF_FONT_PROFILE& profile, const U8_SCRIPT_HISTOGRAM& hist, std::string_view text, bool portrait)
+{
+    if (hist.japanese_level())
+    {
+        if (!profile.m_japanese || pdf_has_missing_chars(profile, text))
+        {
+            if (portrait)
+                return u8"  Error:  \n  Not  \nJapanese\nfont";
+            else
+                return u8"   Error:   \nNot Japanese font";
+        }
+    }
+    else if (hist.chinese_level())
+    {
+        if (!profile.m_chinese || pdf_has_missing_chars(profile, text))
+        {
+            if (portrait)
+                return u8"  Error:  \n  Not  \nChinese\nfont";
+            else
+                return u8"   Error:   \nNot Chinese font";
+        }
+    }
+    else if (hist.korean_level())
+    {
+        if (!profile.m_korean || pdf_has_missing_chars(profile, text))
+        {
+            if (portrait)
+                return u8"  Error:  \n  Not  \nKorean\nfont";
+            else
+                return u8"   Error:   \nNot Korean font";
+        }
+    }
+    return nullptr;
+}
+
+// エラーのテキストを描画するフォントを選ぶ。
+const PDF_FONT_PROFILE *pdfplaca_select_error_font(PLACARD_CONTEXT& ctx)
+{
+    ctx.m_vertical = false;
+    return &pdf_get_font_profile(ctx, pdf_select_font(ctx, "Arial"));
+}
+
+// ページごとの出力ファイル名のパターン。printf形式の整数の変換（%d、%05dなど）を一つだけ含む。
+struct PDF_PAGE_PATTERN
+{
+    std::basic_string<_TCHAR> m_prefix;     // 変換の前の部分（%%は%に戻したもの）。
+    std::basic_string<_TCHAR> m_suffix;     // 変換の後の部分（%%は%に戻したもの）。
+    int m_width = 0;                        // 最小の桁数。
+    bool m_zero = false;                    // 0で埋めるか？（でなければ空白）
+};
+
+// 出力ファイル名がページごとのパターンなら解析する。整数の変換がちょうど一つでなければfalseを返し、
+// そのファイル名は一つのPDFの名前として扱う。
+bool pdf_parse_page_pattern(const std::basic_string<_TCHAR>& pattern, PDF_PAGE_PATTERN& parsed)
+{
+    parsed = PDF_PAGE_PATTERN();
+    int num_conversions = 0;
+    for (size_t ich = 0; ich < pattern.size(); ++ich)
+    {
+        auto& text = num_conversions ? parsed.m_suffix : parsed.m_prefix;
+        if (pattern[ich] != _T('%'))
+        {
+            text += pattern[ich];
+            continue;
+        }
+        if (++ich < pattern.size() && pattern[ich] == _T('%'))
+        {
+            text += _T('%');
+            continue;
+        }
+        if (ich < pattern.size() && pattern[ich] == _T('0'))
+        {
+            parsed.m_zero = true;
+            ++ich;
+        }
+        for (; ich < pattern.size() && _T('0') <= pattern[ich] && pattern[ich] <= _T('9'); ++ich)
+        {
+            parsed.m_width = parsed.m_width * 10 + (pattern[ich] - _T('0'));
+            if (parsed.m_width > 32)
+                return false;
+        }
+        if (ich >= pattern.size() || (pattern[ich] != _T('d') && pattern[ich] != _T('i') && pattern[ich] != _T('u')))
+            return false;
+        ++num_conversions;
+    }
+    return num_conversions == 1;
+}
+
+// ページ番号（1から）の出力ファイル名を作る。
+std::basic_string<_TCHAR> pdf_page_file_name(const PDF_PAGE_PATTERN& parsed, int page)
+{
+    std::basic_string<_TCHAR> digits;
+    for (unsigned value = unsigned(page); ; value /= 10)
+    {
+        digits.insert(digits.begin(), _TCHAR(_T('0') + value % 10));
+        if (value < 10)
+            break;
+    }
+    if (int(digits.size()) < parsed.m_width)
+        digits.insert(0, parsed.m_width - digits.size(), parsed.m_zero ? _T('0') : _T(' '));
+    return parsed.m_prefix + digits + parsed.m_suffix;
+}
+
+void pdf_page_pattern_unittest(void)
+{
+#ifndef NDEBUG
+    PDF_PAGE_PATTERN parsed;
+    assert(pdf_parse_page_pattern(_T("page_%05d.pdf"), parsed));
+    assert(pdf_page_file_name(parsed, 1) == _T("page_00001.pdf"));
+    assert(pdf_page_file_name(parsed, 123456) == _T("page_123456.pdf"));
+    assert(pdf_parse_page_pattern(_T("%d.pdf"), parsed));
+    assert(pdf_page_file_name(parsed, 10) == _T("10.pdf"));
+    assert(pdf_parse_page_pattern(_T("100%%_%3i.pdf"), parsed));
+    assert(pdf_page_file_name(parsed, 7) == _T("100%_  7.pdf"));
+    assert(!pdf_parse_page_pattern(_T("output.pdf"), parsed));
+    assert(!pdf_parse_page_pattern(_T("100%%.pdf"), parsed));
+    assert(!pdf_parse_page_pattern(_T("%d_%d.pdf"), parsed));
+    assert(!pdf_parse_page_pattern(_T("%s.pdf"), parsed));
+    assert(!pdf_parse_page_pattern(_T("page%"), parsed));
+#endif
+}
+
+// FILEに書き込むcairoの出力関数。closureはFILE*。nullptrなら書き込みに失敗する。
+cairo_status_t pdfplaca_write_to_stdio(void *closure, const unsigned char *data, unsigned int length)
+{
+    FILE *fp = reinterpret_cast<FILE *>(closure);
+    if (!fp || fwrite(data, 1, length, fp) != length)
+        return CAIRO_STATUS_WRITE_ERROR;
+    return CAIRO_STATUS_SUCCESS;
+}
+
+// std::stringに追加するcairoの出力関数。closureはstd::string*。
+cairo_status_t pdfplaca_write_to_string(void *closure, const unsigned char *data, unsigned int length)
+{
+    reinterpret_cast<std::string *>(closure)->append(reinterpret_cast<const char *>(data), length);
+    return CAIRO_STATUS_SUCCESS;
+}
+
+// PDFサーフェスに書き込むFILEのユーザーデータのキー。
+static const cairo_user_data_key_t s_pdf_file_key = { 0 };
+
+static void pdf_close_file(void *data)
+{
+    fclose(reinterpret_cast<FILE *>(data));
+}
+
+// 出力ファイル名が標準出力を表すか？
+static bool pdf_is_stdout(const _TCHAR *out_file)
+{
+    return _tcscmp(out_file, _T("-")) == 0;
+}
+
+// PDFサーフェスを作る。write_funcがnullptrならファイルに、でなければwrite_funcに書き込む。
+// ファイルは_tfopenで開くので、現在のコードページにない文字を含むファイル名でもよい。
+// "-"なら標準出力に書き込む。Windowsで標準出力をバイナリモードにするのは呼び出し側。
+// ファイルを開けなければnullptrを返すので、呼び出し側はレイアウトの前にエラーを表示できる。
+cairo_surface_t *pdf_create_surface(const PLACARD_JOB& job, const _TCHAR *out_file, cairo_write_func_t write_func,
+                                    void *closure, double page_width, double page_height)
+{
+    cairo_surface_t *surface;
+    if (write_func)
+    {
+        surface = cairo_pdf_surface_create_for_stream(write_func, closure, page_width, page_height);
+    }
+    else if (pdf_is_stdout(out_file))
+    {
+        surface = cairo_pdf_surface_create_for_stream(pdfplaca_write_to_stdio, stdout, page_width, page_height);
+        cairo_surface_set_user_data(surface, &s_pdf_file_key, stdout, nullptr);
+    }
+    else
+    {
+        FILE *fp = _tfopen(out_file, _T("wb"));
+        if (!fp)
+            return nullptr;
+        surface = cairo_pdf_surface_create_for_stream(pdfplaca_write_to_stdio, fp, page_width, page_height);
+        if (cairo_surface_set_user_data(surface, &s_pdf_file_key, fp, pdf_close_file) != CAIRO_STATUS_SUCCESS)
+        {
+            // サーフェスはfpに書き込むので、先に破棄してから閉じる。
+            cairo_surface_destroy(surface);
+            fclose(fp);
+            return nullptr;
+        }
+    }
+    if (job.m_create_date.size())
+        cairo_pdf_surface_set_metadata(surface, CAIRO_PDF_METADATA_CREATE_DATE, job.m_create_date.c_str());
+    return surface;
+}
+
+// PDFサーフェスを仕上げて、書き込めたか確かめる。ファイルはサーフェスの破棄で閉じる。
+bool pdf_finish_surface(cairo_surface_t *surface)
+{
+    cairo_surface_finish(surface);
+    bool ok = (cairo_surface_status(surface) == CAIRO_STATUS_SUCCESS);
+    FILE *fp = reinterpret_cast<FILE *>(cairo_surface_get_user_data(surface, &s_pdf_file_key));
+    if (fp && fflush(fp) != 0)
+        ok = false;
+    return ok;
+}
+
+// ページのレイアウトを一つのPDFファイルに書き込む。
+bool pdf_write_page_file(const PLACARD_JOB& job, const PDF_PAGE_PATTERN& pattern, int page,
+                         double page_width, double page_height, const PDF_PAGE_LAYOUT& layout)
+{
+    auto filename = pdf_page_file_name(pattern, page);
+    cairo_surface_t *surface = pdf_create_surface(job, filename.c_str(), nullptr, nullptr, page_width, page_height);
+    if (!surface)
+    {
+        _ftprintf(stderr, _T("ERROR: Cannot open '%s'\n"), filename.c_str());
+        return false;
+    }
+    cairo_t *cr = cairo_create(surface);
+    pdf_emit_page_layout(cr, layout);
+    cairo_show_page(cr);
+    cairo_destroy(cr);
+    bool ok = pdf_finish_surface(surface);
+    cairo_surface_destroy(surface);
+    if (!ok)
+        _ftprintf(stderr, _T("ERROR: Cannot write '%s'\n"), filename.c_str());
+    return ok;
+}
+
+// 作業者1つあたりの、レイアウト済みで描画待ちのページの最大数。
+#define PDF_PAGE_WINDOW_PER_WORKER 4
+
+// ページのレイアウトを作業者のスレッドで並列に求めて、呼び出し元のスレッドでページの順番に描画する。
+// 作業者は自分の文脈（キャッシュ）を持ち、フォントはプロファイルのフォントフェイスから測る。
+// PDFサーフェスに描画するのは呼び出し元のスレッドだけ。投入して描画していないページは窓の大きさまでに制限するので、
+// メモリーはページ数によらない。作業者がいなければ、投入したページをその場で描画する。
+// patternがあれば、ページごとに別のPDFファイルに書き込む。文書は互いに独立なので、
+// 作業者がレイアウトと書き込みの両方をして、呼び出し元のスレッドは順番に完了を確かめるだけ。
+struct PDF_PAGE_PIPELINE
+{
+    struct SLOT
+    {
+        std::string m_text;         // ページのテキスト。
+        PDF_PAGE_LAYOUT m_layout;   // ページのレイアウト。
+        bool m_ready = false;       // レイアウト済み（ファイルに書き込むなら書き込み済み）か？
+        bool m_ok = true;           // ファイルに書き込めたか？
+    };
+
+    PLACARD_CONTEXT& m_ctx;
+    cairo_t *m_cr;
+    const PDF_FONT_PROFILE& m_profile;
+    const PDF_PAGE_PATTERN *m_pattern;  // ページごとのファイル名のパターン。nullptrならm_crに描画する。
+                                        // パターンがあればm_crはnullptr。
+    double m_page_width, m_page_height, m_printable_width, m_printable_height, m_margin;
+    PDF_PAGE_LAYOUT m_layout;           // 作業者がいないときのレイアウト。
+    std::vector<SLOT> m_slots;          // 描画待ちの窓。ページnはm_slots[n % m_slots.size()]。
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_task_cond;    // 作業者にページの投入を知らせる。
+    std::condition_variable m_ready_cond;   // 描画するスレッドにレイアウトの完了を知らせる。
+    size_t m_submitted = 0;     // 投入したページ数。
+    size_t m_taken = 0;         // 作業者が取ったページ数。
+    size_t m_emitted = 0;       // 描画したページ数。
+    bool m_quit = false;
+    bool m_failed = false;      // 書き込めなかったページがあるか？
+
+    PDF_PAGE_PIPELINE(PLACARD_CONTEXT& ctx, cairo_t *cr, const PDF_FONT_PROFILE& profile,
+                      const PDF_PAGE_PATTERN *pattern, double page_width, double page_height,
+                      double printable_width, double printable_height, double margin)
+        : m_ctx(ctx)
+        , m_cr(cr)
+        , m_profile(profile)
+        , m_pattern(pattern)
+        , m_page_width(page_width)
+        , m_page_height(page_height)
+        , m_printable_width(printable_width)
+        , m_printable_height(printable_height)
+        , m_margin(margin)
+    {
+        int num_workers = ctx.m_job->m_layout_threads;
+        if (num_workers <= 0)
+            num_workers = int(std::thread::hardware_concurrency());
+        if (num_workers <= 1)
+            return;
+
+        // 作業者の文脈は描画の文脈に残して、次のジョブでもキャッシュを使う。
+        while (ctx.m_layout_workers.size() < size_t(num_workers))
+            ctx.m_layout_workers.push_back(pdfplaca_create_context());
+
+        m_slots.resize(num_workers * PDF_PAGE_WINDOW_PER_WORKER);
+        for (int iworker = 0; iworker < num_workers; ++iworker)
+        {
+            PLACARD_CONTEXT *worker = ctx.m_layout_workers[iworker];
+            worker->m_job = ctx.m_job;
+            worker->m_vertical = ctx.m_vertical;
+            worker->m_y_adjust = ctx.m_y_adjust;
+            m_threads.emplace_back([this, worker] { work(*worker); });
+        }
+    }
+
+    ~PDF_PAGE_PIPELINE()
+    {
+        finish();
+    }
+
+    // 作業者のスレッド。
+    void work(PLACARD_CONTEXT& worker)
+    {
+        for (;;)
+        {
+            size_t page;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_task_cond.wait(lock, [&] { return m_quit || m_taken < m_submitted; });
+                if (m_taken == m_submitted)
+                    break;
+                page = m_taken++;
+            }
+
+            SLOT& slot = m_slots[page % m_slots.size()];
+            std::vector<std::string_view> rows = { slot.m_text };
+            pdfplaca_layout_page(worker, m_profile, rows, m_page_width, m_page_height,
+                                 m_printable_width, m_printable_height, m_margin, slot.m_layout);
+            if (m_pattern)
+                slot.m_ok = pdf_write_page_file(*worker.m_job, *m_pattern, int(page + 1), m_page_width, m_page_height, slot.m_layout);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            slot.m_ready = true;
+            m_ready_cond.notify_one();
+        }
+    }
+
+    // 最も古いページのレイアウトを待って描画する。
+    void emit_one()
+    {
+        SLOT& slot = m_slots[m_emitted % m_slots.size()];
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_ready_cond.wait(lock, [&] { return slot.m_ready; });
+        }
+        if (!m_pattern)
+        {
+            pdf_emit_page_layout(m_cr, slot.m_layout);
+            cairo_show_page(m_cr);
+        }
+        else if (!slot.m_ok)
+        {
+            m_failed = true;
+        }
+        ++m_emitted;
+    }
+
+    // ページを投入する。窓が一杯なら、空くまで古いページを描画する。
+    void submit(std::string_view page)
+    {
+        if (m_threads.empty())
+        {
+            std::vector<std::string_view> rows = { page };
+            pdfplaca_layout_page(m_ctx, m_profile, rows, m_page_width, m_page_height,
+                                 m_printable_width, m_printable_height, m_margin, m_layout);
+            if (m_pattern)
+            {
+                if (!pdf_write_page_file(*m_ctx.m_job, *m_pattern, int(++m_submitted), m_page_width, m_page_height, m_layout))
+                    m_failed = true;
+                m_emitted = m_submitted;
+                return;
+            }
+            pdf_emit_page_layout(m_cr, m_layout);
+            cairo_show_page(m_cr);
+            return;
+        }
+
+        if (m_submitted - m_emitted == m_slots.size())
+            emit_one();
+
+        SLOT& slot = m_slots[m_submitted % m_slots.size()];
+        slot.m_text.assign(page.data(), page.size());
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        slot.m_ready = false;
+        ++m_submitted;
+        m_task_cond.notify_one();
+    }
+
+    // 残りのページを描画して、作業者を終わらせる。書き込めなかったページがあればfalseを返す。
+    bool finish()
+    {
+        while (m_emitted < m_submitted)
+            emit_one();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+            m_task_cond.notify_all();
+        }
+        for (auto& thread : m_threads)
+            thread.join();
+        m_threads.clear();
+
+        for (auto worker : m_ctx.m_layout_workers)
+            worker->m_job = nullptr;
+        return !m_failed;
+    }
+};
+
+// 1ページの文字数に制限があるとき、テキストを読みながらページを描画する。
+// patternがあれば、ページごとに別のPDFファイルに書き込む。
+// 完成したページはレイアウトの窓に投入して捨てるので、保持するのは窓の分と読み込み1回分だけ。
+// streamingなら、テキストを検証しながら読み、ページごとにフォントを確認する。
+// 最初のページでフォントが対応していなければ、*font_errorにエラーのテキストを返す。
+bool pdfplaca_draw_limited_pages(PLACARD_CONTEXT& ctx, cairo_t *cr, const PDF_FONT_PROFILE& profile, PDF_TEXT_SOURCE& source,
+                                 const PDF_PAGE_PATTERN *pattern, bool streaming, const char **font_error, int *num_pages,
+                                 double page_width, double page_height, double printable_width,
+                                 double printable_height, double margin)
+{
+    *font_error = nullptr;
+    *num_pages = 0;
+
+    U8_TEXT_NORMALIZER normalizer(true, source.m_unescape);
+    U8_SCRIPT_HISTOGRAM hist;
+    bool valid = true;
+    size_t scan = 0, page_chars = 0;
+    PDF_PAGE_PIPELINE pipeline(ctx, cr, profile, pattern, page_width, page_height, printable_width, printable_height, margin);
+
+    // 1ページを描画する。
+    auto draw_page = [&](std::string_view page) -> bool {
+        if (streaming)
+        {
+            if (const char *error = pdfplaca_get_font_error(profile, hist, page, page_width < page_height))
+            {
+                if (*num_pages == 0)
+                    *font_error = error;
+                else
+                    fprintf(stderr, "ERROR: The font does not support the text of page %d\n", *num_pages + 1);
+                return false;
+            }
+        }
+
+        // ページ番号を表示する。
+        ++*num_pages;
+        if (ctx.m_job->m_verbose)
+            fprintf(ctx.m_log, "Page %d\n", *num_pages);
+
+        // Lay out the page in parallel and draw it in order
+        pipeline.submit(page);
+        return true;
+    };
+
+    // 溜まったテキストから完成したページを描画して、描画した分を捨てる。
+    auto flush_pages = [&](bool final) -> bool {
+        std::string_view text = normalizer.m_text;
+        size_t start = 0;
+        while (scan < text.size())
+        {
+            // 1文字は1つの書記素クラスタ。
+            uint32_t u32;
+            size_t end = u8_grapheme_end(text, scan, &u32);
+            if (!end)
+                end = scan + 1;
+            if (end == text.size() && !final) // 次に読む部分に続くかもしれない。
+                break;
+            if (page_chars == size_t(ctx.m_job->m_letters_per_page))
+            {
+                if (!draw_page(text.substr(start, scan - start)))
+                    return false;
+                start = scan;
+                page_chars = 0;
+            }
+            ++page_chars;
+            scan = end;
+        }
+        if (final && page_chars)
+        {
+            if (!draw_page(text.substr(start)))
+                return false;
+            start = text.size();
+            page_chars = 0;
+        }
+        normalizer.discard(start);
+        scan -= start;
+        return true;
+    };
+
+    bool ok = source.read([&](std::string_view chunk) {
+        if (streaming)
+        {
+            if (!u8_is_valid(chunk))
+                return valid = false;
+            u8_script_histogram_add(hist, chunk);
+        }
+        normalizer.feed(chunk);
+        return flush_pages(false);
+    });
+    if (ok)
+    {
+        normalizer.finish();
+        ok = flush_pages(true);
+    }
+    if (!pipeline.finish())
+        ok = false;
+
+    if (!valid)
+        fprintf(stderr, "ERROR: Invalid UTF-8 text\n");
+    return ok;
+}
+
+// ジョブの看板を描画する。write_funcがnullptrならジョブの出力ファイルに、でなければwrite_funcに書き込む。
+bool pdfplaca_render_to(PLACARD_CONTEXT& ctx, const PLACARD_JOB& job, cairo_write_func_t write_func, void *closure)
+{
+    ctx.m_job = &job;
+    ctx.m_vertical = job.m_vertical;
+    ctx.m_y_adjust = -pt_from_mm(job.m_y_adjust);
+    ctx.m_log = (!write_func && pdf_is_stdout(job.m_out_file.c_str())) ? stderr : stdout;
+    bool verbose = job.m_verbose;
+
+    // Get page size in points
+    double page_width = pt_from_mm(job.m_page_width), page_height = pt_from_mm(job.m_page_height);
+    if (verbose)
+        fprintf(ctx.m_log, "page_width: %f pt, page_height: %f pt\n", page_width, page_height);
+
+    // Swap width and height if orientation doesn't match
+    if (job.m_portrait)
+    {
+        if (page_width > page_height)
+            std::swap(page_width, page_height);
+    }
+    else
+    {
+        if (page_width < page_height)
+            std::swap(page_width, page_height);
+    }
+
+    // Get margin in points
+    double margin = pt_from_mm(job.m_margin);
+
+    // Get printable area in points
+    double printable_width = page_width - 2 * margin;
+    double printable_height = page_height - 2 * margin;
+
+    // Open the text source
+    PDF_TEXT_SOURCE source;
+    if (job.m_text_file.size() ? !source.open_file(job.m_text_file.c_str()) : !source.open_text(job.m_text.c_str()))
+    {
+        fprintf(stderr, "ERROR: Cannot read text\n");
+        return false;
+    }
+
+    // 1ページの文字数に制限があって標準入力から読むときは、読みながら検証して描画する。
+    // それ以外は、先にテキスト全体を一度に検証して分類する。制限がなければ、
+    // 全部の行を1ページに描画するので、同時に正規化（エスケープの解除、改行、タブ）もする。
+    bool one_page = (job.m_letters_per_page == -1);
+    bool streaming = (!one_page && source.m_stdin);
+    U8_SCRIPT_HISTOGRAM hist;
+    U8_TEXT_NORMALIZER normalizer(false, source.m_unescape);
+    if (!streaming)
+    {
+        if (one_page)
+            normalizer.reserve(source.size_hint());
+        bool valid = true;
+        bool read = source.read([&](std::string_view chunk) {
+            if (!u8_is_valid(chunk))
+                return valid = false;
+            u8_script_histogram_add(hist, chunk);
+            if (one_page)
+                normalizer.feed(chunk);
+            return true;
+        });
+        normalizer.finish();
+        if (one_page)
+            source.close();
+        if (!valid)
+        {
+            fprintf(stderr, "ERROR: Invalid UTF-8 text\n");
+            return false;
+        }
+        if (!read)
+        {
+            fprintf(stderr, "ERROR: Cannot read text\n");
+            return false;
+        }
+    }
+
+    // Initialize Cairo. For a page pattern, each page gets its own PDF and there is no shared surface.
+    PDF_PAGE_PATTERN page_pattern;
+    const PDF_PAGE_PATTERN *pattern = nullptr;
+    if (!write_func && pdf_parse_page_pattern(job.m_out_file, page_pattern))
+        pattern = &page_pattern;
+    cairo_surface_t *surface = nullptr;
+    cairo_t *cr = nullptr;
+    if (!pattern)
+    {
+        surface = pdf_create_surface(job, job.m_out_file.c_str(), write_func, closure, page_width, page_height);
+        if (!surface)
+        {
+            _ftprintf(stderr, _T("ERROR: Cannot open '%s'\n"), job.m_out_file.c_str());
+            ctx.m_job = nullptr;
+            return false;
+        }
+        cr = cairo_create(surface);
+    }
+
+    // Choose font and font size
+    const _TCHAR *font_name = job.m_font_name.size() ? job.m_font_name.c_str() : pdfplaca_get_default_font();
+#ifdef UNICODE
+    std::string utf8_font_name = ansi_from_wide(font_name, CP_UTF8);
+#else
+    std::string utf8_font_name = font_name;
+#endif
+    cairo_font_face_t *face = pdf_select_font(ctx, utf8_font_name.c_str());
+
+    // Get the font profile (cached per context)
+    const PDF_FONT_PROFILE *profile = &pdf_get_font_profile(ctx, face);
+
+    // Display error if text is CJK and font is not CJK
+    const char *error_text = nullptr;
+    if (!streaming)
+    {
+        std::string_view text = one_page ? std::string_view(normalizer.m_text) : source.m_view;
+        error_text = pdfplaca_get_font_error(*profile, hist, text, page_width < page_height);
+    }
+    if (error_text)
+        profile = pdfplaca_select_error_font(ctx);
+
+    // フォントの種類を表示する。
+    if (verbose)
+        fprintf(ctx.m_log, profile->m_fixed_pitch ? "fixed-pitch font\n" : "proportional font\n");
+
+    if (0 && cr) // 必要ならば、ちょっとしたテストを行う。
+    {
+        cairo_move_to(cr, 150, 100);
+        cairo_line_to(cr, 150, 200);
+        cairo_move_to(cr, 100, 150);
+        cairo_line_to(cr, 200, 150);
+        cairo_set_source_rgb(cr, 1, 0, 0);
+        cairo_stroke(cr);
+
+        auto text = u8"あ";
+        cairo_set_font_face(cr, profile->m_face);
+        cairo_set_font_size(cr, 30);
+
+        cairo_text_extents_t extents;
+        cairo_text_extents(cr, text, &extents);
+
+        cairo_font_extents_t font_extents;
+        cairo_font_extents(cr, &font_extents);
+
+        double scale_x = 2, scale_y = 3;
+
+        double x = 150, y = 150;
+        cairo_matrix_t matrix;
+#if 0 // -90度回転かつ上下反転
+        cairo_matrix_init(&matrix,
+            0, scale_y, scale_x, 0,
+            x + (font_extents.height - extents.x_bearing) * scale_x,
+            y - font_extents.height * scale_y);
+#elif 0 // +90度回転
+        cairo_matrix_init(&matrix,
+            0, scale_y, -scale_x, 0,
+            x + extents.x_bearing * scale_x,
+            y - font_extents.height * scale_y);
+#else // 移動なし
+        cairo_matrix_init(&matrix,
+            scale_x, 0, 0, scale_y,
+            x, y - font_extents.descent * scale_y);
+#endif
+        cairo_set_matrix(cr, &matrix);
+        cairo_set_source_rgb(cr, 0, 0, 0);
+        cairo_move_to(cr, 0, 0);
+        cairo_show_text(cr, text);
+    }
+    else if (job.m_letters_per_page == -1) // 1ページの文字数に制限がない？
+    {
+        // ページ番号を表示する。
+        if (verbose)
+            fprintf(ctx.m_log, "Page %d\n", 1);
+
+        if (error_text)
+        {
+            normalizer = U8_TEXT_NORMALIZER();
+            normalizer.feed(error_text);
+            normalizer.finish();
+        }
+
+        // Split rows
+        std::vector<std::string_view> rows;
+        normalizer.get_rows(rows);
+
+        // Draw page (one page only)
+        PDF_PAGE_LAYOUT layout;
+        pdfplaca_layout_page(ctx, *profile, rows, page_width, page_height, printable_width, printable_height, margin, layout);
+        if (pattern)
+        {
+            if (!pdf_write_page_file(job, *pattern, 1, page_width, page_height, layout))
+            {
+                cairo_destroy(cr);
+                cairo_surface_destroy(surface);
+                ctx.m_job = nullptr;
+                return false;
+            }
+        }
+        else
+        {
+            pdf_emit_page_layout(cr, layout);
+
+            // New page
+            cairo_show_page(cr);
+        }
+    }
+    else if (job.m_letters_per_page > 0) // 制限がある？
+    {
+        // Draw pages while reading the text
+        if (error_text)
+            source.open_utf8(error_text);
+        int num_pages;
+        bool ok = pdfplaca_draw_limited_pages(ctx, cr, *profile, source, pattern, streaming, &error_text, &num_pages,
+                                              page_width, page_height, printable_width, printable_height, margin);
+        if (!ok && error_text) // 最初のページでフォントが対応していなかった？
+        {
+            profile = pdfplaca_select_error_font(ctx);
+            source.open_utf8(error_text);
+            ok = pdfplaca_draw_limited_pages(ctx, cr, *profile, source, pattern, false, &error_text, &num_pages,
+                                             page_width, page_height, printable_width, printable_height, margin);
+        }
+
+        if (!ok)
+        {
+            cairo_destroy(cr);
+            cairo_surface_destroy(surface);
+            ctx.m_job = nullptr;
+            return false;
+        }
+    }
+
+    // スケーリング済みフォントのキャッシュのヒット率を表示する。
+    if (verbose)
+    {
+        auto& cache = ctx.m_scaled_font_cache;
+        size_t total = cache.m_hits + cache.m_misses;
+        fprintf(ctx.m_log, "scaled font cache: %d hits, %d misses (hit rate %.1f%%)\n",
+               int(cache.m_hits), int(cache.m_misses), total ? cache.m_hits * 100.0 / total : 0.0);
+    }
+
+    // Clean up. The caches are kept in the context for the next job.
+    cairo_destroy(cr);
+    bool ok = pattern || pdf_finish_surface(surface);
+    cairo_surface_destroy(surface);
+    ctx.m_job = nullptr;
+
+    if (!ok)
+    {
+        if (write_func)
+            fprintf(stderr, "ERROR: Cannot write PDF\n");
+        else
+            _ftprintf(stderr, _T("ERROR: Cannot write '%s'\n"), job.m_out_file.c_str());
+    }
+    return ok;
+}
+
+// 描画の文脈を作成する。
+PLACARD_CONTEXT *pdfplaca_create_context(void)
+{
+    return new PLACARD_CONTEXT();
+}
+
+// 描画の文脈を破棄する。
+void pdfplaca_destroy_context(PLACARD_CONTEXT *ctx)
+{
+    if (!ctx)
+        return;
+    for (auto worker : ctx->m_layout_workers)
+        pdfplaca_destroy_context(worker);
+    pdf_clear_metrics_caches(*ctx);
+    pdf_clear_scaled_font_cache(*ctx);
+    pdf_clear_font_faces(*ctx);
+    delete ctx;
+}
+
+// ジョブの看板のPDFを作成する。
+bool pdfplaca_render(PLACARD_CONTEXT *ctx, const PLACARD_JOB& job)
+{
+    return pdfplaca_render_to(*ctx, job, nullptr, nullptr);
+}
+
+// ジョブの看板のPDFをwrite_funcに書き込む。ジョブの出力ファイルは使わない。
+bool pdfplaca_render_to_stream(PLACARD_CONTEXT *ctx, const PLACARD_JOB& job, cairo_write_func_t write_func, void *closure)
+{
+    return pdfplaca_render_to(*ctx, job, write_func, closure);
+}
+
+// ジョブの看板のPDFをメモリーに作成する。ジョブの出力ファイルは使わない。
+bool pdfplaca_render_to_memory(PLACARD_CONTEXT *ctx, const PLACARD_JOB& job, std::string& pdf)
+{
+    pdf.clear(); // 確保済みの容量は次のジョブでも使う。
+    return pdfplaca_render_to(*ctx, job, pdfplaca_write_to_string, &pdf);
+}
+
+// 自己テストの条件を確かめる。成り立たなければ表示して、okをfalseにする。
+#define PDF_SELF_CHECK(ok, cond) pdf_self_check((ok), (cond), #cond, __LINE__)
+
+void pdf_self_check(bool& ok, bool cond, const char *expr, int line)
+{
+    if (cond)
+        return;
+    fprintf(stderr, "FAILED: %s (libpdfplaca.cpp:%d)\n", expr, line);
+    ok = false;
+}
+
+// 行の作業領域の自己テスト。一度描画して作業領域とキャッシュが温まった後は、
+// 短い行や同じ行を描画しても作業領域を確保し直さず、キャッシュも増えない（文字や書記素クラスタごとに確保しない）。
+void pdf_row_buffer_self_test(bool& ok)
+{
+    PLACARD_JOB job;
+    job.m_verbose = false;
+    PLACARD_CONTEXT *ctx = pdfplaca_create_context();
+    ctx->m_job = &job;
+#ifdef UNICODE
+    cairo_font_face_t *face = pdf_select_font(*ctx, ansi_from_wide(pdfplaca_get_default_font(), CP_UTF8).c_str());
+#else
+    cairo_font_face_t *face = pdf_select_font(*ctx, pdfplaca_get_default_font());
+#endif
+    const PDF_FONT_PROFILE& profile = pdf_get_font_profile(*ctx, face);
+    const PDF_METRICS_CACHE& metrics = pdf_get_metrics_cache(*ctx, face);
+
+    PDF_PAGE_LAYOUT layout;
+    ctx->m_layout = &layout;
+    auto draw = [&](std::string_view text, int mode) {
+        layout.m_items.clear();
+        if (mode == 0)
+            pdf_draw_h_text(*ctx, profile, text, 20, 20, 800, 200, 1.5);
+        else if (mode == 1)
+            pdf_draw_v_text(*ctx, profile, text, 20, 20, 200, 550, 1.5);
+        else
+            pdf_draw_v_text_fixed(*ctx, profile, text, 20, 20, 200, 550, 1.5);
+    };
+    // 作業領域の先頭アドレスとキャッシュの大きさ。確保し直せば変わる。
+    auto snapshot = [&] {
+        return std::vector<uintptr_t>{
+            uintptr_t(ctx->m_row_text.data()), uintptr_t(ctx->m_row_chars.data()), uintptr_t(ctx->m_row_classes.data()),
+            uintptr_t(ctx->m_row_glyphs.m_glyphs.data()), uintptr_t(ctx->m_row_glyphs.m_char_first.data()),
+            uintptr_t(ctx->m_row_advances.data()), uintptr_t(ctx->m_row_runs.data()),
+            metrics.m_char_extents.size(), metrics.m_cluster_keys.size(),
+        };
+    };
+    // 家族の絵文字は長い書記素クラスタ（短い文字列の最適化に収まらない）。
+    const char *piece = u8"看板ABC\U0001F468\u200D\U0001F469\u200D\U0001F467";
+    std::string long_row;
+    for (int i = 0; i < 10; ++i)
+        long_row += piece;
+    for (int mode = 0; mode < 3; ++mode)
+    {
+        // 長い行を先に描画して、作業領域を広げておく。
+        draw(long_row, mode);
+        PDF_SELF_CHECK(ok, ctx->m_row_chars.capacity() && ctx->m_row_glyphs.m_glyphs.capacity() && ctx->m_row_runs.capacity());
+        auto warm = snapshot();
+        draw(piece, mode);
+        PDF_SELF_CHECK(ok, snapshot() == warm);
+        draw(long_row, mode);
+        PDF_SELF_CHECK(ok, snapshot() == warm);
+    }
+
+    ctx->m_layout = nullptr;
+    pdfplaca_destroy_context(ctx);
+}
+
+// 文字列の変換の自己テスト。基本多言語面の外の文字を含む1024文字を超える文字列を、
+// 複数のスレッドで同時にUTF-8とワイド文字列の間で往復させる。切り捨てられず、元に戻るはず。
+void pdf_string_conversion_self_test(bool& ok)
+{
+    static const char *const s_pieces[] = { "A", u8"é", u8"看", u8"板", u8"\U0001F600", u8"\U00020BB7", " " };
+    const int num_threads = 8;
+    std::vector<char> results(num_threads, 0);
+    std::vector<std::thread> threads;
+    for (int iThread = 0; iThread < num_threads; ++iThread)
+    {
+        threads.emplace_back([&, iThread]() {
+            // スレッドごとに長さと並びの違う文字列を作る。
+            std::string utf8;
+            size_t num_chars = 0, num_astral = 0;
+            for (size_t i = 0; num_chars < 1025 + 517 * size_t(iThread); ++i, ++num_chars)
+            {
+                size_t iPiece = (i * (iThread + 3)) % _countof(s_pieces);
+                utf8 += s_pieces[iPiece];
+                if (iPiece == 4 || iPiece == 5)
+                    ++num_astral;
+            }
+            size_t expected_len = num_chars + (sizeof(wchar_t) == 2 ? num_astral : 0); // UTF-16ならサロゲートペア
+
+            bool same = true;
+            std::wstring wide;
+            std::string ansi;
+            for (int repeat = 0; repeat < 50 && same; ++repeat)
+            {
+                same = wide_from_ansi(wide, utf8.data(), utf8.size(), CP_UTF8) && wide.size() == expected_len &&
+                       ansi_from_wide(ansi, wide.data(), wide.size(), CP_UTF8) && ansi == utf8 &&
+                       ansi_from_wide(wide.c_str(), CP_UTF8) == utf8 && wide_from_ansi(utf8.c_str(), CP_UTF8) == wide;
+            }
+            results[iThread] = same;
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    for (int iThread = 0; iThread < num_threads; ++iThread)
+        PDF_SELF_CHECK(ok, results[iThread]);
+}
+
+// 描画の自己テスト。異なるジョブを複数のスレッドで描画して、バイトごとに比べる。
+void pdfplaca_render_self_test(bool& ok)
+{
+    // 設定の異なるジョブ。
+    PLACARD_JOB jobs[4];
+    jobs[0].m_text = _T("This is\na test.");
+    jobs[1].m_text = _T("Vertical\ntext");
+    jobs[1].m_vertical = true;
+    jobs[2].m_text = _T("Three letters per page");
+    jobs[2].m_letters_per_page = 3;
+    jobs[2].m_portrait = true;
+    jobs[3].m_text = _T("Wrap this text automatically to enlarge it");
+    jobs[3].m_auto_wrap = true;
+    jobs[3].m_text_color = 0xFFFFFF;
+    jobs[3].m_back_color = 0x000080;
+    for (auto& job : jobs)
+    {
+        job.m_create_date = "2000-01-01T00:00:00";
+        job.m_verbose = false;
+    }
+
+    // 一つのスレッドで順に描画する。
+    std::string expected[_countof(jobs)];
+    {
+        PLACARD_CONTEXT *ctx = pdfplaca_create_context();
+        for (size_t iJob = 0; iJob < _countof(jobs); ++iJob)
+        {
+            bool rendered = pdfplaca_render_to(*ctx, jobs[iJob], pdfplaca_write_to_string, &expected[iJob]);
+            PDF_SELF_CHECK(ok, rendered && expected[iJob].size());
+        }
+        pdfplaca_destroy_context(ctx);
+    }
+
+    // 複数のスレッドで同時に描画して、バイトごとに比べる。
+    const size_t num_threads = 2 * _countof(jobs);
+    std::vector<std::string> results(num_threads);
+    std::vector<std::thread> threads;
+    for (size_t iThread = 0; iThread < num_threads; ++iThread)
+    {
+        threads.emplace_back([&, iThread]() {
+            PLACARD_CONTEXT *ctx = pdfplaca_create_context();
+            pdfplaca_render_to(*ctx, jobs[iThread % _countof(jobs)], pdfplaca_write_to_string, &results[iThread]);
+            pdfplaca_destroy_context(ctx);
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    for (size_t iThread = 0; iThread < num_threads; ++iThread)
+        PDF_SELF_CHECK(ok, results[iThread] == expected[iThread % _countof(jobs)]);
+
+    // ページのレイアウトを並列に求めても、順に求めたものとバイトごとに同じ。
+    PLACARD_JOB paged = jobs[2];
+    paged.m_text = _T("Lay out many pages in parallel and emit them in order.");
+    std::string serial, parallel;
+    {
+        PLACARD_CONTEXT *ctx = pdfplaca_create_context();
+        pdfplaca_render_to(*ctx, paged, pdfplaca_write_to_string, &serial);
+        paged.m_layout_threads = 4;
+        pdfplaca_render_to(*ctx, paged, pdfplaca_write_to_string, &parallel);
+        pdfplaca_destroy_context(ctx);
+    }
+    PDF_SELF_CHECK(ok, serial.size() && parallel == serial);
+}
+
+#ifdef PDFPLACA_USE_HARFBUZZ
+
+// HarfBuzzによる整形の自己テスト。整形済みのグリフが文字に漏れなく割り当てられ、
+// キャッシュが最近使ったものを残し、描画が複数のスレッドで同じになることを確かめる。
+void pdf_shaped_self_test(bool& ok)
+{
+    PLACARD_JOB job;
+    job.m_verbose = false;
+    PLACARD_CONTEXT *ctx = pdfplaca_create_context();
+    ctx->m_job = &job;
+#ifdef UNICODE
+    cairo_font_face_t *face = pdf_select_font(*ctx, ansi_from_wide(pdfplaca_get_default_font(), CP_UTF8).c_str());
+#else
+    cairo_font_face_t *face = pdf_select_font(*ctx, pdfplaca_get_default_font());
+#endif
+
+    // 合字になりうる並び、結合文字、漢字を含む行。
+    std::string_view text = u8"fie\u0301 office 看板";
+    U8_CHARS chars;
+    u8_split_chars(chars, text);
+    for (int vertical = 0; vertical < 2; ++vertical)
+    {
+        const PDF_SHAPED_TEXT *shaped = pdf_shape_text(*ctx, face, text, vertical != 0);
+        PDF_SELF_CHECK(ok, shaped && shaped->m_glyphs.size() && shaped->m_advance > 0);
+        if (!shaped)
+            continue;
+        if (vertical)
+            PDF_SELF_CHECK(ok, shaped->m_column_width > 0);
+
+        // クラスタは単調に増え、テキストの中を指す。
+        bool monotone = true;
+        for (size_t iGlyph = 0; iGlyph < shaped->m_glyphs.size(); ++iGlyph)
+        {
+            uint32_t cluster = shaped->m_glyphs[iGlyph].m_cluster;
+            if (cluster >= text.size() || (iGlyph && cluster < shaped->m_glyphs[iGlyph - 1].m_cluster))
+                monotone = false;
+        }
+        PDF_SELF_CHECK(ok, monotone);
+
+        // すべてのグリフがどれかの文字に割り当てられ、送り幅の合計は変わらない。
+        PDF_ROW_GLYPHS row;
+        std::vector<double> advances;
+        pdf_shaped_to_glyphs(*shaped, text, chars, vertical != 0, 10, row, advances);
+        double total = 0;
+        for (double advance : advances)
+            total += advance;
+        PDF_SELF_CHECK(ok, row.m_char_first.size() == chars.size() + 1 && row.m_char_first[0] == 0);
+        PDF_SELF_CHECK(ok, std::is_sorted(row.m_char_first.begin(), row.m_char_first.end()));
+        PDF_SELF_CHECK(ok, std::fabs(total - shaped->m_advance) < 1e-9);
+    }
+
+    // 最近使ったテキストは、キャッシュがいっぱいになっても残る。
+    auto& cache = ctx->m_hb_faces[face].m_shaped[0];
+    const PDF_SHAPED_TEXT *kept = pdf_shape_text(*ctx, face, text, false);
+    for (int i = 0; i < PDF_SHAPED_TEXT_CACHE_SIZE; ++i)
+    {
+        if (i == PDF_SHAPED_TEXT_CACHE_SIZE / 2)
+            PDF_SELF_CHECK(ok, pdf_shape_text(*ctx, face, text, false) == kept);
+        pdf_shape_text(*ctx, face, "row " + std::to_string(i), false);
+    }
+    PDF_SELF_CHECK(ok, cache.m_entries.size() == PDF_SHAPED_TEXT_CACHE_SIZE);
+    PDF_SELF_CHECK(ok, cache.m_index.size() == cache.m_entries.size());
+    PDF_SELF_CHECK(ok, cache.m_index.count(text) == 1 && cache.m_index.count("row 0") == 0);
+    PDF_SELF_CHECK(ok, pdf_shape_text(*ctx, face, text, false) == kept);
+
+    pdfplaca_destroy_context(ctx);
+
+    // 整形して描画した横書きと縦書きのジョブを、複数のスレッドで描画して比べる。
+    PLACARD_JOB jobs[2];
+    jobs[0].m_text = _T("office fie\u0301\n看板");
+    jobs[1].m_text = jobs[0].m_text;
+    jobs[1].m_vertical = true;
+    for (auto& shaped_job : jobs)
+    {
+        shaped_job.m_create_date = "2000-01-01T00:00:00";
+        shaped_job.m_verbose = false;
+    }
+    const size_t num_threads = 2 * _countof(jobs);
+    std::vector<std::string> results(num_threads);
+    std::vector<std::thread> threads;
+    for (size_t iThread = 0; iThread < num_threads; ++iThread)
+    {
+        threads.emplace_back([&, iThread]() {
+            PLACARD_CONTEXT *ctx = pdfplaca_create_context();
+            pdfplaca_render_to(*ctx, jobs[iThread % _countof(jobs)], pdfplaca_write_to_string, &results[iThread]);
+            pdfplaca_destroy_context(ctx);
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    for (size_t iThread = 0; iThread < num_threads; ++iThread)
+        PDF_SELF_CHECK(ok, results[iThread].size() && results[iThread] == results[iThread % _countof(jobs)]);
+}
+
+#endif // def PDFPLACA_USE_HARFBUZZ
+
+// ライブラリの単体テスト（デバッグ版のみ）。
+void pdfplaca_unittest(void)
+{
+    u8_is_japanese_text_unittest();
+    u8_split_chars_unittest();
+    pdf_solve_text_fit_unittest();
+    pdf_wrap_solver_unittest();
+    pdf_page_pattern_unittest();
+    u8_to_fullwidth_unittest();
+    u8_text_normalizer_unittest();
+    pdf_parse_cmap_unittest();
+}
+
+// 自己テスト。実際にジョブを描画するので時間がかかる。リリース版でも動く。
+bool pdfplaca_self_test(void)
+{
+    bool ok = true;
+    pdf_row_buffer_self_test(ok);
+    pdf_string_conversion_self_test(ok);
+    pdfplaca_render_self_test(ok);
+#ifdef PDFPLACA_USE_HARFBUZZ
+    pdf_shaped_self_test(ok);
+#endif
+    return ok;
+}
+
+// ベンチマークの開始からの経過時間(秒)。
+static double pdf_bench_seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// フォントサイズの解法のベンチマーク。以前の1.1倍・1.05倍の反復と、行を測る回数と時間を比べる。
+void pdf_bench_fit(void)
+{
+    // A4横の印刷可能領域に、1文字から80文字までの行を1行から10行まで並べる。
+    struct FIT_CASE
+    {
+        double text_width, text_height, width, height, fill_ratio, growth;
+    };
+    const double printable_width = 841.9 - 2 * 22.7, printable_height = 595.3 - 2 * 22.7;
+    std::vector<FIT_CASE> cases;
+    for (int len = 1; len <= 80; ++len)
+    {
+        for (int rows = 1; rows <= 10; ++rows)
+        {
+            cases.push_back({ 0.55 * len, 1.2, printable_width, printable_height / rows, 0.9, 1.1 });     // 横書き
+            cases.push_back({ 1.0, 1.05 * len, printable_width / rows, printable_height, 0.95, 1.05 });  // 縦書き
+        }
+    }
+
+    // 測る回数と、解の違いを比べる。反復は10ptから大きくするだけなので、
+    // 10ptでもはみ出す行は小さくできない。その行は違いに含めずに数える。
+    size_t total_passes = 0;
+    int max_passes = 0, num_overflows = 0;
+    double max_diff = 0;
+    for (auto& c : cases)
+    {
+        double font_size0, scale_x0, scale_y0, font_size1, scale_x1, scale_y1;
+        int iterations = pdf_fit_text_by_loop(c.text_width, c.text_height, c.width, c.height, c.fill_ratio, c.growth,
+                                              1.5, font_size0, scale_x0, scale_y0);
+        pdf_solve_text_fit(c.text_width, c.text_height, c.width, c.height, c.fill_ratio, 1.5,
+                           font_size1, scale_x1, scale_y1);
+        total_passes += iterations + 1;
+        max_passes = std::max(max_passes, iterations + 1);
+        if (font_size1 < 10)
+            ++num_overflows;
+        else
+            max_diff = std::max(max_diff, std::fabs(font_size0 / font_size1 - 1));
+    }
+
+    // 時間を比べる（行を測る時間は含まない）。
+    const int repeat = 200;
+    double sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeat; ++i)
+    {
+        for (auto& c : cases)
+        {
+            double font_size, scale_x, scale_y;
+            pdf_fit_text_by_loop(c.text_width, c.text_height, c.width, c.height, c.fill_ratio, c.growth,
+                                 1.5, font_size, scale_x, scale_y);
+            sink += font_size;
+        }
+    }
+    double loop_seconds = pdf_bench_seconds(start);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeat; ++i)
+    {
+        for (auto& c : cases)
+        {
+            double font_size, scale_x, scale_y;
+            pdf_solve_text_fit(c.text_width, c.text_height, c.width, c.height, c.fill_ratio, 1.5,
+                               font_size, scale_x, scale_y);
+            sink += font_size;
+        }
+    }
+    double solve_seconds = pdf_bench_seconds(start);
+
+    size_t num_solves = cases.size() * repeat;
+    printf("fit: %d rows, loop %.1f measurement passes/row (max %d), solver 1 pass/row\n",
+           int(cases.size()), double(total_passes) / cases.size(), max_passes);
+    printf("fit: loop %.1f ns/row, solver %.1f ns/row (checksum %g)\n",
+           loop_seconds * 1e9 / num_solves, solve_seconds * 1e9 / num_solves, sink);
+    printf("fit: max font size difference %.1f%%, %d rows overflow with the loop (below 10pt)\n",
+           max_diff * 100, num_overflows);
+}
+
+// UTF-8のデコードのベンチマーク。欧文・和文・混在の文章で、1文字ずつとまとめての処理の速さを比べる。
+void pdf_bench_utf8(void)
+{
+    // 決まった乱数で、それぞれ約8MBの文章を作る。
+    static const char *const s_latin[] = { "e", "t", "a", "o", "n", " ", "s", "r", ",", u8"é", u8"ü", u8"ß", u8"ç" };
+    static const char *const s_japanese[] = { u8"の", u8"に", u8"は", u8"を", u8"た", u8"東", u8"京", u8"都", u8"様", u8"、", u8"。", u8"ー" };
+    static const char *const s_mixed[] = { "A", "1", "-", " ", u8"山", u8"田", u8"〒", u8"号", u8"ｱ", u8"é", u8"\U0001F600" };
+    struct CORPUS
+    {
+        const char *m_name;
+        const char *const *m_words;
+        size_t m_num_words;
+        int m_ascii_percent; // ASCIIの英字の割合
+    } corpora[] =
+    {
+        { "latin", s_latin, _countof(s_latin), 90 },
+        { "japanese", s_japanese, _countof(s_japanese), 5 },
+        { "mixed", s_mixed, _countof(s_mixed), 50 },
+    };
+
+    const size_t corpus_size = 8 * 1024 * 1024;
+    for (auto& corpus : corpora)
+    {
+        std::string text;
+        text.reserve(corpus_size + 8);
+        uint32_t seed = 12345;
+        while (text.size() < corpus_size)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint32_t r = seed >> 8;
+            if (int(r % 100) < corpus.m_ascii_percent)
+                text += char('a' + (r >> 8) % 26);
+            else
+                text += corpus.m_words[(r >> 8) % corpus.m_num_words];
+        }
+
+        // 1文字ずつ検証する。
+        auto start = std::chrono::steady_clock::now();
+        size_t num_chars = 0;
+        for (size_t ich = 0; ich < text.size(); ++num_chars)
+        {
+            uint32_t u32;
+            int skip = u8_decode_one(&text[ich], text.size() - ich, &u32);
+            if (!skip)
+                break;
+            ich += skip;
+        }
+        double scalar_validate = pdf_bench_seconds(start);
+
+        // まとめて検証する。
+        start = std::chrono::steady_clock::now();
+        bool valid = u8_is_valid(text);
+        double bulk_validate = pdf_bench_seconds(start);
+
+        // コードポイントと境界をまとめて取り出す。
+        uint32_t u32s[U8_DECODE_BLOCK + 1], offsets[U8_DECODE_BLOCK + 1];
+        double decode_seconds[2];
+        size_t sums[2];
+        for (int i = 0; i < 2; ++i)
+        {
+            start = std::chrono::steady_clock::now();
+            sums[i] = 0;
+            for (size_t ich = 0; ich < text.size(); )
+            {
+                size_t count = i ? u8_decode(&text[ich], text.size() - ich, u32s, offsets, U8_DECODE_BLOCK)
+                                 : u8_decode_scalar(&text[ich], text.size() - ich, u32s, offsets, U8_DECODE_BLOCK);
+                if (!count)
+                    break;
+                for (size_t k = 0; k < count; ++k)
+                    sums[i] += u32s[k];
+                ich += offsets[count];
+            }
+            decode_seconds[i] = pdf_bench_seconds(start);
+        }
+
+        // 文字に区切る。
+        U8_CHARS chars;
+        double split_seconds[2];
+        size_t num_graphemes[2];
+        for (int i = 0; i < 2; ++i)
+        {
+            start = std::chrono::steady_clock::now();
+            if (i)
+                u8_split_chars(chars, text);
+            else
+                u8_split_chars(chars, text, u8_decode_scalar);
+            split_seconds[i] = pdf_bench_seconds(start);
+            num_graphemes[i] = chars.size();
+        }
+
+        double mb = text.size() / (1024.0 * 1024.0);
+        printf("utf8: %s: %.1f MB, %d chars, %d graphemes%s\n", corpus.m_name, mb, int(num_chars),
+               int(num_graphemes[1]), (valid && sums[0] == sums[1] && num_graphemes[0] == num_graphemes[1]) ? "" : " (MISMATCH)");
+        printf("utf8: %s: validate %.0f MB/s per char, %.0f MB/s bulk\n", corpus.m_name,
+               mb / scalar_validate, mb / bulk_validate);
+        printf("utf8: %s: decode %.0f MB/s per char, %.0f MB/s bulk\n", corpus.m_name,
+               mb / decode_seconds[0], mb / decode_seconds[1]);
+        printf("utf8: %s: split %.0f MB/s per char, %.0f MB/s bulk\n", corpus.m_name,
+               mb / split_seconds[0], mb / split_seconds[1]);
+    }
+}
+
+// テキストの正規化のベンチマーク。1MBから10MBまでの入力で、時間が大きさに比例するかを確かめる。
+void pdf_bench_normalize(void)
+{
+    // エスケープ、CRLF、タブ、和文を含む行を決まった乱数で並べる。
+    static const char *const s_pieces[] =
+    {
+        "Hello, World", u8"山田太郎様", "\\n", "\r\n", "\t", "\\t", "  ", u8"東京都千代田区", "\\\\", "\r", "\n",
+    };
+    const size_t max_size = 10 * 1024 * 1024;
+    std::string input;
+    input.reserve(max_size + 64);
+    uint32_t seed = 12345;
+    while (input.size() < max_size)
+    {
+        seed = seed * 1103515245 + 12345;
+        input += s_pieces[(seed >> 8) % _countof(s_pieces)];
+    }
+
+    static const size_t s_sizes[] = { 1, 2, 5, 10 };
+    double base = 0;
+    for (size_t mb : s_sizes)
+    {
+        std::string_view text(input.data(), mb * 1024 * 1024);
+
+        // 最も速い回を採る。入力は64KBずつ与える。
+        double best = 0;
+        size_t num_rows = 0;
+        for (int repeat = 0; repeat < 3; ++repeat)
+        {
+            auto start = std::chrono::steady_clock::now();
+            U8_TEXT_NORMALIZER normalizer;
+            normalizer.reserve(text.size());
+            for (size_t ich = 0; ich < text.size(); ich += 64 * 1024)
+                normalizer.feed(text.substr(ich, 64 * 1024));
+            normalizer.finish();
+            double seconds = pdf_bench_seconds(start);
+            if (!repeat || seconds < best)
+                best = seconds;
+            num_rows = normalizer.m_row_ends.size() + 1;
+        }
+        if (!base)
+            base = best / mb;
+        printf("normalize: %2d MB, %d rows, %.1f ms, %.2f ns/byte, %.2fx the 1 MB time per byte\n",
+               int(mb), int(num_rows), best * 1e3, best * 1e9 / text.size(), best / mb / base);
+    }
+}
+
+// プロセスの現在のワーキングセット(MB)。取得できなければ0。
+static double pdf_bench_working_set(void)
+{
+    PROCESS_MEMORY_COUNTERS counters = { };
+    counters.cb = sizeof(counters);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.WorkingSetSize / (1024.0 * 1024.0);
+}
+
+// fnを実行する間のワーキングセットの増加の最大(MB)。実行前の値を基準に、別のスレッドで1msごとに調べる。
+// PeakWorkingSetSizeはプロセス全体のピークで、--bench allで先に実行したベンチマークの分を含むので使わない。
+template <typename T_FN>
+static double pdf_bench_memory_growth(T_FN fn)
+{
+    double base = pdf_bench_working_set(), peak = base;
+    std::atomic<bool> done(false);
+    std::thread sampler([&] {
+        while (!done)
+        {
+            peak = std::max(peak, pdf_bench_working_set());
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    fn();
+    done = true;
+    sampler.join();
+    peak = std::max(peak, pdf_bench_working_set());
+    return peak - base;
+}
+
+// 書き込まれたバイト数を数えるだけの出力関数。closureはsize_t*。
+static cairo_status_t pdf_bench_write_count(void *closure, const unsigned char *data, unsigned int length)
+{
+    *reinterpret_cast<size_t *>(closure) += length;
+    return CAIRO_STATUS_SUCCESS;
+}
+
+// --letters-per-pageのテキストを作る。num_pagesページ分の文字を決まった乱数で並べる。
+static std::basic_string<_TCHAR> pdf_bench_paged_text(int num_pages, int letters_per_page)
+{
+    static const _TCHAR s_letters[] = _T("看板印刷東京都千代田区ABCDEFGHxyz0123456789");
+    std::basic_string<_TCHAR> text;
+    text.reserve(size_t(num_pages) * letters_per_page);
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < size_t(num_pages) * letters_per_page; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        text += s_letters[(seed >> 8) % (_countof(s_letters) - 1)];
+    }
+    return text;
+}
+
+// ページ分割のベンチマーク。1000ページと10000ページを描画して、ページの描画速度と
+// 描画の間のメモリ使用量の増加を比べる。ページ数が増えてもメモリ使用量はほとんど増えないはず。
+void pdf_bench_pages(void)
+{
+    PLACARD_CONTEXT *ctx = pdfplaca_create_context();
+    static const int s_page_counts[] = { 1000, 10000 };
+    for (int num_pages : s_page_counts)
+    {
+        PLACARD_JOB job;
+        job.m_letters_per_page = 8;
+        job.m_text = pdf_bench_paged_text(num_pages, job.m_letters_per_page);
+        job.m_create_date = "2000-01-01T00:00:00";
+        job.m_verbose = false;
+
+        size_t size = 0;
+        bool ok = false;
+        double seconds = 0;
+        double growth = pdf_bench_memory_growth([&] {
+            auto start = std::chrono::steady_clock::now();
+            ok = pdfplaca_render_to(*ctx, job, pdf_bench_write_count, &size);
+            seconds = pdf_bench_seconds(start);
+        });
+        printf("pages: %d pages in %.3f sec (%.1f pages/sec), %.1f MB of PDF, working set +%.1f MB%s\n",
+               num_pages, seconds, num_pages / seconds, size / (1024.0 * 1024.0), growth,
+               ok ? "" : " (FAILED)");
+    }
+    pdfplaca_destroy_context(ctx);
+}
+
+// ジョブの並列化のベンチマーク。バッチと同じく作業者ごとの文脈でジョブをメモリーに描画して、
+// スレッド数ごとの速さを比べる。
+void pdf_bench_jobs(void)
+{
+    // 設定の異なるジョブを並べる。
+    std::vector<PLACARD_JOB> jobs(2048);
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        auto& job = jobs[i];
+        job.m_text = pdf_bench_paged_text(1, 4 + int(i % 29));
+        job.m_vertical = (i % 3 == 1);
+        job.m_auto_wrap = (i % 4 == 2);
+        job.m_portrait = (i % 5 == 3);
+        job.m_create_date = "2000-01-01T00:00:00";
+        job.m_verbose = false;
+    }
+
+    printf("jobs: %d jobs, %d hardware threads\n", int(jobs.size()), int(std::thread::hardware_concurrency()));
+    static const int s_thread_counts[] = { 1, 2, 4, 8, 16 };
+    double base = 0;
+    for (int num_threads : s_thread_counts)
+    {
+        std::vector<PLACARD_CONTEXT *> contexts(num_threads);
+        for (auto& ctx : contexts)
+            ctx = pdfplaca_create_context();
+
+        // 最初の回は文脈のキャッシュを温めるだけ。残りの回の最も速い回を採る。
+        std::vector<std::string> pdfs(jobs.size());
+        std::atomic<int> num_failed(0);
+        double seconds = 0;
+        for (int repeat = 0; repeat < 4; ++repeat)
+        {
+            auto start = std::chrono::steady_clock::now();
+            work_stealing_for(num_threads, jobs.size(), [&](int iworker, size_t ijob) {
+                if (!pdfplaca_render_to_memory(contexts[iworker], jobs[ijob], pdfs[ijob]))
+                    ++num_failed;
+            }, [](size_t) { });
+            double elapsed = pdf_bench_seconds(start);
+            if (repeat == 1 || (repeat > 1 && elapsed < seconds))
+                seconds = elapsed;
+        }
+
+        for (auto ctx : contexts)
+            pdfplaca_destroy_context(ctx);
+        if (!base)
+            base = seconds;
+        printf("jobs: %2d threads, %.3f sec, %.0f jobs/sec, %.2fx%s\n", num_threads, seconds,
+               jobs.size() / seconds, base / seconds, num_failed ? " (FAILED)" : "");
+    }
+}
+
+// ページのレイアウトの並列化のベンチマーク。10000ページを描画する時間を、
+// レイアウトを求めるスレッド数ごとに比べる。出力はスレッド数によらず同じはず。
+void pdf_bench_layout(void)
+{
+    PLACARD_JOB job;
+    job.m_letters_per_page = 8;
+    job.m_text = pdf_bench_paged_text(10000, job.m_letters_per_page);
+    job.m_create_date = "2000-01-01T00:00:00";
+    job.m_verbose = false;
+
+    PLACARD_CONTEXT *ctx = pdfplaca_create_context();
+    std::string expected;
+    pdfplaca_render_to_memory(ctx, job, expected); // キャッシュを温める。
+
+    static const int s_thread_counts[] = { 1, 2, 4, 8 };
+    double base = 0;
+    std::string pdf;
+    for (int num_threads : s_thread_counts)
+    {
+        job.m_layout_threads = num_threads;
+        double seconds = 0;
+        bool same = true;
+        for (int repeat = 0; repeat < 3; ++repeat)
+        {
+            auto start = std::chrono::steady_clock::now();
+            bool ok = pdfplaca_render_to_memory(ctx, job, pdf);
+            double elapsed = pdf_bench_seconds(start);
+            if (!repeat || elapsed < seconds)
+                seconds = elapsed;
+            same = same && ok && pdf == expected;
+        }
+        if (!base)
+            base = seconds;
+        printf("layout: 10000 pages, %d layout threads, %.3f sec, %.2fx%s\n", num_threads, seconds,
+               base / seconds, same ? "" : " (MISMATCH)");
+    }
+    pdfplaca_destroy_context(ctx);
+}
+
+// ベンチマークの一覧。
+static const struct
+{
+    const char *m_name;
+    void (*m_fn)(void);
+} s_pdf_benches[] =
+{
+    { "fit", pdf_bench_fit },
+    { "utf8", pdf_bench_utf8 },
+    { "normalize", pdf_bench_normalize },
+    { "pages", pdf_bench_pages },
+    { "jobs", pdf_bench_jobs },
+    { "layout", pdf_bench_layout },
+};
+
+// ベンチマークを実行して、結果を標準出力に表示する。
+bool pdfplaca_bench(const char *name)
+{
+    bool found = false;
+    for (auto& bench : s_pdf_benches)
+    {
+        if (strcmp(name, "all") == 0 || strcmp(name, bench.m_name) == 0)
+        {
+            bench.m_fn();
+            found = true;
+        }
+    }
+    if (!found)
+        fprintf(stderr, "ERROR: Unknown benchmark '%s'\n", name);
+    return found;
+}
+
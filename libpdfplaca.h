@@ -0,0 +1,118 @@
+// libpdfplaca.h --- The core of pdfplaca (layout and drawing) by katahiromz
+// License: Apache 2.0
+
+#pragma once
+
+#include <cstdint>          // C Standard Integers
+#include <climits>          // For INT_MAX
+#include <cstring>          // C String Library
+#include <string>           // For std::string and std::wstring
+
+#include <windows.h>        // Windows standard header
+#include <tchar.h>          // Generic text mapping
+
+#include <cairo.h>          // For cairo_write_func_t
+
+// 看板の作成の指示（ジョブ）。描画はジョブと文脈だけを読み、グローバル変数は使わない。
+struct PLACARD_JOB
+{
+    std::basic_string<_TCHAR> m_out_file = _T("output.pdf");    // 出力するPDFファイル。%05dなどを含めばページごとのファイル。"-"なら標準出力（Windowsでは呼び出し側がバイナリモードにする）。
+    std::basic_string<_TCHAR> m_text = _T("This is\na test."); // 出力するテキスト（エスケープ付き）。
+    std::basic_string<_TCHAR> m_text_file;  // テキストを読み込むファイル。空ならm_text。"-"なら標準入力。
+    std::basic_string<_TCHAR> m_font_name;  // フォント名。空なら既定のフォント。
+    double m_page_width = 297;              // ページの幅(mm)。
+    double m_page_height = 210;             // ページの高さ(mm)。
+    bool m_portrait = false;                // 縦向きか？（でなければ横向き）
+    double m_margin = 8;                    // 余白(mm)。
+    uint32_t m_text_color = 0x000000;       // 文字の色。
+    uint32_t m_back_color = 0xFFFFFF;       // 背景の色。
+    double m_threshold = 1.5;               // 縦横比の上限。
+    double m_y_adjust = 0;                  // Y方向の補正(mm)。正なら上にずらす。
+    int m_letters_per_page = -1;            // 1ページの文字数。-1なら制限しない。
+    int m_layout_threads = 1;               // ページのレイアウトを求めるスレッド数。0ならコア数。
+    bool m_vertical = false;                // 縦書きか？
+    bool m_auto_wrap = false;               // 自動で改行するか？
+    std::string m_create_date;              // PDFの作成日時（ISO 8601）。空なら現在の日時。
+    bool m_verbose = true;                  // 進行状況を表示するか？（PDFを標準出力に書くときは標準エラー出力に）
+};
+
+// 描画の文脈。フォントのキャッシュを持つ。スレッドごとに一つ作る。
+struct PLACARD_CONTEXT;
+
+// 描画の文脈を作成する。
+PLACARD_CONTEXT *pdfplaca_create_context(void);
+// 描画の文脈を破棄する。
+void pdfplaca_destroy_context(PLACARD_CONTEXT *ctx);
+
+// ジョブの看板のPDFを作成する。文脈のキャッシュは次のジョブでも使う。
+bool pdfplaca_render(PLACARD_CONTEXT *ctx, const PLACARD_JOB& job);
+// ジョブの看板のPDFをwrite_funcに書き込む。ジョブの出力ファイルは使わない。
+// 一時ファイルを使わずに、パイプやHTTPの応答などに直接書き込める。
+bool pdfplaca_render_to_stream(PLACARD_CONTEXT *ctx, const PLACARD_JOB& job, cairo_write_func_t write_func, void *closure);
+// ジョブの看板のPDFをメモリーに作成する。ジョブの出力ファイルは使わない。
+// pdfの中身は置き換えるが、確保済みの容量は再利用する。
+bool pdfplaca_render_to_memory(PLACARD_CONTEXT *ctx, const PLACARD_JOB& job, std::string& pdf);
+
+// pdfplaca_render_to_streamの出力関数。closureはFILE*（標準出力ならstdout）。
+cairo_status_t pdfplaca_write_to_stdio(void *closure, const unsigned char *data, unsigned int length);
+// pdfplaca_render_to_streamの出力関数。closureはstd::string*で、末尾に追加する。
+cairo_status_t pdfplaca_write_to_string(void *closure, const unsigned char *data, unsigned int length);
+
+// 既定のフォントを取得する。
+const _TCHAR *pdfplaca_get_default_font(void);
+
+// ライブラリの単体テスト（デバッグ版のみ）。すぐに終わるものだけ。
+void pdfplaca_unittest(void);
+// ライブラリの自己テスト。実際にジョブを描画して結果を比べる。成功すればtrueを返す。
+bool pdfplaca_self_test(void);
+// ベンチマークを実行して、結果を標準出力に表示する。nameはベンチマークの名前か"all"。
+// 描画の経路とは別に測るので、通常の描画では何も測らない。
+bool pdfplaca_bench(const char *name);
+
+// ワイド文字列からANSI文字列に変換する。必要な長さを先に求めるので、切り捨てられない。
+// 静的なバッファは使わないので、複数のスレッドから同時に呼んでもよい。
+inline bool ansi_from_wide(std::string& ret, const wchar_t *wide, size_t len, int codepage = CP_UTF8)
+{
+    ret.clear();
+    if (!len)
+        return true;
+    if (len > INT_MAX)
+        return false;
+
+    int cch = WideCharToMultiByte(codepage, 0, wide, int(len), nullptr, 0, nullptr, nullptr);
+    if (cch <= 0)
+        return false;
+    ret.resize(cch);
+    WideCharToMultiByte(codepage, 0, wide, int(len), &ret[0], cch, nullptr, nullptr);
+    return true;
+}
+inline std::string ansi_from_wide(const wchar_t *wide, int codepage = CP_UTF8)
+{
+    std::string ret;
+    ansi_from_wide(ret, wide, wcslen(wide), codepage);
+    return ret;
+}
+
+// ANSI文字列からワイド文字列に変換する。必要な長さを先に求めるので、切り捨てられない。
+// 静的なバッファは使わないので、複数のスレッドから同時に呼んでもよい。
+inline bool wide_from_ansi(std::wstring& ret, const char *ansi, size_t len, int codepage = CP_UTF8)
+{
+    ret.clear();
+    if (!len)
+        return true;
+    if (len > INT_MAX)
+        return false;
+
+    int cch = MultiByteToWideChar(codepage, 0, ansi, int(len), nullptr, 0);
+    if (cch <= 0)
+        return false;
+    ret.resize(cch);
+    MultiByteToWideChar(codepage, 0, ansi, int(len), &ret[0], cch);
+    return true;
+}
+inline std::wstring wide_from_ansi(const char *ansi, int codepage = CP_UTF8)
+{
+    std::wstring ret;
+    wide_from_ansi(ret, ansi, strlen(ansi), codepage);
+    return ret;
+}
@@ -2,17 +2,22 @@
 // License: Apache 2.0
 
 #define _CRT_SECURE_NO_DEPRECATE    // We use deprecate functions for compatibility
-#define _USE_MATH_DEFINES           // We use <cmath> M_PI constant
 
 #include <cstdlib>          // C Standard Library
 #include <cstdio>           // C Standard Input/Output Library
 #include <cstdint>          // C Standard Integers
 #include <cmath>            // C Math Library
-#include <cassert>          // For assert macro
+#include <cerrno>           // For errno
 #include <vector>           // For std::vector
 #include <string>           // For std::string and std::wstring
-#include <complex>          // For std::complex
 #include <algorithm>        // For standard algorithm
+#include <chrono>           // For std::chrono
+#include <thread>           // For std::thread
+#include <mutex>            // For std::mutex
+#include <condition_variable> // For std::condition_variable
+#include <deque>            // For std::deque
+#include <unordered_map>    // For std::unordered_map
+#include <signal.h>         // For signal
 
 // For detecting memory leak (for MSVC only)
 #if defined(_MSC_VER) && !defined(NDEBUG) && !defined(_CRTDBG_MAP_ALLOC)
@@ -20,17 +25,27 @@
     #include <crtdbg.h>     // For C run-time debugging
 #endif
 
-#include <cairo.h>          // Cairo Graphic Library
-#include <cairo-pdf.h>      // Cairo PDF
-
+#ifdef _WIN32
+    #include <winsock2.h>   // Windows Sockets 2
+    #include <afunix.h>     // For AF_UNIX
+    #include <io.h>         // For _setmode
+    #include <fcntl.h>      // For _O_BINARY
+#else
+    #include <sys/socket.h> // For socket
+    #include <sys/un.h>     // For sockaddr_un
+    #include <unistd.h>     // For close and unlink
+    #include <poll.h>       // For poll
+    #include <fcntl.h>      // For fcntl
+#endif
 #include <windows.h>        // Windows standard header
-#include <windowsx.h>       // Windows helper macros
 #include <shlwapi.h>        // Shell Light-weight API
 #include <tchar.h>          // Generic text mapping
-#include <strsafe.h>        // Safe string manipulation
 
+#include "libpdfplaca.h"    // The core of pdfplaca
 #include "color_value.h"    // Color values
 #include "page_size.h"      // Page sizes
+#include "json_object.h"    // JSON objects of job files
+#include "work_stealing.h"  // Work-stealing parallel loop
 
 // Show version info
 void pdfplaca_version(void)
@@ -38,14 +53,6 @@ void pdfplaca_version(void)
     std::printf("pdfplaca by katahiromz Version 0.97\n");
 }
 
-// Get the default font
-const _TCHAR *pdfplaca_get_default_font(void)
-{
-    if (PRIMARYLANGID(GetUserDefaultLangID()) == LANG_JAPANESE) // Is the user Japanese?
-        return _T("MS Gothic");
-    return _T("Tahoma");
-}
-
 // Show help message
 void pdfplaca_usage(void)
 {
@@ -53,7 +60,10 @@ void pdfplaca_usage(void)
         "Usage: pdfplaca [OPTIONS]\n"
         "Options:\n"
         "  --text \"TEXT\"             Specify output text (default: \"This is\\na test.\")\n"
+        "  --text-file FILE          Read UTF-8 output text from FILE (\"-\" for stdin).\n"
         "  -o output.pdf             Specify output PDF filename (default: output.pdf)\n"
+        "                            A pattern like page_%%05d.pdf writes one PDF per page.\n"
+        "                            \"-\" writes the PDF to stdout.\n"
         "  --page-size WIDTHxHEIGHT  Specify page size in mm (default: A4).\n"
         "  --landscape               Use landscape orientation.\n"
         "  --portrait                Use portrait orientation.\n"
@@ -64,8 +74,17 @@ void pdfplaca_usage(void)
         "  --threshold THRESHOLD     Specify aspect ratio threshold (default: 1.5).\n"
         "  --letters-per-page NUM    Specify letters per page (default: -1)\n"
         "  --vertical                Use vertical writing.\n"
+        "  --auto-wrap               Break rows automatically to enlarge text.\n"
         "  --y-adjust VALUE          Y adjustment in mm (default: 0).\n"
+        "  --batch JOBS.jsonl        Render one placard per JSON line of JOBS.jsonl.\n"
+        "  --jobs NUM                Use NUM threads for --batch, --serve, --serve-bench\n"
+        "                            or for laying out pages (default: 1, 0: all cores).\n"
+        "  --serve SOCKET            Serve length-prefixed JSON jobs on a Unix domain socket.\n"
+        "  --serve-bench SOCKET NUM  Send NUM jobs to a server and show the latencies.\n"
         "  --font-list               List font entries.\n"
+        "  --self-test               Render test jobs and check the results.\n"
+        "  --bench NAME              Run a benchmark (fit, utf8, normalize, pages, jobs,\n"
+        "                            layout, or all).\n"
         "  --help                    Display this message.\n"
         "  --version                 Display version information.\n",
         pdfplaca_get_default_font()
@@ -73,1384 +92,324 @@ void pdfplaca_usage(void)
 }
 
 // Global variables
-const _TCHAR *g_out_text = _T("This is\na test.");
-const _TCHAR *g_out_file = _T("output.pdf");
-const _TCHAR *g_font_name = pdfplaca_get_default_font();
-double g_page_width = -1;
-double g_page_height = -1;
-double g_margin = 8;
+PLACARD_JOB g_job;
 bool g_usage = false;
 bool g_version = false;
 bool g_font_list = false;
-bool g_vertical = false;
-const _TCHAR *g_orientation = _T("landscape");
-uint32_t g_text_color = 0x000000;
-uint32_t g_back_color = 0xFFFFFF;
-double g_threshold = 1.5;
-double g_y_adjust = 0;
-int g_letters_per_page = -1;
-bool g_fixed_pitch_font = false;
-
-// 単位をmmからptへ変換する。
-constexpr double pt_from_mm(double mm)
-{
-    return mm * (72.0 / 25.4);
-}
-
-// ワイド文字列からANSI文字列に変換する。
-std::string ansi_from_wide(const wchar_t *wide, int codepage = CP_UTF8)
-{
-    static char s_buf[1024];
-    s_buf[0] = 0;
-    WideCharToMultiByte(codepage, 0, wide, -1, s_buf, _countof(s_buf), nullptr, nullptr);
-    s_buf[_countof(s_buf) - 1] = 0;
-    return s_buf;
-}
-
-// ANSI文字列からワイド文字列に変換する。
-std::wstring wide_from_ansi(const char *ansi, int codepage = CP_UTF8)
-{
-    static wchar_t s_buf[1024];
-    s_buf[0] = 0;
-    MultiByteToWideChar(codepage, 0, ansi, -1, s_buf, _countof(s_buf));
-    s_buf[_countof(s_buf) - 1] = 0;
-    return s_buf;
-}
-
-// RGBから赤の値を取得する。
-constexpr uint8_t get_r_value(uint32_t color)
-{
-    return (color >> 16) & 0xFF;
-}
-// RGBから緑の値を取得する。
-constexpr uint8_t get_g_value(uint32_t color)
-{
-    return (color >> 8) & 0xFF;
-}
-// RGBから青の値を取得する。
-constexpr uint8_t get_b_value(uint32_t color)
-{
-    return (color >> 0) & 0xFF;
-}
-
-// UTF-8シーケンスの最初のバイトかどうか判定する。
-constexpr bool u8_is_lead(unsigned char ch)
-{
-    return (ch & 0xC0) != 0x80;
-}
+bool g_self_test = false;
+std::basic_string<_TCHAR> g_bench_name;
+std::basic_string<_TCHAR> g_batch_file;
+int g_num_threads = 1;
+std::basic_string<_TCHAR> g_serve_socket;
+std::basic_string<_TCHAR> g_bench_socket;
+int g_bench_requests = 0;
 
-// UTF-8文字列の実際の文字数を取得する。
-constexpr size_t u8_len(const char *str)
+// Parse command line
+bool pdfplaca_parse_cmdline(int argc, _TCHAR **argv)
 {
-    size_t len = 0;
-    while (*str)
-    {
-        if (u8_is_lead(*str))
-            ++len;
-        ++str;
-    }
-    return len;
-}
-static_assert(u8_len(u8"abあいう漢字") == 7, "");
-static_assert(u8_len(u8"𠮷") == 1, "");
-static_assert(u8_len(u8"😃😃") == 2, "");
+    // Default page size is A4.
+    page_size_parse(_T("A4"), &g_job.m_page_width, &g_job.m_page_height);
 
-// UTF-8文字列の実際の文字に分割する。
-void u8_split_chars(std::vector<std::string>& chars, const char *str)
-{
-    std::string s;
-    for (const char *pch = str; *pch; ++pch)
+    for (int iarg = 1; iarg < argc; ++iarg)
     {
-        if (u8_is_lead(*pch) && s.size())
+        auto arg = argv[iarg];
+        if (_tcsicmp(arg, _T("--help")) == 0 || _tcsicmp(arg, _T("/?")) == 0)
         {
-            chars.push_back(s);
-            s.clear();
+            g_usage = true;
         }
-        s += *pch;
-    }
-    if (s.size())
-        chars.push_back(s);
-}
-
-// 文字列を置き換える。
-template <typename T_STR>
-constexpr bool
-mstr_replace_all(T_STR& str, const T_STR& from, const T_STR& to)
-{
-    bool ret = false;
-    size_t i = 0;
-    for (;;) {
-        i = str.find(from, i);
-        if (i == T_STR::npos)
-            break;
-        ret = true;
-        str.replace(i, from.size(), to);
-        i += to.size();
-    }
-    return ret;
-}
-template <typename T_STR>
-constexpr bool
-mstr_replace_all(T_STR& str,
-                 const typename T_STR::value_type *from,
-                 const typename T_STR::value_type *to)
-{
-    return mstr_replace_all(str, T_STR(from), T_STR(to));
-}
-
-// 文字列を分割する。charsは区切りの文字集合。
-template <typename T_STR_CONTAINER>
-constexpr void
-mstr_split(T_STR_CONTAINER& container,
-           const typename T_STR_CONTAINER::value_type& str,
-           const typename T_STR_CONTAINER::value_type& chars)
-{
-    container.clear();
-    size_t i = 0, k = str.find_first_of(chars);
-    while (k != T_STR_CONTAINER::value_type::npos)
-    {
-        container.push_back(str.substr(i, k - i));
-        i = k + 1;
-        k = str.find_first_of(chars, i);
-    }
-    container.push_back(str.substr(i));
-}
-
-// 文字列を結合する。sepは区切り。
-template <typename T_STR_CONTAINER>
-constexpr typename T_STR_CONTAINER::value_type
-mstr_join(const T_STR_CONTAINER& container,
-          const typename T_STR_CONTAINER::value_type& sep)
-{
-    typename T_STR_CONTAINER::value_type result;
-    typename T_STR_CONTAINER::const_iterator it, end;
-    it = container.begin();
-    end = container.end();
-    if (it != end)
-    {
-        result = *it;
-        for (++it; it != end; ++it)
+        else if (_tcsicmp(arg, _T("--version")) == 0)
         {
-            result += sep;
-            result += *it;
+            g_version = true;
         }
-    }
-    return result;
-}
-
-// 文字列をエスケープする。
-std::string mstr_escape(const std::string& text)
-{
-    std::string ret;
-    for (size_t ich = 0; ich < text.size(); ++ich)
-    {
-        auto ch = text[ich];
-        switch (ch)
+        else if (_tcsicmp(arg, _T("--font-list")) == 0)
         {
-        case '\t': ret += '\\'; ret += 't'; break;
-        case '\n': ret += '\\'; ret += 'n'; break;
-        case '\r': ret += '\\'; ret += 'r'; break;
-        case '\f': ret += '\\'; ret += 'f'; break;
-        case '\\': ret += '\\'; ret += '\\'; break;
-        default: ret += ch; break;
+            g_font_list = true;
         }
-    }
-    return ret;
-}
-
-// 文字列のエスケープを解除する。
-std::string mstr_unescape(const std::string& text)
-{
-    std::string ret;
-    bool escaping = false;
-    for (size_t ich = 0; ich < text.size(); ++ich)
-    {
-        auto ch = text[ich];
-        if (escaping)
+        else if (_tcsicmp(arg, _T("--self-test")) == 0)
         {
-            switch (ch)
-            {
-            case 't': ret += '\t'; break;
-            case 'n': ret += '\n'; break;
-            case 'r': ret += '\r'; break;
-            case 'f': ret += '\f'; break;
-            case '\\': ret += '\\'; break;
-            default: ret += ch; break;
-            }
-            escaping = false;
+            g_self_test = true;
         }
-        else
+        else if (_tcsicmp(arg, _T("--vertical")) == 0)
         {
-            if (ch == '\\')
-            {
-                escaping = true;
-                if (ich + 1 == text.size())
-                {
-                    ret += ch;
-                    break;
-                }
-            }
-            else
-            {
-                ret += ch;
-            }
+            g_job.m_vertical = true;
         }
-    }
-    return ret;
-}
-
-// UTF-8文字列を改行で分割する。
-void u8_split_by_newlines(std::vector<std::string>& rows, const char *str)
-{
-    std::string s = str;
-    mstr_replace_all(s, "\r\n", "\n");
-    mstr_replace_all(s, "\r", "\n");
-    mstr_split(rows, s, "\n");
-}
-
-bool u8_contains_one_of(const char *ptr, const char *char_set)
-{
-    std::vector<std::string> chars;
-    u8_split_chars(chars, char_set);
-    for (auto ch : chars)
-    {
-        if (ch == ptr)
-            return true;
-    }
-    return false;
-}
-
-// 文字はスペースか？
-static inline bool u8_is_space(const char *ptr)
-{
-    return u8_contains_one_of(ptr, u8" 　");
-}
-
-// カッコ（タイプ1）か？
-static inline bool u8_is_paren_type_1(const char *ptr)
-{
-    return u8_contains_one_of(ptr, u8"(（[［〔【｛〈《≪｟⁅〖〘«»〙〗⁆｠≫》〉｝】〕］]）)");
-}
-
-// カッコ（タイプ2）か？
-static inline bool u8_is_paren_type_2(const char *ptr)
-{
-    return u8_contains_one_of(ptr, u8"「『");
-}
-
-// カッコ（タイプ3）か？
-static inline bool u8_is_paren_type_3(const char *ptr)
-{
-    return u8_contains_one_of(ptr, u8"』」");
-}
-
-// 句読点か？
-static inline bool u8_is_comma_period(const char *ptr)
-{
-    return u8_contains_one_of(ptr, u8"、。，．");
-}
-
-// 横棒か？
-static inline bool u8_is_hyphen_dash(const char *ptr)
-{
-    return u8_contains_one_of(ptr, u8"-－―ー=＝≡～");
-}
-
-// 小さいカナか？
-static inline bool u8_is_small_kana(const char *ptr)
-{
-    return u8_contains_one_of(ptr, u8"ぁぃぅぇぉっゃゅょゎゕゖァィゥェォヵㇰヶㇱㇲッㇳㇴㇵㇶㇷㇸㇹㇺャュョㇻㇼㇽㇾㇿヮ");
-}
-
-// UTF-8シーケンスの最初のバイトでシーケンスの長さを判定する。
-int u8_get_skip_chars(uint8_t ch)
-{
-    if (!(ch & 0x80))
-        return 1;
-    if ((ch & 0xE0) == 0xC0)
-        return 2;
-    if ((ch & 0xF0) == 0xE0)
-        return 3;
-    if ((ch & 0xF8) == 0xF0)
-        return 4;
-    if ((ch & 0xFC) == 0xF8)
-        return 5;
-    if ((ch & 0xFE) == 0xFC)
-        return 6;
-    assert(0);
-    return -1;
-}
-
-// UTF-8からUTF-32に変換する。*skipはシーケンス長。
-uint32_t u32_from_u8(const char *ptr, int *skip)
-{
-    uint32_t u32 = 0;
-    const uint8_t *pch = reinterpret_cast<const uint8_t *>(ptr);
-    int len = u8_get_skip_chars(*pch);
-    *skip = len;
-
-    switch (len)
-    {
-    case 1:
-        u32 = *pch;
-        break;
-    case 2:
-        u32 = ((pch[0] & 0x1F) << 6) | (pch[1] & 0x3F);
-        break;
-    case 3:
-        u32 = ((pch[0] & 0x0F) << 12) | ((pch[1] & 0x3F) << 6) | (pch[2] & 0x3F);
-        break;
-    case 4:
-        u32 = ((pch[0] & 0x07) << 18) | ((pch[1] & 0x3F) << 12) | ((pch[2] & 0x3F) << 6) | (pch[3] & 0x3F);
-        break;
-    default:
-        *skip = -1;
-        return 0;
-    }
-
-    return u32;
-}
-
-// UTF-8文字列が日本語テキストかどうか判定する。
-int u8_is_japanese_text(const char *str)
-{
-    int skip;
-    int ret = 0;
-    for (const char *pch = str; *pch; )
-    {
-        uint32_t u32 = u32_from_u8(pch, &skip);
-        if (skip == -1)
-            return 0;
-        if (0x3040 <= u32 && u32 <= 0x309F) // U+3040..U+309F: Hiragana
-            if (ret < 2) ret = 2;
-        if (0x30A0 <= u32 && u32 <= 0x30FF) // U+30A0..U+30FF: Katakana
-            if (ret < 2) ret = 2;
-        if (0x31F0 <= u32 && u32 <= 0x31FF) // U+31F0..U+31FF: Katakana Phonetic Extensions
-            if (ret < 2) ret = 2;
-        if (0xFF01 <= u32 && u32 <= 0xFF9D) // U+FF01..U+FF9D: Halfwidth and Fullwidth Forms
-            if (ret < 1) ret = 1;
-        if ((0x3400 <= u32 && u32 <= 0x4DB5) || (0x4E00 <= u32 && u32 <= 0x9FCB) ||
-            (0xF900 <= u32 && u32 <= 0xFA6A)) // Kanji
+        else if (_tcsicmp(arg, _T("--auto-wrap")) == 0)
         {
-            if (ret < 1) ret = 1;
+            g_job.m_auto_wrap = true;
         }
-        if (0x3000 <= u32 && u32 <= 0x303F) // U+3000..U+303F: CJK Symbols and Punctuation Block
-            if (ret < 1) ret = 1;
-        for (int i = 0; i < skip && *pch; ++i)
-            ++pch;
-    }
-    return ret;
-}
-
-void u8_is_japanese_text_unittest(void)
-{
-#ifndef NDEBUG
-    assert(!u8_is_japanese_text(u8""));
-    assert(!u8_is_japanese_text(u8"ABCabc123"));
-    assert(u8_is_japanese_text(u8"あ")); // Hiragana
-    assert(u8_is_japanese_text(u8"ア")); // Katanaka
-    assert(u8_is_japanese_text(u8"ｱ")); // Halfwidth Katanaka
-    assert(u8_is_japanese_text(u8"漢字")); // Kanji
-    assert(u8_is_japanese_text(u8"ＡＢＣ")); // Fullwidth ASCII
-#endif
-}
-
-// UTF-8文字列が中国語テキストかどうか判定する。
-int u8_is_chinese_text(const char *str)
-{
-    int skip;
-    for (const char *pch = str; *pch; )
-    {
-        uint32_t u32 = u32_from_u8(pch, &skip);
-        if (skip == -1)
-            return 0;
-        if (0x4E00 <= u32 && u32 <= 0x9FFF) // U+4E00..U+9FFF: CJK Unified Ideographs
-            return 1;
-        if (0xF900 <= u32 && u32 <= 0xFAFF) // U+F900..U+FAFF: CJK Compatibility Ideographs
-            return 1;
-        if (0x2F00 <= u32 && u32 <= 0x2FDF) // U+2F00..U+2FDF: CJK Radicals
-            return 1;
-        if (0x2E80 <= u32 && u32 <= 0x2EFF) // U+2E80..U+2EFF: CJK Radicals Supplement
-            return 1;
-        if (0x3400 <= u32 && u32 <= 0x4DBF) // U+3400..U+4DBF CJK Unified Ideographs Extension A
-            return 1;
-        if (0x20000 <= u32 && u32 <= 0x2A6DF) // U+20000..U+2A6DF CJK Unified Ideographs Extension B
-            return 1;
-        if (0x2A700 <= u32 && u32 <= 0x2B73F) // U+2A700..U+2B73F CJK Unified Ideographs Extension C
-            return 1;
-        if (0x2B740 <= u32 && u32 <= 0x2B81F) // U+2B740..U+2B81F CJK Unified Ideographs Extension D
-            return 1;
-        if (0x2B820 <= u32 && u32 <= 0x2CEAF) // U+2B820..U+2CEAF CJK Unified Ideographs Extension E
-            return 1;
-        if (0x2CEB0 <= u32 && u32 <= 0x2EBEF) // U+2CEB0..U+2EBEF CJK Unified Ideographs Extension F
-            return 1;
-        if (0x30000 <= u32 && u32 <= 0x3134F) // U+30000..U+3134F CJK Unified Ideographs Extension G
-            return 1;
-        if (0x31350 <= u32 && u32 <= 0x323AF) // U+31350..U+323AF CJK Unified Ideographs Extension H
-            return 1;
-        if (0x3000 <= u32 && u32 <= 0x303F) // U+3000..U+303F: CJK Symbols and Punctuation Block
-            return 1;
-        if (0x2F800 <= u32 && u32 <= 0x2FA1F) // U+2F800..U+2FA1F: Unifiable variants
-            return 1;
-        for (int i = 0; i < skip && *pch; ++i)
-            ++pch;
-    }
-    return 0;
-}
-
-// UTF-8文字列が韓国語テキストかどうか判定する。
-int u8_is_korean_text(const char *str)
-{
-    int skip;
-    int ret = 0;
-    for (const char *pch = str; *pch; )
-    {
-        uint32_t u32 = u32_from_u8(pch, &skip);
-        if (skip == -1)
-            return 0;
-        if (0x4E00 <= u32 && u32 <= 0x9FFF) // U+4E00..U+9FFF: CJK Unified Ideographs
-            if (ret < 1) ret = 1;
-        if (0xF900 <= u32 && u32 <= 0xFAFF) // U+F900..U+FAFF: CJK Compatibility Ideographs
-            if (ret < 1) ret = 1;
-        if (0x2F00 <= u32 && u32 <= 0x2FDF) // U+2F00..U+2FDF: CJK Radicals
-            if (ret < 1) ret = 1;
-        if (0x2E80 <= u32 && u32 <= 0x2EFF) // U+2E80..U+2EFF: CJK Radicals Supplement
-            if (ret < 1) ret = 1;
-        if (0x3000 <= u32 && u32 <= 0x303F) // U+3000..U+303F: CJK Symbols and Punctuation Block
-            if (ret < 1) ret = 1;
-        if (0xAC00 <= u32 && u32 <= 0xD7AF) // U+AC00-U+D7AF: Hangul Syllables Block
-            if (ret < 2) ret = 2;
-        if (0x1100 <= u32 && u32 <= 0x11FF) // U+1100..U+11FF: Hangul Jamo
-            if (ret < 2) ret = 2;
-        if (0x3130 <= u32 && u32 <= 0x318F) // U+3130..U+318F: Hangul Compatibility Jamo
-            if (ret < 2) ret = 2;
-        if (0xA960 <= u32 && u32 <= 0xA97F) // U+A960..U+A97F: Hangul Jamo Extended-A
-            if (ret < 2) ret = 2;
-        if (0xD7B0 <= u32 && u32 <= 0xD7FF) // U+D7B0..U+D7FF: Hangul Jamo Extended-B
-            if (ret < 2) ret = 2;
-        if (0xFFA0 <= u32 && u32 <= 0xFFDF) // U+FFA0..U+FFDF: Halfwidth Hangul Filler
-            if (ret < 2) ret = 2;
-        for (int i = 0; i < skip && *pch; ++i)
-            ++pch;
-    }
-    return ret;
-}
-
-// 選択中のフォントが日本語対応か判定する。
-bool pdf_is_font_japanese(cairo_t *cr)
-{
-    cairo_save(cr);
-    cairo_set_font_size(cr, 30);
-    cairo_text_extents_t extents;
-    cairo_text_extents(cr, u8"あ", &extents);
-    cairo_restore(cr);
-    return !(extents.width < 1 || extents.height < 1);
-}
-
-// 選択中のフォントが中国語対応か判定する。
-bool pdf_is_font_chinese(cairo_t *cr)
-{
-    cairo_save(cr);
-    cairo_set_font_size(cr, 30);
-    cairo_text_extents_t extents;
-    cairo_text_extents(cr, u8"沉", &extents);
-    cairo_restore(cr);
-    return !(extents.width < 1 || extents.height < 1);
-}
-
-// 選択中のフォントが韓国語対応か判定する。
-bool pdf_is_font_korean(cairo_t *cr)
-{
-    cairo_save(cr);
-    cairo_set_font_size(cr, 30);
-    cairo_text_extents_t extents;
-    cairo_text_extents(cr, u8"작", &extents);
-    cairo_restore(cr);
-    return !(extents.width < 1 || extents.height < 1);
-}
-
-// 原点を中心として複素数xを回転する。
-template <typename T>
-inline std::complex<T>
-complex_rotate(std::complex<T> c, const T& theta)
-{
-    return c * std::polar<T>(1, theta);
-}
-
-// 複素数xを平行移動する。
-template <typename T>
-inline std::complex<T>
-complex_translate(std::complex<T> c, const T& x0, const T& y0)
-{
-    return c + std::complex<T>(x0, y0);
-}
-
-// 二つの値がほとんど等しいか？
-inline bool is_nearly_equal(double x0, double x1)
-{
-    return std::fabs(x1 - x0) < 0.25;
-}
-
-// 選択中のフォントは等幅フォントか？
-bool pdf_is_fixed_pitch_font(cairo_t *cr)
-{
-    cairo_save(cr);
-
-    cairo_text_extents_t extents;
-    cairo_set_font_size(cr, 30);
-    cairo_text_extents(cr, "wwww", &extents);
-
-    double x0 = extents.x_advance, x1;
-    if (pdf_is_font_japanese(cr))
-    {
-        cairo_text_extents(cr, u8"目目", &extents);
-        x1 = extents.x_advance;
-    }
-    else if (pdf_is_font_chinese(cr))
-    {
-        cairo_text_extents(cr, u8"沉沉", &extents);
-        x1 = extents.x_advance;
-    }
-    else if (pdf_is_font_korean(cr))
-    {
-        cairo_text_extents(cr, u8"작작", &extents);
-        x1 = extents.x_advance;
-    }
-    else
-    {
-        cairo_text_extents(cr, "iiii", &extents);
-        x1 = extents.x_advance;
-    }
-
-    cairo_restore(cr);
-    return is_nearly_equal(x0, x1);
-}
-
-// PDFに出力したときのテキストの幅の合計を返す。
-double pdf_get_total_text_width(cairo_t *cr, const char *utf8_text)
-{
-    std::vector<std::string> chars;
-    u8_split_chars(chars, utf8_text);
-
-    double text_width = 0;
-    for (size_t ich = 0; ich < chars.size(); ++ich)
-    {
-        cairo_text_extents_t extents;
-        cairo_text_extents(cr, chars[ich].c_str(), &extents);
-        text_width += extents.x_advance;
-    }
-
-    return text_width;
-}
-
-// 小さいカナの縮小率。
-#define SMALL_KANA_RATIO 0.55
-
-void pdf_get_h_text_width_and_height(cairo_t *cr, const std::vector<std::string>& chars, double& text_width, double& text_height)
-{
-    text_width = text_height = 0;
-    cairo_text_extents_t extents;
-    cairo_font_extents_t font_extents;
-    cairo_font_extents(cr, &font_extents);
-    for (auto& text_char : chars)
-    {
-        cairo_text_extents(cr, text_char.c_str(), &extents);
-        if (text_height < extents.height)
-            text_height = extents.height;
-        if (text_height < font_extents.height)
-            text_height = font_extents.height;
-        text_width += extents.x_advance;
-    }
-}
-
-void pdf_get_v_text_width_and_height(cairo_t *cr, const std::vector<std::string>& chars, double& text_width, double& text_height)
-{
-    text_width = text_height = 0;
-    cairo_text_extents_t extents;
-    cairo_font_extents_t font_extents;
-    cairo_font_extents(cr, &font_extents);
-    for (auto& text_char : chars)
-    {
-        cairo_text_extents(cr, text_char.c_str(), &extents);
-        if (u8_is_space(text_char.c_str())) // スペースか？
+        else if (_tcscmp(arg, _T("--text")) == 0)
         {
-            if (text_width < extents.width)
-                text_width = extents.width;
-            text_height += extents.x_advance;
+            if (iarg + 1 >= argc)
+                return false;
+            g_job.m_text = argv[++iarg];
         }
-        else if (u8_is_small_kana(text_char.c_str())) // 小さいカナか？
+        else if (_tcscmp(arg, _T("--text-file")) == 0)
         {
-            if (text_width < extents.width * SMALL_KANA_RATIO)
-                text_width = extents.width * SMALL_KANA_RATIO;
-            text_height += extents.height * SMALL_KANA_RATIO;
+            if (iarg + 1 >= argc)
+                return false;
+            g_job.m_text_file = argv[++iarg];
         }
-        else if (u8_is_hyphen_dash(text_char.c_str())) // 横棒か？
+        else if (_tcscmp(arg, _T("-o")) == 0) // output.pdf
         {
-            if (text_width < extents.height)
-                text_width = extents.height;
-            text_height += extents.width;
+            if (iarg + 1 >= argc)
+                return false;
+            g_job.m_out_file = argv[++iarg];
         }
-        else if (u8_is_paren_type_1(text_char.c_str()) ||
-                 u8_is_paren_type_2(text_char.c_str()) ||
-                 u8_is_paren_type_3(text_char.c_str())) // カッコか？
+        else if (_tcscmp(arg, _T("--page-size")) == 0)
         {
-            if (text_width < extents.height)
-                text_width = extents.height;
-            text_height += extents.width;
+            if (iarg + 1 >= argc)
+                return false;
+            arg = argv[++iarg];
+            if (!page_size_parse(arg, &g_job.m_page_width, &g_job.m_page_height))
+                return false;
         }
-        else
+        else if (_tcsicmp(arg, _T("--portrait")) == 0)
         {
-            if (text_width < extents.width)
-                text_width = extents.width;
-            text_height += extents.height;
+            g_job.m_portrait = true;
         }
-    }
-}
-
-void pdf_get_v_text_width_and_height_fixed(cairo_t *cr, const std::vector<std::string>& chars, double& text_width, double& text_height)
-{
-    text_width = text_height = 0;
-    cairo_text_extents_t extents;
-    cairo_font_extents_t font_extents;
-    cairo_font_extents(cr, &font_extents);
-    for (auto& text_char : chars)
-    {
-        cairo_text_extents(cr, text_char.c_str(), &extents);
-        if (text_width < extents.width)
-            text_width = extents.width;
-        text_height += extents.x_advance;
-    }
-}
-
-// Do scaling for drawing horizontal text
-bool pdf_scaling_h_text(cairo_t *cr, const char *utf8_text, double width, double height, double& font_size, double& scale_x, double& scale_y, double threshold)
-{
-    scale_x = scale_y = 1;
-    font_size = 10;
-
-    if (!*utf8_text)
-        return false;
-
-    // Split characters
-    std::vector<std::string> chars;
-    u8_split_chars(chars, utf8_text);
-
-    // Adjust the font size and scale
-    cairo_text_extents_t extents;
-    cairo_font_extents_t font_extents;
-    for (;;)
-    {
-        cairo_set_font_size(cr, font_size);
-        double text_width, text_height;
-        pdf_get_h_text_width_and_height(cr, chars, text_width, text_height);
-
-        if (font_size >= 10000 || !extents.width || !extents.height)
-            return false;
-
-        if (text_width * scale_x < width * 0.9 && text_height * scale_y < height * 0.9)
-            font_size *= 1.1;
-        else if (threshold < 1.1)
-            break;
-        else if (text_width * scale_x < width * 0.9)
-            scale_x *= 1.1;
-        else if (text_height * scale_y < height * 0.9)
-            scale_y *= 1.1;
-        else
-            break;
-    }
-
-    std::string text = utf8_text;
-    size_t len = u8_len(text.c_str());
-
-    cairo_set_font_size(cr, font_size);
-
-    double text_width, text_height;
-    pdf_get_h_text_width_and_height(cr, chars, text_width, text_height);
-
-    if ((text_width * scale_x / len) / (text_height * scale_y) > threshold)
-        scale_x = threshold * (text_height * scale_y) * len / text_width;
-    if ((text_height * scale_y) / (text_width * scale_x / len) > threshold)
-        scale_y = threshold * (text_width * scale_x / len) / text_height;
-
-    return true;
-}
-
-// Do scaling for drawing vertical text
-bool pdf_scaling_v_text(cairo_t *cr, const char *utf8_text, double width, double height, double& font_size, double& scale_x, double& scale_y, double threshold)
-{
-    scale_x = scale_y = 1;
-    font_size = 10;
-
-    if (!*utf8_text)
-        return false;
-
-    // Split characters
-    std::vector<std::string> chars;
-    u8_split_chars(chars, utf8_text);
-
-    // Adjust the font size and scale
-    for (;;)
-    {
-        double text_width, text_height;
-        cairo_set_font_size(cr, font_size);
-        pdf_get_v_text_width_and_height(cr, chars, text_width, text_height);
-
-        if (font_size >= 10000 || !text_width || !text_height)
-            return false;
-
-        if (text_width * scale_x < width * 0.95 && text_height * scale_y < height * 0.95)
-            font_size *= 1.05;
-        else if (threshold < 1.1)
-            break;
-        else if (text_width * scale_x < width * 0.95)
-            scale_x *= 1.05;
-        else if (text_height * scale_y < height * 0.95)
-            scale_y *= 1.05;
-        else
-            break;
-    }
-
-    size_t len = chars.size();
-
-    double text_width, text_height;
-    cairo_set_font_size(cr, font_size);
-    pdf_get_v_text_width_and_height(cr, chars, text_width, text_height);
-
-    if ((text_width * scale_x) / (text_height * scale_y / len) > threshold)
-        scale_x = threshold * (text_height * scale_y / len) / text_width;
-    else if ((text_height * scale_y / len) / (text_width * scale_x) > threshold)
-        scale_y = threshold * (text_width * scale_x) * len / text_height;
-
-    return true;
-}
-
-// Do scaling for drawing vertical text (fixed-pitch)
-bool pdf_scaling_v_text_fixed(cairo_t *cr, const char *utf8_text, double width, double height, double& font_size, double& scale_x, double& scale_y, double threshold)
-{
-    scale_x = scale_y = 1;
-    font_size = 10;
-
-    if (!*utf8_text)
-        return false;
-
-    // Split characters
-    std::vector<std::string> chars;
-    u8_split_chars(chars, utf8_text);
-
-    // Adjust the font size and scale
-    for (;;)
-    {
-        double text_width, text_height;
-        cairo_set_font_size(cr, font_size);
-        pdf_get_v_text_width_and_height_fixed(cr, chars, text_width, text_height);
-
-        if (font_size >= 10000 || !text_width || !text_height)
-            return false;
-
-        if (text_width * scale_x < width * 0.95 && text_height * scale_y < height * 0.95)
-            font_size *= 1.05;
-        else if (threshold < 1.1)
-            break;
-        else if (text_width * scale_x < width * 0.95)
-            scale_x *= 1.05;
-        else if (text_height * scale_y < height * 0.95)
-            scale_y *= 1.05;
-        else
-            break;
-    }
-
-    size_t len = chars.size();
-
-    double text_width, text_height;
-    cairo_set_font_size(cr, font_size);
-    pdf_get_v_text_width_and_height_fixed(cr, chars, text_width, text_height);
-
-    if ((text_width * scale_x) / (text_height * scale_y / len) > threshold)
-        scale_x = threshold * (text_height * scale_y / len) / text_width;
-    else if ((text_height * scale_y / len) / (text_width * scale_x) > threshold)
-        scale_y = threshold * (text_width * scale_x) * len / text_height;
-
-    return true;
-}
-
-// 横書き用の文字を描画する。
-void pdf_draw_h_char(cairo_t *cr, const char *text_char, double x, double y, double scale_x, double scale_y, cairo_text_extents_t& extents, cairo_font_extents_t& font_extents)
-{
-    // 補正分。
-    y += g_y_adjust;
-
-    // テキストのエクステントを取得
-    cairo_text_extents(cr, text_char, &extents);
-    cairo_font_extents(cr, &font_extents);
-
-    if (0)
-    {
-        // ボックスを描画
-        cairo_save(cr); // 描画状態を保存
+        else if (_tcsicmp(arg, _T("--landscape")) == 0)
         {
-            double x0 = x + extents.x_bearing * scale_x;
-            double scaled_width = extents.width * scale_x;
-            double scaled_height = font_extents.height * scale_y;
-
-            // 緑色のボックスを描画
-            cairo_set_source_rgb(cr, 0, 0.5, 0);  // 緑色
-            cairo_rectangle(cr, x0, y, scaled_width, scaled_height);
-            cairo_stroke(cr);  // ボックスを描画
+            g_job.m_portrait = false;
         }
-        cairo_restore(cr); // 描画状態を元に戻す
-
-        // ベースラインを描画
-        cairo_save(cr); // 描画状態を保存
+        else if (_tcscmp(arg, _T("--margin")) == 0)
         {
-            // 青い線でベースラインを描画
-            double x0 = x + extents.x_bearing * scale_x;
-            double x1 = x0 + extents.width * scale_x;
-            double baseline_y = y + font_extents.ascent * scale_y;
-            cairo_set_source_rgb(cr, 0, 0, 1);
-            cairo_move_to(cr, x0, baseline_y);
-            cairo_line_to(cr, x1, baseline_y);
-            cairo_stroke(cr);  // 線を描画
+            if (iarg + 1 >= argc)
+                return false;
+            arg = argv[++iarg];
+            _TCHAR *endptr;
+            g_job.m_margin = _tcstod(arg, &endptr);
+            if (*endptr || !std::isnormal(g_job.m_margin) || g_job.m_margin <= 0)
+                return false;
         }
-        cairo_restore(cr); // 描画状態を元に戻す
-    }
-
-    // テキストを描画
-    cairo_save(cr); // 描画状態を保存
-    {
-        // テキストの基準位置を調整
-        double x_pos = x;
-        double y_pos = y + font_extents.ascent * scale_y;
-        cairo_translate(cr, x_pos, y_pos);  // 指定位置に移動
-
-        // スケーリングを適用
-        cairo_scale(cr, scale_x, scale_y);
-
-        // テキストを描画
-        cairo_move_to(cr, 0, 0);  // 座標(0, 0)から描画
-        cairo_show_text(cr, text_char);
-    }
-    cairo_restore(cr); // 描画状態を元に戻す
-}
-
-// 縦書き用の文字を描画する。
-void pdf_draw_v_char(cairo_t *cr, const char *text_char, double x, double y, double scale_x, double scale_y, cairo_text_extents_t& extents, cairo_font_extents_t& font_extents)
-{
-    // テキストのエクステントを取得
-    cairo_text_extents(cr, text_char, &extents);
-    cairo_font_extents(cr, &font_extents);
-
-    // 補正分。
-    y += g_y_adjust;
-
-    // 句読点なら右にずらす。
-    if (u8_is_comma_period(text_char))
-        x += extents.width * scale_x * 0.75;
-
-    // 小さいカナなら右にずらす。
-    if (u8_is_small_kana(text_char))
-    {
-        scale_x *= SMALL_KANA_RATIO;
-        scale_y *= SMALL_KANA_RATIO;
-        x += extents.width * scale_x * 0.5;
-    }
-
-    // 横棒なら縦と横を入れ替える。
-    if (u8_is_hyphen_dash(text_char)) // 横棒か？
-    {
-        std::swap(extents.width, extents.height);
-        std::swap(extents.x_bearing, extents.y_bearing);
-    }
-
-    // カッコなら縦と横を入れ替える。
-    if (u8_is_paren_type_1(text_char) ||
-        u8_is_paren_type_2(text_char) ||
-        u8_is_paren_type_3(text_char)) // カッコか？
-    {
-        std::swap(extents.width, extents.height);
-        std::swap(extents.x_bearing, extents.y_bearing);
-    }
-
-    double scaled_width = extents.width * scale_x;
-    double scaled_height = extents.height * scale_y;
-
-    if (0)
-    {
-        // ボックスを描画
-        cairo_save(cr); // 描画状態を保存
+        else if (_tcscmp(arg, _T("--threshold")) == 0)
         {
-            double x_pos = x - extents.x_advance * scale_x / 2 + extents.x_bearing * scale_x; // 中央揃え。
-            double y_pos = y;
-
-            // 緑色のボックスを描画
-            cairo_set_source_rgb(cr, 0, 0.5, 0);  // 緑色
-            cairo_rectangle(cr, x_pos, y_pos, scaled_width, scaled_height);
-            cairo_stroke(cr);  // ボックスを描画
+            if (iarg + 1 >= argc)
+                return false;
+            _TCHAR *endptr;
+            g_job.m_threshold = _tcstod(argv[++iarg], &endptr);
+            if (*endptr || !std::isnormal(g_job.m_margin) || g_job.m_margin < 1.0)
+                return false;
         }
-        cairo_restore(cr); // 描画状態を元に戻す
-    }
-
-    // テキストを描画
-    cairo_save(cr); // 描画状態を保存
-    {
-        if (u8_is_hyphen_dash(text_char)) // 横棒か？
+        else if (_tcscmp(arg, _T("--y-adjust")) == 0)
         {
-            // テキストの基準位置を調整
-            double x_pos = x - extents.x_bearing * scale_x - scaled_width / 2;
-            double y_pos = y - extents.y_bearing * scale_y;
-            cairo_translate(cr, x_pos, y_pos);  // 指定位置に移動
-
-            // スケーリングを適用
-            cairo_scale(cr, scale_x, -scale_y);
-
-            // 回転。
-            cairo_rotate(cr, -M_PI / 2);
-
-            // テキストを描画
-            cairo_move_to(cr, 0, 0);  // 座標(0, 0)から描画
-            cairo_show_text(cr, text_char);
+            if (iarg + 1 >= argc)
+                return false;
+            _TCHAR *endptr;
+            g_job.m_y_adjust = _tcstod(argv[++iarg], &endptr);
+            if (*endptr || std::isinf(g_job.m_y_adjust) || std::isnan(g_job.m_y_adjust))
+                return false;
         }
-        else if (u8_is_paren_type_1(text_char)) // カッコ（タイプ1）か？
+        else if (_tcscmp(arg, _T("--font")) == 0)
         {
-            // テキストの基準位置を調整
-            double x_pos = x - scaled_width * 0.55 + extents.height * scale_x / 2;
-            double y_pos = y - extents.y_bearing * scale_y;
-            cairo_translate(cr, x_pos, y_pos);  // 指定位置に移動
-
-            // スケーリングを適用
-            cairo_scale(cr, scale_x, scale_y);
-
-            // 回転。
-            cairo_rotate(cr, M_PI / 2);
-
-            // テキストを描画
-            cairo_move_to(cr, 0, 0);  // 座標(0, 0)から描画
-            cairo_show_text(cr, text_char);
+            if (iarg + 1 >= argc)
+                return false;
+            g_job.m_font_name = argv[++iarg];
         }
-        else if (u8_is_paren_type_2(text_char)) // カッコ（タイプ2）か？
+        else if (_tcscmp(arg, _T("--text-color")) == 0)
         {
-            // テキストの基準位置を調整
-            double x_pos = x + scaled_width * 0.6 + extents.x_bearing * scale_x;
-            double y_pos = y - extents.y_bearing * scale_y;
-            cairo_translate(cr, x_pos, y_pos);  // 指定位置に移動
-
-            // スケーリングを適用
-            cairo_scale(cr, scale_x, scale_y);
-
-            // 回転。
-            cairo_rotate(cr, M_PI / 2);
-
-            // テキストを描画
-            cairo_move_to(cr, 0, 0);  // 座標(0, 0)から描画
-            cairo_show_text(cr, text_char);
+            if (iarg + 1 >= argc)
+                return false;
+            uint32_t value = color_value_parse(ansi_from_wide(argv[++iarg]).c_str());
+            if (value == uint32_t(-1))
+                return false;
+            g_job.m_text_color = value;
         }
-        else if (u8_is_paren_type_3(text_char)) // カッコ（タイプ3）か？
+        else if (_tcscmp(arg, _T("--back-color")) == 0)
         {
-            // テキストの基準位置を調整
-            double x_pos = x - scaled_width * 0.55 + extents.y_bearing * scale_x;
-            double y_pos = y - extents.y_bearing * scale_y;
-            cairo_translate(cr, x_pos, y_pos);  // 指定位置に移動
-
-            // スケーリングを適用
-            cairo_scale(cr, scale_x, scale_y);
-
-            // 回転。
-            cairo_rotate(cr, M_PI / 2);
-
-            // テキストを描画
-            cairo_move_to(cr, 0, 0);  // 座標(0, 0)から描画
-            cairo_show_text(cr, text_char);
+            if (iarg + 1 >= argc)
+                return false;
+            uint32_t value = color_value_parse(ansi_from_wide(argv[++iarg]).c_str());
+            if (value == uint32_t(-1))
+                return false;
+            g_job.m_back_color = value;
         }
-        else
+        else if (_tcscmp(arg, _T("--batch")) == 0)
         {
-            // テキストの基準位置を調整
-            double x_pos = x - extents.x_advance * scale_x / 2;
-            double y_pos = y - extents.y_bearing * scale_y;
-            cairo_translate(cr, x_pos, y_pos);  // 指定位置に移動
-
-            // スケーリングを適用
-            cairo_scale(cr, scale_x, scale_y);
-
-            // テキストを描画
-            cairo_move_to(cr, 0, 0);  // 座標(0, 0)から描画
-            cairo_show_text(cr, text_char);
+            if (iarg + 1 >= argc)
+                return false;
+            g_batch_file = argv[++iarg];
         }
-    }
-    cairo_restore(cr); // 描画状態を元に戻す
-}
-
-// Draw horizontal scaled text
-bool pdf_draw_h_text(cairo_t *cr, const char *text, double x0, double y0, double width, double height, double threshold)
-{
-    if (!*text)
-        return false;
-
-    // Calculate scaling and font size
-    double font_size, scale_x, scale_y;
-    if (!pdf_scaling_h_text(cr, text, width, height, font_size, scale_x, scale_y, threshold))
-        return false;
-
-    // Split to characters
-    std::vector<std::string> chars;
-    u8_split_chars(chars, text);
-
-    cairo_font_extents_t font_extents;
-    cairo_font_extents(cr, &font_extents);
-
-    // Draw each character one by one
-    double total_text_width = pdf_get_total_text_width(cr, text) * scale_x;
-    double text_height = font_extents.height * scale_y;
-    double x = x0;
-    auto each_blank_width = (width - total_text_width) / (chars.size() + 1);
-    for (size_t ich = 0; ich < chars.size(); ++ich)
-    {
-        x += each_blank_width;
-
-        auto& text_char = chars[ich];
-
-        cairo_text_extents_t extents;
-        cairo_text_extents(cr, text_char.c_str(), &extents);
-
-        double y = y0 + (height - font_extents.height * scale_y) / 2;
-        pdf_draw_h_char(cr, text_char.c_str(), x, y, scale_x, scale_y, extents, font_extents);
-
-        x += extents.x_advance * scale_x;
-    }
-
-    return true;
-}
-
-// 縦書きに備えて、半角文字を全角文字に変換する。
-std::string u8_locale_map_text(const char *text)
-{
-    std::wstring wide = wide_from_ansi(text, CP_UTF8);
-    if (!g_fixed_pitch_font)
-    {
-        mstr_replace_all(wide, L" ", L"\x0001"); // 半角スペース。
-        mstr_replace_all(wide, L"　", L"\x0002"); // 全角スペース。
-    }
-    static WCHAR s_szMapped[1024];
-    LCMapStringW(GetUserDefaultLCID(), LCMAP_FULLWIDTH, wide.c_str(), -1, s_szMapped, _countof(s_szMapped));
-    wide = s_szMapped;
-    if (!g_fixed_pitch_font)
-    {
-        mstr_replace_all(wide, L"\x0001", L" "); // 半角スペースを元に戻す。
-        mstr_replace_all(wide, L"\x0002", L"　"); // 全角スペースを元に戻す。
-    }
-    return ansi_from_wide(wide.c_str(), CP_UTF8);
-}
-
-// Draw vertical scaled text
-bool pdf_draw_v_text(cairo_t *cr, const char *text, double x0, double y0, double width, double height, double threshold)
-{
-    if (!*text)
-        return false;
-
-    // Locale mapping
-    std::string mapped_text;
-    if (pdf_is_font_japanese(cr) || pdf_is_font_chinese(cr) || pdf_is_font_korean(cr))
-        mapped_text = u8_locale_map_text(text);
-    else
-        mapped_text = text;
-
-    // Calculate scaling and font size
-    double font_size, scale_x, scale_y;
-    if (!pdf_scaling_v_text(cr, mapped_text.c_str(), width, height, font_size, scale_x, scale_y, threshold))
-        return false;
-
-    // Split to characters
-    std::vector<std::string> chars;
-    u8_split_chars(chars, mapped_text.c_str());
-
-    // get text height
-    double text_width, text_height;
-    pdf_get_v_text_width_and_height(cr, chars, text_width, text_height);
-    text_width *= scale_x;
-    text_height *= scale_y;
-
-    auto each_blank_height = (height - text_height) / (chars.size() + 1);
-    while (each_blank_height <= font_size * scale_y * 0.1)
-    {
-        scale_x *= 0.95;
-        scale_y *= 0.95;
-
-        pdf_get_v_text_width_and_height(cr, chars, text_width, text_height);
-        text_width *= scale_x;
-        text_height *= scale_y;
-        each_blank_height = (height - text_height) / (chars.size() + 1);
-    }
-
-    // Draw each character one by one
-    double y = y0;
-    for (size_t ich = 0; ich < chars.size(); ++ich)
-    {
-        y += each_blank_height;
-
-        auto& text_char = chars[ich];
-
-        cairo_text_extents_t extents;
-        cairo_text_extents(cr, text_char.c_str(), &extents);
-
-        cairo_font_extents_t font_extents;
-        cairo_font_extents(cr, &font_extents);
-
-        double x = x0 + width / 2;
-        pdf_draw_v_char(cr, text_char.c_str(), x, y, scale_x, scale_y, extents, font_extents);
-
-        cairo_text_extents(cr, text_char.c_str(), &extents);
-
-        if (u8_is_space(text_char.c_str()))
-            y += extents.x_advance * scale_y;
-        else if (u8_is_small_kana(text_char.c_str()))
-            y += extents.height * scale_y * SMALL_KANA_RATIO;
-        else if (u8_is_hyphen_dash(text_char.c_str()))
-            y += extents.width * scale_y;
-        else if (u8_is_paren_type_1(text_char.c_str()) || u8_is_paren_type_2(text_char.c_str()) || u8_is_paren_type_3(text_char.c_str()))
-            y += extents.width * scale_y;
-        else
-            y += extents.height * scale_y;
-    }
-
-    return true;
-}
-
-// Draw vertical scaled text (fixed-pitch)
-bool pdf_draw_v_text_fixed(cairo_t *cr, const char *text, double x0, double y0, double width, double height, double threshold)
-{
-    if (!*text)
-        return false;
-
-    // Locale mapping
-    std::string mapped_text;
-    if (pdf_is_font_japanese(cr) || pdf_is_font_chinese(cr) || pdf_is_font_korean(cr))
-        mapped_text = u8_locale_map_text(text);
-    else
-        mapped_text = text;
-
-    // Calculate scaling and font size
-    double font_size, scale_x, scale_y;
-    if (!pdf_scaling_v_text_fixed(cr, mapped_text.c_str(), width, height, font_size, scale_x, scale_y, threshold))
-        return false;
-
-    // Split to characters
-    std::vector<std::string> chars;
-    u8_split_chars(chars, mapped_text.c_str());
-
-    // get text height
-    double text_width, text_height;
-    pdf_get_v_text_width_and_height_fixed(cr, chars, text_width, text_height);
-    text_width *= scale_x;
-    text_height *= scale_y;
-    auto each_blank_height = (height - text_height) / (chars.size() + 1);
-    while (each_blank_height <= 0)
-    {
-        scale_x *= 0.95;
-        scale_y *= 0.95;
-
-        pdf_get_v_text_width_and_height(cr, chars, text_width, text_height);
-        text_width *= scale_x;
-        text_height *= scale_y;
-        each_blank_height = (height - text_height) / (chars.size() + 1);
-    }
-
-    double y = y0;
-    for (size_t ich = 0; ich < chars.size(); ++ich)
-    {
-        y += each_blank_height;
-
-        auto& text_char = chars[ich];
-
-        cairo_text_extents_t extents;
-        cairo_text_extents(cr, text_char.c_str(), &extents);
-
-        cairo_font_extents_t font_extents;
-        cairo_font_extents(cr, &font_extents);
-
-        double x = x0 + width / 2 - extents.x_advance * scale_x / 2;
-
-        // 変換行列や位置などを調整する。
-        cairo_matrix_t matrix;
-        double dx = 0, dy = g_y_adjust;
-        if (u8_is_small_kana(text_char.c_str())) // 小さいカナか？
+        else if (_tcscmp(arg, _T("--serve")) == 0)
         {
-            dx += font_extents.height * scale_x * 0.27;
-            dy += -font_extents.height * scale_y * 0.3;
-            cairo_matrix_init(&matrix,
-                scale_x * 0.75, 0, 0, scale_y * 0.75,
-                x + dx,
-                y - font_extents.descent * scale_y + font_extents.height * scale_y + dy);
+            if (iarg + 1 >= argc)
+                return false;
+            g_serve_socket = argv[++iarg];
         }
-        else if (u8_is_hyphen_dash(text_char.c_str())) // 横棒か？
+        else if (_tcscmp(arg, _T("--bench")) == 0)
         {
-            cairo_matrix_init(&matrix,
-                0, scale_y, scale_x, 0,
-                x + (font_extents.height - font_extents.descent) * scale_x + dx,
-                y - font_extents.height * scale_y + font_extents.height * scale_y + dy);
+            if (iarg + 1 >= argc)
+                return false;
+            g_bench_name = argv[++iarg];
         }
-        else if (u8_is_paren_type_1(text_char.c_str())) // カッコ（タイプ1）か？
+        else if (_tcscmp(arg, _T("--serve-bench")) == 0)
         {
-            cairo_matrix_init(&matrix,
-                0, scale_y, -scale_x, 0,
-                x + font_extents.descent * scale_x + dx,
-                y + dy);
+            if (iarg + 2 >= argc)
+                return false;
+            g_bench_socket = argv[++iarg];
+            g_bench_requests = _ttoi(argv[++iarg]);
+            if (g_bench_requests <= 0)
+                return false;
         }
-        else if (u8_is_paren_type_2(text_char.c_str())) // カッコ（タイプ2）か？
+        else if (_tcscmp(arg, _T("--jobs")) == 0)
         {
-            cairo_matrix_init(&matrix,
-                0, scale_y, -scale_x, 0,
-                x + font_extents.descent * scale_x + dx,
-                y + dy);
+            if (iarg + 1 >= argc)
+                return false;
+            _TCHAR *endptr;
+            long value = _tcstol(argv[++iarg], &endptr, 10);
+            if (*endptr || value < 0 || value > 1024)
+                return false;
+            g_num_threads = int(value);
         }
-        else if (u8_is_paren_type_3(text_char.c_str())) // カッコ（タイプ3）か？
+        else if (_tcscmp(arg, _T("--letters-per-page")) == 0)
         {
-            cairo_matrix_init(&matrix,
-                0, scale_y, -scale_x, 0,
-                x + font_extents.descent * scale_x + dx,
-                y + dy);
+            if (iarg + 1 >= argc)
+                return false;
+            g_job.m_letters_per_page = _ttoi(argv[++iarg]);
+            if (g_job.m_letters_per_page == 0)
+                return false;
         }
         else
         {
-            if (u8_is_comma_period(text_char.c_str())) // 句読点か？
-            {
-                dx += extents.x_advance * scale_x * 0.5;
-                dy += -extents.x_advance * scale_y * 0.5;
-            }
-            cairo_matrix_init(&matrix,
-                scale_x, 0, 0, scale_y,
-                x + dx,
-                y - font_extents.descent * scale_y + font_extents.height * scale_y + dy);
+            return false;
         }
-        cairo_set_matrix(cr, &matrix);
+    }
 
-        auto r = get_r_value(g_text_color);
-        auto g = get_g_value(g_text_color);
-        auto b = get_b_value(g_text_color);
-        cairo_set_source_rgb(cr, r / 255.0, g / 255.0, b / 255.0);
+    return true;
+}
 
-        cairo_move_to(cr, 0, 0);
-        cairo_show_text(cr, text_char.c_str());
+// フォントを列挙するコールバック関数。
+static
+INT CALLBACK
+EnumFontFamProc(
+    const LOGFONTW *plf,
+    const TEXTMETRICW *ptm,
+    DWORD FontType,
+    LPARAM lParam)
+{
+    auto pList = reinterpret_cast<std::vector<std::wstring> *>(lParam);
+    if (plf->lfFaceName[0] == L'@') // 縦書きフォントは無視。
+        return TRUE;
+    pList->push_back(plf->lfFaceName);
+    return TRUE;
+}
 
-        y += extents.x_advance * scale_y;
-    }
+// フォントを列挙する。
+void pdfplaca_list_fonts(void)
+{
+    HDC hDC = CreateCompatibleDC(NULL);
+    std::vector<std::wstring> list;
+    EnumFontFamiliesW(hDC, nullptr, (FONTENUMPROCW)EnumFontFamProc, (LPARAM)&list);
+    DeleteDC(hDC);
 
-    return true;
+    std::sort(list.begin(), list.end());
+
+    for (auto& entry : list)
+    {
+        printf("%s\n", ansi_from_wide(entry.c_str(), CP_ACP).c_str());
+    }
 }
 
-// Parse command line
-bool pdfplaca_parse_cmdline(int argc, _TCHAR **argv)
+// UTF-8の文字列を_TCHARの文字列にする。
+std::basic_string<_TCHAR> pdfplaca_tstr_from_utf8(const std::string& str)
 {
-    // Default page size is A4.
-    page_size_parse(_T("A4"), &g_page_width, &g_page_height);
+#ifdef UNICODE
+    std::wstring ret;
+    wide_from_ansi(ret, str.c_str(), str.size(), CP_UTF8);
+    return ret;
+#else
+    return str;
+#endif
+}
 
-    for (int iarg = 1; iarg < argc; ++iarg)
+// ジョブファイルの1行のJSONオブジェクトをジョブにする。指定のないキーはコマンドラインの値のまま。
+// 失敗したら、*errorに原因を返す。
+bool pdfplaca_job_from_json(const JSON_OBJECT& object, PLACARD_JOB& job, std::string *error)
+{
+    for (auto& member : object)
     {
-        auto arg = argv[iarg];
-        if (_tcsicmp(arg, _T("--help")) == 0 || _tcsicmp(arg, _T("/?")) == 0)
-        {
-            g_usage = true;
-        }
-        else if (_tcsicmp(arg, _T("--version")) == 0)
-        {
-            g_version = true;
-        }
-        else if (_tcsicmp(arg, _T("--font-list")) == 0)
-        {
-            g_font_list = true;
-        }
-        else if (_tcsicmp(arg, _T("--vertical")) == 0)
+        auto& key = member.m_key;
+        bool is_string = (member.m_type == JSON_STRING);
+        bool is_number = (member.m_type == JSON_NUMBER);
+        bool is_bool = (member.m_type == JSON_BOOL);
+        bool ok;
+        if (key == "text")
         {
-            g_vertical = true;
+            if ((ok = is_string))
+                job.m_text = pdfplaca_tstr_from_utf8(member.m_str);
         }
-        else if (_tcscmp(arg, _T("--text")) == 0)
+        else if (key == "text_file")
         {
-            if (iarg + 1 >= argc)
-                return false;
-            g_out_text = argv[++iarg];
+            if ((ok = is_string))
+                job.m_text_file = pdfplaca_tstr_from_utf8(member.m_str);
         }
-        else if (_tcscmp(arg, _T("-o")) == 0) // output.pdf
+        else if (key == "output")
         {
-            if (iarg + 1 >= argc)
-                return false;
-            g_out_file = argv[++iarg];
+            if ((ok = is_string && member.m_str.size()))
+                job.m_out_file = pdfplaca_tstr_from_utf8(member.m_str);
         }
-        else if (_tcscmp(arg, _T("--page-size")) == 0)
+        else if (key == "page_size")
         {
-            if (iarg + 1 >= argc)
-                return false;
-            arg = argv[++iarg];
-            if (!page_size_parse(arg, &g_page_width, &g_page_height))
-                return false;
+            ok = is_string && page_size_parse(pdfplaca_tstr_from_utf8(member.m_str).c_str(),
+                                              &job.m_page_width, &job.m_page_height);
         }
-        else if (_tcsicmp(arg, _T("--portrait")) == 0)
+        else if (key == "orientation")
         {
-            g_orientation = _T("portrait");
+            ok = is_string && (member.m_str == "portrait" || member.m_str == "landscape");
+            if (ok)
+                job.m_portrait = (member.m_str == "portrait");
         }
-        else if (_tcsicmp(arg, _T("--landscape")) == 0)
+        else if (key == "font")
         {
-            g_orientation = _T("landscape");
+            if ((ok = is_string))
+                job.m_font_name = pdfplaca_tstr_from_utf8(member.m_str);
         }
-        else if (_tcscmp(arg, _T("--margin")) == 0)
+        else if (key == "text_color" || key == "back_color")
         {
-            if (iarg + 1 >= argc)
-                return false;
-            arg = argv[++iarg];
-            _TCHAR *endptr;
-            g_margin = _tcstod(arg, &endptr);
-            if (*endptr || !std::isnormal(g_margin) || g_margin <= 0)
-                return false;
+            uint32_t value = is_string ? color_value_parse(member.m_str.c_str()) : uint32_t(-1);
+            if ((ok = (value != uint32_t(-1))))
+                (key == "text_color" ? job.m_text_color : job.m_back_color) = value;
         }
-        else if (_tcscmp(arg, _T("--threshold")) == 0)
+        else if (key == "margin")
         {
-            if (iarg + 1 >= argc)
-                return false;
-            _TCHAR *endptr;
-            g_threshold = _tcstod(argv[++iarg], &endptr);
-            if (*endptr || !std::isnormal(g_margin) || g_margin < 1.0)
-                return false;
+            if ((ok = is_number && std::isnormal(member.m_num) && member.m_num > 0))
+                job.m_margin = member.m_num;
         }
-        else if (_tcscmp(arg, _T("--y-adjust")) == 0)
+        else if (key == "threshold")
         {
-            if (iarg + 1 >= argc)
-                return false;
-            _TCHAR *endptr;
-            g_y_adjust = _tcstod(argv[++iarg], &endptr);
-            if (*endptr || std::isinf(g_y_adjust) || std::isnan(g_y_adjust))
-                return false;
-            g_y_adjust = -pt_from_mm(g_y_adjust);
+            if ((ok = is_number && member.m_num >= 1.0))
+                job.m_threshold = member.m_num;
         }
-        else if (_tcscmp(arg, _T("--font")) == 0)
+        else if (key == "y_adjust")
         {
-            if (iarg + 1 >= argc)
-                return false;
-            g_font_name = argv[++iarg];
+            if ((ok = is_number))
+                job.m_y_adjust = member.m_num;
         }
-        else if (_tcscmp(arg, _T("--text-color")) == 0)
+        else if (key == "letters_per_page")
         {
-            if (iarg + 1 >= argc)
-                return false;
-            uint32_t value = color_value_parse(ansi_from_wide(argv[++iarg]).c_str());
-            if (value == uint32_t(-1))
-                return false;
-            g_text_color = value;
+            ok = is_number && member.m_num == std::floor(member.m_num) && member.m_num != 0 &&
+                 member.m_num >= -1 && member.m_num <= INT_MAX;
+            if (ok)
+                job.m_letters_per_page = int(member.m_num);
         }
-        else if (_tcscmp(arg, _T("--back-color")) == 0)
+        else if (key == "vertical")
         {
-            if (iarg + 1 >= argc)
-                return false;
-            uint32_t value = color_value_parse(ansi_from_wide(argv[++iarg]).c_str());
-            if (value == uint32_t(-1))
-                return false;
-            g_back_color = value;
+            if ((ok = is_bool))
+                job.m_vertical = member.m_bool;
         }
-        else if (_tcscmp(arg, _T("--letters-per-page")) == 0)
+        else if (key == "auto_wrap")
         {
-            if (iarg + 1 >= argc)
-                return false;
-            g_letters_per_page = _ttoi(argv[++iarg]);
-            if (g_letters_per_page == 0)
-                return false;
+            if ((ok = is_bool))
+                job.m_auto_wrap = member.m_bool;
         }
         else
         {
+            *error = "Unknown key \"" + key + "\"";
+            return false;
+        }
+
+        if (!ok)
+        {
+            *error = "Invalid value of \"" + key + "\"";
             return false;
         }
     }
@@ -1458,333 +417,742 @@ bool pdfplaca_parse_cmdline(int argc, _TCHAR **argv)
     return true;
 }
 
-// 横書きの1ページを描画する。
-bool pdfplaca_draw_h_page(cairo_t *cr, const std::vector<std::string>& rows, double page_width, double page_height, double printable_width, double printable_height, double margin)
+// ジョブファイルの空でない行と、その行番号を読み込む。
+bool pdfplaca_read_job_lines(const _TCHAR *batch_file, std::vector<std::string>& lines, std::vector<int>& line_numbers)
 {
-    double y = margin;
-    double row_height = (page_height - margin * (rows.size() + 1)) / rows.size();
-    for (size_t iRow = 0; iRow < rows.size(); ++iRow)
+    FILE *fp = (_tcscmp(batch_file, _T("-")) == 0) ? stdin : _tfopen(batch_file, _T("rb"));
+    if (!fp)
     {
-        // Fill text background
-        cairo_save(cr); // Save drawing status
-        {
-            auto r = get_r_value(g_back_color);
-            auto g = get_g_value(g_back_color);
-            auto b = get_b_value(g_back_color);
-            cairo_set_source_rgb(cr, r / 255.0, g / 255.0, b / 255.0);
-            cairo_rectangle(cr, margin, y, printable_width, row_height);
-            cairo_fill(cr);
-        }
-        cairo_restore(cr); // Restore drawing status
-        // Draw horizontal text
+        _ftprintf(stderr, _T("ERROR: Cannot open '%s'\n"), batch_file);
+        return false;
+    }
+
+    std::string line;
+    for (int line_number = 1, eof = 0; !eof; ++line_number)
+    {
+        line.clear();
+        for (;;)
         {
-            auto r = get_r_value(g_text_color);
-            auto g = get_g_value(g_text_color);
-            auto b = get_b_value(g_text_color);
-            cairo_set_source_rgb(cr, r / 255.0, g / 255.0, b / 255.0);
-            pdf_draw_h_text(cr, rows[iRow].c_str(), margin, y, printable_width, row_height, g_threshold);
+            int ch = getc(fp);
+            if (ch == EOF)
+            {
+                eof = 1;
+                break;
+            }
+            if (ch == '\n')
+                break;
+            line += char(ch);
         }
-        // Advance
-        y += row_height;
-        // Advance
-        y += margin;
+        if (line_number == 1 && line.compare(0, 3, "\xEF\xBB\xBF") == 0) // UTF-8 BOM?
+            line.erase(0, 3);
+        if (line.find_first_not_of(" \t\r") == line.npos) // 空行は無視。
+            continue;
+        lines.push_back(line);
+        line_numbers.push_back(line_number);
     }
-
+    if (fp != stdin)
+        fclose(fp);
     return true;
 }
 
-// 縦書きの1ページを描画する。
-bool pdfplaca_draw_v_page(cairo_t *cr, const std::vector<std::string>& rows, double page_width, double page_height, double printable_width, double printable_height, double margin)
+// ジョブファイルの各行のジョブを一つのプロセスで描画する。作業者スレッドごとに文脈を持つので、
+// フォントフェイス、メトリックス、フォントのプロファイルは作業者ごとに一度だけ求める。
+// 作業者は空けば他の作業者のジョブを盗む。失敗したジョブは入力の順番に報告して、残りのジョブを続ける。
+bool pdfplaca_batch(const _TCHAR *batch_file, int num_threads)
 {
-    double x = 0;
-    double row_width = (page_width - margin * (rows.size() + 1)) / rows.size();
-    for (size_t iRow = 0; iRow < rows.size(); ++iRow)
-    {
-        // Advance
-        x += margin;
-        // Convert X coordinate
-        double x0 = (2 * margin + printable_width) - (x + row_width);
-        // Fill text background
-        cairo_save(cr); // Save drawing status
+    std::vector<std::string> lines;
+    std::vector<int> line_numbers;
+    if (!pdfplaca_read_job_lines(batch_file, lines, line_numbers))
+        return false;
+
+    if (num_threads <= 0)
+        num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<PLACARD_CONTEXT *> contexts(num_threads);
+    for (auto& ctx : contexts)
+        ctx = pdfplaca_create_context();
+
+    // 出力が"-"のジョブはメモリーに描画して、ジョブの順番に標準出力に書き込む。
+    std::vector<std::string> errors(lines.size()), pdfs(lines.size());
+    std::vector<char> to_stdout(lines.size(), 0);
+    int num_failed = 0;
+    bool any_stdout = false;
+    work_stealing_for(num_threads, lines.size(), [&](int iworker, size_t ijob) {
+        PLACARD_JOB job = g_job;
+        job.m_verbose = false;
+        job.m_layout_threads = 1; // ジョブごとに並列にするので、ページは並列にしない。
+        JSON_OBJECT object;
+        std::string& error = errors[ijob];
+        if (lines[ijob].find('\0') != lines[ijob].npos || !json_parse_object(lines[ijob].c_str(), object, &error))
         {
-            auto r = get_r_value(g_back_color);
-            auto g = get_g_value(g_back_color);
-            auto b = get_b_value(g_back_color);
-            cairo_set_source_rgb(cr, r / 255.0, g / 255.0, b / 255.0);
-            cairo_rectangle(cr, x0, margin, row_width, printable_height);
-            cairo_fill(cr);
+            error = error.empty() ? "Invalid JSON object" : "Invalid JSON object: " + error;
         }
-        cairo_restore(cr); // Restore drawing status
-        // Draw vertical text
-        cairo_save(cr); // Save drawing status
+        else if (pdfplaca_job_from_json(object, job, &error))
         {
-            auto r = get_r_value(g_text_color);
-            auto g = get_g_value(g_text_color);
-            auto b = get_b_value(g_text_color);
-            cairo_set_source_rgb(cr, r / 255.0, g / 255.0, b / 255.0);
-            if (g_fixed_pitch_font && pdf_is_font_japanese(cr))
-                pdf_draw_v_text_fixed(cr, rows[iRow].c_str(), x0, margin, row_width, printable_height, g_threshold);
-            else
-                pdf_draw_v_text(cr, rows[iRow].c_str(), x0, margin, row_width, printable_height, g_threshold);
+            to_stdout[ijob] = (job.m_out_file == _T("-"));
+            if (to_stdout[ijob] ? !pdfplaca_render_to_memory(contexts[iworker], job, pdfs[ijob])
+                                : !pdfplaca_render(contexts[iworker], job))
+            {
+                error = "Cannot render '" + ansi_from_wide(job.m_out_file.c_str()) + "'";
+            }
         }
-        cairo_restore(cr); // Restore drawing status
-        // Advance
-        x += row_width;
-    }
+    }, [&](size_t ijob) {
+        if (to_stdout[ijob])
+        {
+            if (!any_stdout)
+            {
+#ifdef _WIN32
+                _setmode(_fileno(stdout), _O_BINARY);
+#endif
+                any_stdout = true;
+            }
+            auto& pdf = pdfs[ijob];
+            if (errors[ijob].empty() &&
+                pdfplaca_write_to_stdio(stdout, reinterpret_cast<const unsigned char *>(pdf.data()),
+                                        unsigned(pdf.size())) != CAIRO_STATUS_SUCCESS)
+            {
+                errors[ijob] = "Cannot write to stdout";
+            }
+            std::string().swap(pdf);
+        }
+        if (errors[ijob].size())
+        {
+            ++num_failed;
+            fprintf(stderr, "ERROR: Line %d: %s\n", line_numbers[ijob], errors[ijob].c_str());
+        }
+    });
+    if (any_stdout && fflush(stdout) != 0)
+        ++num_failed;
+
+    for (auto ctx : contexts)
+        pdfplaca_destroy_context(ctx);
+
+    // ジョブの処理速度を表示する。
+    int num_jobs = int(lines.size());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(any_stdout ? stderr : stdout, "%d jobs (%d failed) on %d threads in %.3f sec (%.1f jobs/sec)\n",
+            num_jobs, num_failed, num_threads, seconds, seconds > 0 ? num_jobs / seconds : 0.0);
+    return num_failed == 0;
+}
+
+#ifdef _WIN32
+    typedef SOCKET PDF_SOCKET;
+    #define pdf_close_socket closesocket
+    #define pdf_poll WSAPoll
+    typedef ULONG PDF_NFDS;
+    #define PDF_SHUT_WR SD_SEND
+    #define PDF_SEND_FLAGS 0
+#else
+    typedef int PDF_SOCKET;
+    #define INVALID_SOCKET (-1)
+    #define pdf_close_socket close
+    #define pdf_poll poll
+    typedef nfds_t PDF_NFDS;
+    #define PDF_SHUT_WR SHUT_WR
+    #ifdef MSG_NOSIGNAL
+        #define PDF_SEND_FLAGS MSG_NOSIGNAL
+    #else
+        #define PDF_SEND_FLAGS 0
+    #endif
+#endif
 
+// --serveの要求の最大の大きさ。
+#define PDFPLACA_SERVE_MAX_REQUEST (16 * 1024 * 1024)
+
+// --serveの応答の状態。
+#define PDFPLACA_SERVE_OK       0   // 本体はPDF。
+#define PDFPLACA_SERVE_ERROR    1   // 本体はエラーメッセージ（UTF-8）。
+
+// ソケットからちょうどsizeバイトを受け取る。
+bool pdfplaca_recv_all(PDF_SOCKET sock, void *data, size_t size)
+{
+    char *pch = reinterpret_cast<char *>(data);
+    while (size > 0)
+    {
+        int chunk = int(std::min<size_t>(size, 1 << 20));
+        int got = int(recv(sock, pch, chunk, 0));
+        if (got <= 0)
+            return false;
+        pch += got;
+        size -= got;
+    }
     return true;
 }
 
-// ページを描画する。
-bool pdfplaca_draw_page(cairo_t *cr, const char *utf8_text, double page_width, double page_height, double printable_width, double printable_height, double margin)
+// ソケットにちょうどsizeバイトを送る。
+bool pdfplaca_send_all(PDF_SOCKET sock, const void *data, size_t size)
 {
-    // Split rows
-    std::vector<std::string> rows;
-    u8_split_by_newlines(rows, utf8_text);
+    const char *pch = reinterpret_cast<const char *>(data);
+    while (size > 0)
+    {
+        int chunk = int(std::min<size_t>(size, 1 << 20));
+        int sent = int(send(sock, pch, chunk, PDF_SEND_FLAGS));
+        if (sent <= 0)
+            return false;
+        pch += sent;
+        size -= sent;
+    }
+    return true;
+}
 
-    if (g_vertical) // Vertical writing?
-        return pdfplaca_draw_v_page(cr, rows, page_width, page_height, printable_width, printable_height, margin);
-    else
-        return pdfplaca_draw_h_page(cr, rows, page_width, page_height, printable_width, printable_height, margin);
+// 32ビットの値をリトルエンディアンで書き込む。
+inline void pdfplaca_put_le32(unsigned char *data, uint32_t value)
+{
+    data[0] = uint8_t(value);
+    data[1] = uint8_t(value >> 8);
+    data[2] = uint8_t(value >> 16);
+    data[3] = uint8_t(value >> 24);
 }
 
-bool pdfplaca_do_it(const _TCHAR *out_file, const _TCHAR *out_text, const _TCHAR *font_name)
+// 32ビットの値をリトルエンディアンで読み込む。
+inline uint32_t pdfplaca_get_le32(const unsigned char *data)
 {
-    // Get page size in points
-    double page_width = pt_from_mm(g_page_width), page_height = pt_from_mm(g_page_height);
-    printf("page_width: %f pt, page_height: %f pt\n", page_width, page_height);
+    return data[0] | (data[1] << 8) | (data[2] << 16) | (uint32_t(data[3]) << 24);
+}
 
-    // Swap width and height if orientation doesn't match
-    if (_tcsicmp(g_orientation, _T("portrait")) == 0)
-    {
-        if (page_width > page_height)
-            std::swap(page_width, page_height);
-    }
-    else if (_tcsicmp(g_orientation, _T("landscape")) == 0)
-    {
-        if (page_width < page_height)
-            std::swap(page_width, page_height);
-    }
-    else
+// Unix domain socketのアドレスを作る。パスが長すぎればfalseを返す。
+bool pdfplaca_socket_address(const _TCHAR *socket_path, sockaddr_un& addr)
+{
+    std::string path = ansi_from_wide(socket_path, CP_UTF8);
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
     {
-        assert(0);
+        _ftprintf(stderr, _T("ERROR: Invalid socket path '%s'\n"), socket_path);
         return false;
     }
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
 
-    // Get margin in points
-    double margin = pt_from_mm(g_margin);
-
-    // Get printable area in points
-    double printable_width = page_width - 2 * margin;
-    double printable_height = page_height - 2 * margin;
-
-    // Initialize Cairo
-#ifdef UNICODE
-    std::string filename = ansi_from_wide(out_file, CP_ACP);
+// ソケットの機能を初期化する。
+bool pdfplaca_socket_startup(void)
+{
+#ifdef _WIN32
+    WSADATA wsa;
+    return WSAStartup(MAKEWORD(2, 2), &wsa) == 0;
 #else
-    std::string filename = out_file;
+    signal(SIGPIPE, SIG_IGN); // 切断されたクライアントへの書き込みで終了しない。
+    return true;
 #endif
-    cairo_surface_t *surface = cairo_pdf_surface_create(filename.c_str(), page_width, page_height);
-    cairo_t *cr = cairo_create(surface);
+}
 
-    // Get UTF-8 text
-#ifdef UNICODE
-    std::string utf8_text = ansi_from_wide(out_text, CP_UTF8);
+// ソケットの機能を終了する。
+void pdfplaca_socket_cleanup(void)
+{
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+// ソケットを非ブロッキングにする。
+bool pdfplaca_set_nonblocking(PDF_SOCKET sock)
+{
+#ifdef _WIN32
+    u_long nonblocking = 1;
+    return ioctlsocket(sock, FIONBIO, &nonblocking) == 0;
 #else
-    std::string utf8_text = out_text;
+    int flags = fcntl(sock, F_GETFL, 0);
+    return flags != -1 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
 #endif
+}
 
-    // Choose font and font size
-#ifdef UNICODE
-    std::string utf8_font_name = ansi_from_wide(font_name, CP_UTF8);
+// 非ブロッキングのソケットの操作が、待たなければ進めないために失敗したか。
+bool pdfplaca_would_block(void)
+{
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
 #else
-    std::string utf8_font_name = font_name;
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
 #endif
-    cairo_select_font_face(cr, utf8_font_name.c_str(), CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+}
 
-    // Display error if text is CJK and font is not CJK
-    if (u8_is_japanese_text(utf8_text.c_str()))
+// 互いに接続された一対のソケットを作る。
+bool pdfplaca_socket_pair(PDF_SOCKET pair[2])
+{
+#ifdef _WIN32
+    // socketpairがないので、ループバックのTCPで接続する。
+    pair[0] = pair[1] = INVALID_SOCKET;
+    PDF_SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == INVALID_SOCKET)
+        return false;
+    sockaddr_in addr;
+    int addr_len = sizeof(addr);
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0 &&
+        getsockname(listener, reinterpret_cast<sockaddr *>(&addr), &addr_len) == 0 &&
+        listen(listener, 1) == 0)
     {
-        if (!pdf_is_font_japanese(cr))
-        {
-            if (page_width < page_height)
-                utf8_text = u8"  Error:  \n  Not  \nJapanese\nfont";
-            else
-                utf8_text = u8"   Error:   \nNot Japanese font";
-            utf8_font_name = "Arial";
-            g_vertical = false;
-        }
+        pair[1] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (pair[1] != INVALID_SOCKET && connect(pair[1], reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0)
+            pair[0] = accept(listener, nullptr, nullptr);
     }
-    else if (u8_is_chinese_text(utf8_text.c_str()))
+    closesocket(listener);
+    if (pair[0] != INVALID_SOCKET)
+        return true;
+    if (pair[1] != INVALID_SOCKET)
+        closesocket(pair[1]);
+    return false;
+#else
+    return socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0;
+#endif
+}
+
+// 応答の見出し（4バイトの状態と4バイトの本体の長さ、リトルエンディアン）を書き込む。
+// responseは見出しの8バイトの後ろに本体を持つこと。
+void pdfplaca_serve_set_header(std::string& response, uint32_t status)
+{
+    auto head = reinterpret_cast<unsigned char *>(&response[0]);
+    pdfplaca_put_le32(&head[0], status);
+    pdfplaca_put_le32(&head[4], uint32_t(response.size() - 8));
+}
+
+// 一つの要求（JSONオブジェクト）を処理して、見出し付きの応答を作る。
+void pdfplaca_serve_request(PLACARD_CONTEXT *ctx, const std::string& request, std::string& response)
+{
+    PLACARD_JOB job = g_job;
+    job.m_verbose = false;
+    job.m_layout_threads = 1; // 要求ごとに並列にするので、ページは並列にしない。
+    // 応答の見出しの後ろにPDFを直接描画するので、PDFを写さずに一度で送れる。
+    JSON_OBJECT object;
+    std::string error;
+    response.assign(8, '\0');
+    if (request.find('\0') != request.npos || !json_parse_object(request.c_str(), object, &error))
+        error = error.empty() ? "Invalid JSON object" : "Invalid JSON object: " + error;
+    else if (pdfplaca_job_from_json(object, job, &error))
     {
-        if (!pdf_is_font_chinese(cr))
-        {
-            if (page_width < page_height)
-                utf8_text = u8"  Error:  \n  Not  \nChinese\nfont";
-            else
-                utf8_text = u8"   Error:   \nNot Chinese font";
-            utf8_font_name = "Arial";
-            g_vertical = false;
-        }
+        if (job.m_text_file.size()) // 標準入力やサーバーのファイルは読まない。
+            error = "text_file is not supported by --serve";
+        else if (!pdfplaca_render_to_stream(ctx, job, pdfplaca_write_to_string, &response))
+            error = "Cannot render";
     }
-    else if (u8_is_korean_text(utf8_text.c_str()))
+
+    if (error.size())
+        response.replace(8, response.npos, error);
+    pdfplaca_serve_set_header(response, error.empty() ? PDFPLACA_SERVE_OK : PDFPLACA_SERVE_ERROR);
+}
+
+// --serveの一つの接続の状態。要求は一つずつ作業者に渡すので、応答は要求の順に返る。
+struct PDFPLACA_SERVE_CLIENT
+{
+    PDF_SOCKET m_sock;
+    std::string m_in;           // 受け取ったが、まだ作業者に渡していないバイト列。
+    std::string m_out;          // 送っている最中の応答。
+    size_t m_sent = 0;          // m_outのうち送ったバイト数。
+    bool m_busy = false;        // 作業者が要求を処理しているか。
+    bool m_closing = false;     // 応答を送ったら、受け取ったものを捨てて切断を待つか。
+};
+
+// 受け取れるだけ受け取る。切断されたらfalseを返す。
+bool pdfplaca_serve_read(PDFPLACA_SERVE_CLIENT& client)
+{
+    const size_t chunk = 64 * 1024;
+    size_t old_size = client.m_closing ? 0 : client.m_in.size();
+    client.m_in.resize(old_size + chunk);
+    int got = int(recv(client.m_sock, &client.m_in[old_size], int(chunk), 0));
+    client.m_in.resize(old_size + std::max(got, 0));
+    if (client.m_closing)
+        client.m_in.clear();
+    return got > 0 || (got < 0 && pdfplaca_would_block());
+}
+
+// 応答の残りを送れるだけ送る。切断されたらfalseを返す。
+bool pdfplaca_serve_write(PDFPLACA_SERVE_CLIENT& client)
+{
+    while (client.m_sent < client.m_out.size())
     {
-        if (!pdf_is_font_korean(cr))
-        {
-            if (page_width < page_height)
-                utf8_text = u8"  Error:  \n  Not  \nKorean\nfont";
-            else
-                utf8_text = u8"   Error:   \nNot Korean font";
-            utf8_font_name = "Arial";
-            g_vertical = false;
-        }
+        int chunk = int(std::min<size_t>(client.m_out.size() - client.m_sent, 1 << 20));
+        int sent = int(send(client.m_sock, client.m_out.data() + client.m_sent, chunk, PDF_SEND_FLAGS));
+        if (sent <= 0)
+            return sent < 0 && pdfplaca_would_block();
+        client.m_sent += sent;
     }
-    cairo_select_font_face(cr, utf8_font_name.c_str(), CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+    std::string().swap(client.m_out);
+    client.m_sent = 0;
+    if (client.m_closing) // すぐに閉じると、未読のデータのせいで応答が届かないことがある。
+        shutdown(client.m_sock, PDF_SHUT_WR);
+    return true;
+}
 
-    // Unescape string
-    utf8_text = mstr_unescape(utf8_text.c_str());
+// --serveを止めるシグナルを受けたか。
+static volatile sig_atomic_t g_serve_quit = 0;
+// 待ち受けのループを起こすソケット。
+static PDF_SOCKET g_serve_wake = INVALID_SOCKET;
 
-    // タブを3スペースに変換する。
-    mstr_replace_all(utf8_text, u8"\t", u8"   ");
+// SIGINTとSIGTERMで待ち受けを止める。
+static void pdfplaca_serve_signal(int)
+{
+    g_serve_quit = 1;
+    char byte = 0;
+    send(g_serve_wake, &byte, 1, PDF_SEND_FLAGS);
+}
 
-    // フォントの種類を表示する。
-    g_fixed_pitch_font = pdf_is_fixed_pitch_font(cr);
-    if (g_fixed_pitch_font)
-        printf("fixed-pitch font\n");
-    else
-        printf("proportional font\n");
+// Unix domain socketで要求を待ち受ける常駐サーバー。作業者スレッドごとに文脈を持ち続けるので、
+// フォントフェイス、メトリックス、レイアウトのキャッシュは温まったまま次の要求で使われる。
+// 要求は4バイトの長さ（リトルエンディアン）とJSONオブジェクト。応答は4バイトの状態と4バイトの長さと本体。
+// 一つのスレッドがpollですべての接続を読み書きして、揃った要求だけを作業者に渡すので、
+// 何もしない接続が作業者を占めることはない。SIGINTかSIGTERMで止まる。
+bool pdfplaca_serve(const _TCHAR *socket_path, int num_threads)
+{
+    sockaddr_un addr;
+    if (!pdfplaca_socket_address(socket_path, addr) || !pdfplaca_socket_startup())
+        return false;
 
-    if (0) // 必要ならば、ちょっとしたテストを行う。
+    PDF_SOCKET server = socket(AF_UNIX, SOCK_STREAM, 0);
+    PDF_SOCKET wake[2];
+    if (server == INVALID_SOCKET || !pdfplaca_socket_pair(wake))
     {
-        cairo_move_to(cr, 150, 100);
-        cairo_line_to(cr, 150, 200);
-        cairo_move_to(cr, 100, 150);
-        cairo_line_to(cr, 200, 150);
-        cairo_set_source_rgb(cr, 1, 0, 0);
-        cairo_stroke(cr);
-
-        auto text = u8"あ";
-        cairo_set_font_size(cr, 30);
-
-        cairo_text_extents_t extents;
-        cairo_text_extents(cr, text, &extents);
-
-        cairo_font_extents_t font_extents;
-        cairo_font_extents(cr, &font_extents);
-
-        double scale_x = 2, scale_y = 3;
-
-        double x = 150, y = 150;
-        cairo_matrix_t matrix;
-#if 0 // -90度回転かつ上下反転
-        cairo_matrix_init(&matrix,
-            0, scale_y, scale_x, 0,
-            x + (font_extents.height - extents.x_bearing) * scale_x,
-            y - font_extents.height * scale_y);
-#elif 0 // +90度回転
-        cairo_matrix_init(&matrix,
-            0, scale_y, -scale_x, 0,
-            x + extents.x_bearing * scale_x,
-            y - font_extents.height * scale_y);
-#else // 移動なし
-        cairo_matrix_init(&matrix,
-            scale_x, 0, 0, scale_y,
-            x, y - font_extents.descent * scale_y);
-#endif
-        cairo_set_matrix(cr, &matrix);
-        cairo_set_source_rgb(cr, 0, 0, 0);
-        cairo_move_to(cr, 0, 0);
-        cairo_show_text(cr, text);
+        fprintf(stderr, "ERROR: Cannot create socket\n");
+        if (server != INVALID_SOCKET)
+            pdf_close_socket(server);
+        pdfplaca_socket_cleanup();
+        return false;
     }
-    else if (g_letters_per_page == -1) // 1ページの文字数に制限がない？
+#ifdef _WIN32
+    DeleteFileW(socket_path); // 前回のソケットファイルを消す。
+#else
+    unlink(addr.sun_path); // 前回のソケットファイルを消す。
+#endif
+    if (bind(server, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(server, SOMAXCONN) != 0 ||
+        !pdfplaca_set_nonblocking(server) || !pdfplaca_set_nonblocking(wake[0]) || !pdfplaca_set_nonblocking(wake[1]))
     {
-        // ページ番号を表示する。
-        printf("Page %d\n", 1);
+        _ftprintf(stderr, _T("ERROR: Cannot listen on '%s'\n"), socket_path);
+        pdf_close_socket(server);
+        pdf_close_socket(wake[0]);
+        pdf_close_socket(wake[1]);
+        pdfplaca_socket_cleanup();
+        return false;
+    }
 
-        // Draw page (one page only)
-        pdfplaca_draw_page(cr, utf8_text.c_str(), page_width, page_height, printable_width, printable_height, margin);
+    if (num_threads <= 0)
+        num_threads = std::max(1, int(std::thread::hardware_concurrency()));
 
-        // New page
-        cairo_show_page(cr);
+    // 揃った要求を作業者に渡し、作業者は応答を返して待ち受けのループを起こす。
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::pair<uint64_t, std::string>> requests, responses; // 接続の番号と要求、応答。
+    bool quit = false;
+    std::vector<std::thread> workers;
+    for (int iworker = 0; iworker < num_threads; ++iworker)
+    {
+        workers.emplace_back([&] {
+            PLACARD_CONTEXT *ctx = pdfplaca_create_context();
+            std::string request, response;
+            for (;;)
+            {
+                uint64_t id;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cond.wait(lock, [&] { return quit || !requests.empty(); });
+                    if (quit)
+                        break;
+                    id = requests.front().first;
+                    request.swap(requests.front().second);
+                    requests.pop_front();
+                }
+                pdfplaca_serve_request(ctx, request, response);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    responses.emplace_back(id, std::move(response));
+                }
+                char byte = 0;
+                send(wake[1], &byte, 1, PDF_SEND_FLAGS);
+            }
+            pdfplaca_destroy_context(ctx);
+        });
     }
-    else if (g_letters_per_page > 0) // 制限がある？
+
+    g_serve_quit = 0;
+    g_serve_wake = wake[1];
+    signal(SIGINT, pdfplaca_serve_signal);
+    signal(SIGTERM, pdfplaca_serve_signal);
+
+    printf("Serving on '%s' with %d threads\n", addr.sun_path, num_threads);
+    fflush(stdout);
+
+    bool ok = true;
+    std::unordered_map<uint64_t, PDFPLACA_SERVE_CLIENT> clients;
+    uint64_t next_id = 0;
+    std::vector<pollfd> fds;
+    std::vector<uint64_t> fd_ids;
+    std::deque<std::pair<uint64_t, std::string>> finished;
+    while (!g_serve_quit)
     {
-        // Delete spaces
-        mstr_replace_all(utf8_text, " ", "");
-        mstr_replace_all(utf8_text, "\t", "");
-        mstr_replace_all(utf8_text, "\r", "");
-        mstr_replace_all(utf8_text, "\n", "");
-        mstr_replace_all(utf8_text, u8"　", "");
-
-        // Split characters
-        std::vector<std::string> chars;
-        u8_split_chars(chars, utf8_text.c_str());
-
-        // Draw pages
-        size_t num_page = (chars.size() + g_letters_per_page - 1) / g_letters_per_page;
-        for (size_t iPage = 0, iChar = 0; iPage < num_page; ++iPage)
+        // 作業者の応答を接続に渡す。応答の前に切断された接続の応答は捨てる。
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.swap(responses);
+        }
+        for (auto& pair : finished)
+        {
+            auto it = clients.find(pair.first);
+            if (it == clients.end())
+                continue;
+            it->second.m_busy = false;
+            it->second.m_out = std::move(pair.second);
+        }
+        finished.clear();
+
+        // 要求を処理していない接続だけ読む。応答が残っていれば書く。
+        fds.clear();
+        fd_ids.clear();
+        fds.push_back({ server, POLLIN, 0 });
+        fds.push_back({ wake[0], POLLIN, 0 });
+        for (auto& pair : clients)
+        {
+            auto& client = pair.second;
+            short events = 0;
+            if (client.m_closing || (!client.m_busy && client.m_out.empty()))
+                events |= POLLIN;
+            if (client.m_out.size())
+                events |= POLLOUT;
+            fds.push_back({ client.m_sock, events, 0 });
+            fd_ids.push_back(pair.first);
+        }
+
+        if (pdf_poll(fds.data(), PDF_NFDS(fds.size()), -1) < 0)
+        {
+#ifndef _WIN32
+            if (errno == EINTR)
+                continue;
+#endif
+            fprintf(stderr, "ERROR: Cannot poll the sockets\n");
+            ok = false;
+            break;
+        }
+
+        if (fds[1].revents)
         {
-            // ページ番号を表示する。
-            printf("Page %d\n", int(iPage + 1));
+            char bytes[256];
+            while (recv(wake[0], bytes, sizeof(bytes), 0) > 0)
+                ;
+        }
 
-            // Limit the number of characters per page
-            std::string str;
-            for (; iChar < (iPage + 1) * g_letters_per_page; ++iChar)
+        if (fds[0].revents)
+        {
+            for (;;)
             {
-                if (iChar < chars.size())
-                    str += chars[iChar];
+                PDF_SOCKET sock = accept(server, nullptr, nullptr);
+                if (sock == INVALID_SOCKET)
+                {
+#ifndef _WIN32
+                    if (errno == ECONNABORTED)
+                        continue;
+#endif
+                    if (!pdfplaca_would_block())
+                    {
+                        fprintf(stderr, "ERROR: Cannot accept a connection\n");
+                        ok = false;
+                    }
+                    break;
+                }
+                if (!pdfplaca_set_nonblocking(sock))
+                {
+                    pdf_close_socket(sock);
+                    continue;
+                }
+                clients[next_id++].m_sock = sock;
             }
+            if (!ok)
+                break;
+        }
 
-            // Draw page
-            pdfplaca_draw_page(cr, str.c_str(), page_width, page_height, printable_width, printable_height, margin);
+        for (size_t ifd = 2; ifd < fds.size(); ++ifd)
+        {
+            auto it = clients.find(fd_ids[ifd - 2]);
+            auto& client = it->second;
+            short revents = fds[ifd].revents;
+            bool keep = !(revents & (POLLERR | POLLNVAL));
+            if (keep && (revents & POLLOUT))
+                keep = pdfplaca_serve_write(client);
+            if (keep && (revents & POLLIN))
+                keep = pdfplaca_serve_read(client);
+            else if (revents & POLLHUP)
+                keep = false;
+
+            // 要求が揃えば作業者に渡す。大きすぎる要求にはエラーを返して、接続を閉じる。
+            if (keep && !client.m_busy && client.m_out.empty() && !client.m_closing && client.m_in.size() >= 4)
+            {
+                uint32_t size = pdfplaca_get_le32(reinterpret_cast<const unsigned char *>(client.m_in.data()));
+                if (size > PDFPLACA_SERVE_MAX_REQUEST)
+                {
+                    client.m_out.assign(8, '\0');
+                    client.m_out += "Request too large";
+                    pdfplaca_serve_set_header(client.m_out, PDFPLACA_SERVE_ERROR);
+                    client.m_in.clear();
+                    client.m_closing = true;
+                }
+                else if (client.m_in.size() - 4 >= size)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    requests.emplace_back(it->first, client.m_in.substr(4, size));
+                    client.m_in.erase(0, 4 + size_t(size));
+                    client.m_busy = true;
+                    cond.notify_one();
+                }
+            }
 
-            // New page
-            cairo_show_page(cr);
+            if (!keep)
+            {
+                pdf_close_socket(client.m_sock);
+                clients.erase(it);
+            }
         }
     }
 
-    // Clean up
-    cairo_destroy(cr);
-    cairo_surface_destroy(surface);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    g_serve_wake = INVALID_SOCKET;
 
-    return true;
-}
+    // 処理中の要求が終わるのを待って、残りの要求は捨てる。
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+        cond.notify_all();
+    }
+    for (auto& worker : workers)
+        worker.join();
+    for (auto& pair : clients)
+        pdf_close_socket(pair.second.m_sock);
+    pdf_close_socket(server);
+    pdf_close_socket(wake[0]);
+    pdf_close_socket(wake[1]);
+#ifdef _WIN32
+    DeleteFileW(socket_path);
+#else
+    unlink(addr.sun_path);
+#endif
+    pdfplaca_socket_cleanup();
 
-// フォントを列挙するコールバック関数。
-static
-INT CALLBACK
-EnumFontFamProc(
-    const LOGFONTW *plf,
-    const TEXTMETRICW *ptm,
-    DWORD FontType,
-    LPARAM lParam)
-{
-    auto pList = reinterpret_cast<std::vector<std::wstring> *>(lParam);
-    if (plf->lfFaceName[0] == L'@') // 縦書きフォントは無視。
-        return TRUE;
-    pList->push_back(plf->lfFaceName);
-    return TRUE;
+    if (ok)
+        printf("Stopped serving on '%s'\n", addr.sun_path);
+    return ok;
 }
 
-// フォントを列挙する。
-void pdfplaca_list_fonts(void)
+// --serveのサーバーに要求を送って、応答までの時間（レイテンシー）を測る。
+// 要求は--batchのジョブファイルの行を順に使う。なければコマンドラインのテキストを使う。
+// --jobsの数だけ接続して同時に送る。失敗した要求はレイテンシーに含めず、別に数える。
+bool pdfplaca_serve_bench(const _TCHAR *socket_path, int num_requests, int num_threads)
 {
-    HDC hDC = CreateCompatibleDC(NULL);
-    std::vector<std::wstring> list;
-    EnumFontFamiliesW(hDC, nullptr, (FONTENUMPROCW)EnumFontFamProc, (LPARAM)&list);
-    DeleteDC(hDC);
+    sockaddr_un addr;
+    if (!pdfplaca_socket_address(socket_path, addr))
+        return false;
 
-    std::sort(list.begin(), list.end());
+    std::vector<std::string> lines;
+    std::vector<int> line_numbers;
+    if (g_batch_file.size())
+    {
+        if (!pdfplaca_read_job_lines(g_batch_file.c_str(), lines, line_numbers))
+            return false;
+    }
+    else
+    {
+        lines.push_back("{\"text\": " + json_quote(ansi_from_wide(g_job.m_text.c_str(), CP_UTF8)) + "}");
+    }
+    if (lines.empty())
+        return false;
 
-    for (auto& entry : list)
+    if (!pdfplaca_socket_startup())
+        return false;
+
+    if (num_threads <= 0)
+        num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+    num_threads = std::min(num_threads, num_requests);
+
+    std::vector<double> latencies; // 成功した要求のレイテンシー（ミリ秒）。
+    latencies.reserve(num_requests);
+    std::vector<std::thread> threads;
+    int num_failed = 0, num_disconnected = 0;
+    size_t num_bytes = 0;
+    std::mutex mutex;
+    auto start = std::chrono::steady_clock::now();
+    for (int iThread = 0; iThread < num_threads; ++iThread)
     {
-        printf("%s\n", ansi_from_wide(entry.c_str(), CP_ACP));
+        threads.emplace_back([&, iThread] {
+            int failed = 0, disconnected = 0;
+            size_t bytes = 0;
+            std::vector<double> times;
+            PDF_SOCKET sock = socket(AF_UNIX, SOCK_STREAM, 0);
+            bool connected = (sock != INVALID_SOCKET &&
+                              connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0);
+            std::string body;
+            for (int iRequest = iThread; iRequest < num_requests; iRequest += num_threads)
+            {
+                if (!connected) // 切断された後の要求は送らずに失敗とする。
+                {
+                    ++failed;
+                    ++disconnected;
+                    continue;
+                }
+                auto& request = lines[iRequest % lines.size()];
+                auto t0 = std::chrono::steady_clock::now();
+                unsigned char header[8];
+                pdfplaca_put_le32(header, uint32_t(request.size()));
+                bool ok = pdfplaca_send_all(sock, header, 4) &&
+                          pdfplaca_send_all(sock, request.data(), request.size()) &&
+                          pdfplaca_recv_all(sock, header, 8);
+                if (ok)
+                {
+                    body.resize(pdfplaca_get_le32(&header[4]));
+                    ok = body.empty() || pdfplaca_recv_all(sock, &body[0], body.size());
+                }
+                double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+                if (!ok)
+                {
+                    connected = false;
+                    ++failed;
+                    ++disconnected;
+                }
+                else if (pdfplaca_get_le32(header) != PDFPLACA_SERVE_OK)
+                {
+                    ++failed;
+                }
+                else
+                {
+                    times.push_back(latency);
+                    bytes += body.size();
+                }
+            }
+            if (sock != INVALID_SOCKET)
+                pdf_close_socket(sock);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            num_failed += failed;
+            num_disconnected += disconnected;
+            num_bytes += bytes;
+            latencies.insert(latencies.end(), times.begin(), times.end());
+        });
     }
+    for (auto& thread : threads)
+        thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    pdfplaca_socket_cleanup();
+
+    // 成功した要求のレイテンシーの百分位数を表示する。
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        size_t index = size_t(std::ceil(p * latencies.size()));
+        return latencies[index ? index - 1 : 0];
+    };
+    printf("%d requests (%d failed, %d on broken connections) on %d connections in %.3f sec (%.1f requests/sec, %.1f KB/request)\n",
+           num_requests, num_failed, num_disconnected, num_threads, seconds, seconds > 0 ? num_requests / seconds : 0.0,
+           latencies.size() ? num_bytes / 1024.0 / latencies.size() : 0.0);
+    if (latencies.size())
+        printf("latency of %d succeeded: p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+               int(latencies.size()), percentile(0.50), percentile(0.99), latencies.back());
+    else
+        printf("latency: no request succeeded\n");
+    return num_failed == 0;
 }
 
 int pdfplaca_main(int argc, _TCHAR **argv)
 {
-    u8_is_japanese_text_unittest();
+    pdfplaca_unittest();
+    json_object_unittest();
+    work_stealing_unittest();
 
     if (!pdfplaca_parse_cmdline(argc, argv))
     {
@@ -1811,10 +1179,38 @@ int pdfplaca_main(int argc, _TCHAR **argv)
         return 0;
     }
 
-    if (!pdfplaca_do_it(g_out_file, g_out_text, g_font_name))
-        return 1;
+    if (g_self_test)
+    {
+        bool ok = pdfplaca_self_test();
+        std::printf(ok ? "self test: OK\n" : "self test: FAILED\n");
+        return ok ? 0 : 1;
+    }
+
+    if (g_bench_name.size())
+        return pdfplaca_bench(ansi_from_wide(g_bench_name.c_str()).c_str()) ? 0 : 1;
+
+    if (g_serve_socket.size())
+        return pdfplaca_serve(g_serve_socket.c_str(), g_num_threads) ? 0 : 1;
+
+    if (g_bench_socket.size())
+        return pdfplaca_serve_bench(g_bench_socket.c_str(), g_bench_requests, g_num_threads) ? 0 : 1;
+
+    if (g_batch_file.size())
+        return pdfplaca_batch(g_batch_file.c_str(), g_num_threads) ? 0 : 1;
+
+    g_job.m_layout_threads = g_num_threads;
+
+#ifdef _WIN32
+    // PDFを標準出力に書くなら、改行を変換しないようにする。
+    if (g_job.m_out_file == _T("-"))
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    PLACARD_CONTEXT *ctx = pdfplaca_create_context();
+    bool ok = pdfplaca_render(ctx, g_job);
+    pdfplaca_destroy_context(ctx);
 
-    return 0;
+    return ok ? 0 : 1;
 }
 
 extern "C"
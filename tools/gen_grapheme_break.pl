@@ -0,0 +1,91 @@
+#!/usr/bin/env perl
+# Generate grapheme_break.h (UAX #29 Grapheme_Cluster_Break and
+# Extended_Pictographic tables) from the Unicode data built into Perl.
+#
+# Usage: perl tools/gen_grapheme_break.pl > grapheme_break.h
+use strict;
+use warnings;
+use Unicode::UCD qw(prop_invlist);
+
+my @props = qw(Other CR LF Control Extend ZWJ Regional_Indicator Prepend
+               SpacingMark L V T LV LVT Extended_Pictographic);
+my $block_shift = 7;
+my $block_size = 1 << $block_shift;
+my $max_cp = 0x110000;
+
+# Fill the property of each codepoint from the inversion lists.
+my @gcb = (0) x $max_cp;
+for my $i (1 .. $#props) {
+    my $name = $props[$i];
+    my @invlist = ($name eq 'Extended_Pictographic') ? prop_invlist('Extended_Pictographic')
+                                                     : prop_invlist("GCB=$name");
+    die "no data for $name" unless @invlist;
+    push @invlist, $max_cp if @invlist % 2;
+    for (my $k = 0; $k < @invlist; $k += 2) {
+        for my $cp ($invlist[$k] .. $invlist[$k + 1] - 1) {
+            # Extended_Pictographic characters are all GCB=Other in this version.
+            die sprintf("U+%04X has two properties", $cp) if $gcb[$cp] && $gcb[$cp] != $i;
+            $gcb[$cp] = $i;
+        }
+    }
+}
+
+# Two-stage table: unique blocks of packed 4-bit properties.
+my (%block_index, @blocks, @stage1);
+for (my $base = 0; $base < $max_cp; $base += $block_size) {
+    my @packed;
+    for (my $cp = $base; $cp < $base + $block_size; $cp += 2) {
+        push @packed, $gcb[$cp] | ($gcb[$cp + 1] << 4);
+    }
+    my $key = join(',', @packed);
+    unless (exists $block_index{$key}) {
+        $block_index{$key} = scalar @blocks;
+        push @blocks, \@packed;
+    }
+    push @stage1, $block_index{$key};
+}
+die "too many blocks" if @blocks > 256;
+
+my $version = Unicode::UCD::UnicodeVersion();
+print "// grapheme_break.h --- UAX #29 grapheme cluster break properties\n";
+print "// Generated by tools/gen_grapheme_break.pl from Unicode $version. Do not edit.\n";
+print "#pragma once\n\n";
+print "#include <cstdint>\n\n";
+print "// Grapheme_Cluster_Break property (plus Extended_Pictographic)\n";
+print "enum U8_GCB : uint8_t\n{\n";
+for my $i (0 .. $#props) {
+    print "    U8_GCB_\U$props[$i]\E = $i,\n";
+}
+print "};\n\n";
+printf "#define U8_GCB_BLOCK_SHIFT %d\n\n", $block_shift;
+
+print "// Block index of each $block_size codepoints\n";
+printf "static const uint8_t g_u8_gcb_stage1[0x%X] =\n{\n", scalar @stage1;
+for (my $i = 0; $i < @stage1; $i += 16) {
+    my $last = $i + 15 < $#stage1 ? $i + 15 : $#stage1;
+    print "    ", join(', ', map { sprintf('%3d', $_) } @stage1[$i .. $last]), ",\n";
+}
+print "};\n\n";
+
+print "// Properties of each block (two 4-bit properties per byte, low nibble first)\n";
+printf "static const uint8_t g_u8_gcb_stage2[%d][%d] =\n{\n", scalar @blocks, $block_size / 2;
+for my $block (@blocks) {
+    print "    {\n";
+    for (my $i = 0; $i < @$block; $i += 16) {
+        print "        ", join(', ', map { sprintf('0x%02X', $_) } @$block[$i .. $i + 15]), ",\n";
+    }
+    print "    },\n";
+}
+print "};\n\n";
+
+print <<'END';
+// Get the grapheme cluster break property of a codepoint
+inline U8_GCB u8_gcb(uint32_t u32)
+{
+    if (u32 >= 0x110000)
+        return U8_GCB_OTHER;
+    uint8_t packed = g_u8_gcb_stage2[g_u8_gcb_stage1[u32 >> U8_GCB_BLOCK_SHIFT]]
+                                    [(u32 & ((1 << U8_GCB_BLOCK_SHIFT) - 1)) >> 1];
+    return U8_GCB((u32 & 1) ? (packed >> 4) : (packed & 0x0F));
+}
+END
@@ -0,0 +1,121 @@
+// work_stealing.h --- Work-stealing parallel loop with in-order completion by katahiromz
+// License: Apache 2.0
+#pragma once
+
+#include <cstddef>              // For size_t
+#include <cassert>              // For assert macro
+#include <vector>               // For std::vector
+#include <deque>                // For std::deque
+#include <thread>               // For std::thread
+#include <mutex>                // For std::mutex
+#include <condition_variable>   // For std::condition_variable
+#include <atomic>               // For std::atomic
+
+// 作業者ごとの作業の両端キュー。持ち主は先頭から取り、他の作業者は末尾から盗む。
+struct WORK_STEALING_QUEUE
+{
+    std::mutex m_mutex;
+    std::deque<size_t> m_items;
+
+    bool pop_front(size_t& item)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_items.empty())
+            return false;
+        item = m_items.front();
+        m_items.pop_front();
+        return true;
+    }
+
+    bool steal_back(size_t& item)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_items.empty())
+            return false;
+        item = m_items.back();
+        m_items.pop_back();
+        return true;
+    }
+};
+
+// 0からnum_items - 1までの項目をnum_threads個の作業者スレッドで処理する。
+// work(iworker, item)は作業者スレッドで呼ばれる。iworkerで作業者ごとの状態を選べる。
+// done(item)は呼び出し元のスレッドで項目の順番に呼ばれる。その項目とそれより前の項目が
+// すべて終わり次第呼ぶので、処理中でも入力の順番どおりに報告できる。
+// 項目は作業者に順番に配るので、先頭の項目から先に終わりやすい。
+template <typename T_WORK, typename T_DONE>
+void work_stealing_for(int num_threads, size_t num_items, T_WORK work, T_DONE done)
+{
+    if (num_threads < 1)
+        num_threads = 1;
+    if (size_t(num_threads) > num_items)
+        num_threads = int(num_items ? num_items : 1);
+
+    std::vector<WORK_STEALING_QUEUE> queues(num_threads);
+    for (size_t item = 0; item < num_items; ++item)
+        queues[item % num_threads].m_items.push_back(item);
+
+    std::mutex done_mutex;
+    std::condition_variable done_cond;
+    std::vector<char> finished(num_items, 0);
+
+    auto worker = [&](int iworker) {
+        for (;;)
+        {
+            size_t item;
+            bool found = queues[iworker].pop_front(item);
+            for (int i = 1; !found && i < num_threads; ++i)
+                found = queues[(iworker + i) % num_threads].steal_back(item);
+            if (!found) // 項目は後から増えないので、どこにもなければ終わり。
+                break;
+
+            work(iworker, item);
+
+            std::lock_guard<std::mutex> lock(done_mutex);
+            finished[item] = 1;
+            done_cond.notify_one();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int iworker = 0; iworker < num_threads; ++iworker)
+        threads.emplace_back(worker, iworker);
+
+    for (size_t item = 0; item < num_items; ++item)
+    {
+        {
+            std::unique_lock<std::mutex> lock(done_mutex);
+            done_cond.wait(lock, [&] { return finished[item] != 0; });
+        }
+        done(item);
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+inline void work_stealing_unittest(void)
+{
+#ifndef NDEBUG
+    for (int num_threads : { 1, 3, 8 })
+    {
+        for (size_t num_items : { size_t(0), size_t(1), size_t(5), size_t(1000) })
+        {
+            std::vector<std::atomic<int>> counts(num_items);
+            std::vector<char> worker_busy(num_threads, 0);
+            size_t next = 0;
+            work_stealing_for(num_threads, num_items, [&](int iworker, size_t item) {
+                assert(0 <= iworker && iworker < num_threads);
+                assert(!worker_busy[iworker]); // 作業者ごとの状態は同時に使われない。
+                worker_busy[iworker] = 1;
+                ++counts[item];
+                worker_busy[iworker] = 0;
+            }, [&](size_t item) {
+                assert(item == next++);
+                assert(counts[item] == 1);
+            });
+            assert(next == num_items);
+        }
+    }
+#endif
+}